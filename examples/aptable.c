@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <netinet/ether.h>
+
+#include "wapi.h"
+
+
+/* Drops the stations heard weaker than "min_signal" in a single batch. */
+static void
+kick_weak(const char *ifname, const wapi_ap_sta_table_t *table, int min_signal)
+{
+	struct ether_addr *macs;
+	size_t n = 0;
+	size_t row;
+	int ret;
+
+	macs = malloc((table->nsta + 1) * sizeof(struct ether_addr));
+	if (!macs) return;
+
+	for (row = 0; row < table->nsta; row++)
+		if ((table->has[row] & WAPI_STA_HAS_SIGNAL) &&
+			table->signal[row] < min_signal)
+			macs[n++] = table->mac[row];
+
+	if (n && (ret = wapi_ap_sta_kick(ifname, macs, n, WAPI_STA_DEAUTH, 0, NULL)) >= 0)
+		printf("kicked: %lu of %lu\n", (unsigned long) (n - ret), (unsigned long) n);
+	free(macs);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	wapi_ap_sta_table_t table;
+	wapi_ap_sta_mon_t *mon;
+	struct pollfd pfd;
+	const char *ifname;
+	int ret;
+
+	/* Parse command line arguments. */
+	if (argc != 2 && argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <IFNAME> [MIN_SIGNAL_DBM]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	ifname = argv[1];
+
+	bzero(&table, sizeof(table));
+	if (wapi_ap_sta_mon_open(NULL, ifname, &table, &mon) < 0)
+		return EXIT_FAILURE;
+
+	pfd.fd = wapi_ap_sta_mon_fd(mon);
+	pfd.events = POLLIN;
+
+	for (ret = 1; ret >= 0; ret = wapi_ap_sta_mon_process(mon))
+	{
+		size_t row;
+
+		if (!ret)
+		{
+			poll(&pfd, 1, -1);
+			continue;
+		}
+
+		printf("stations: %lu\n", (unsigned long) table.nsta);
+		for (row = 0; row < table.nsta; row++)
+		{
+			printf("%s", ether_ntoa(&table.mac[row]));
+			if (table.has[row] & WAPI_STA_HAS_SIGNAL)
+				printf(", signal: %d", table.signal[row]);
+			if (table.has[row] & WAPI_STA_HAS_INACTIVE_TIME)
+				printf(", inactive: %u ms", table.inactive_time[row]);
+			printf(", tx: %u kbps", table.tx_rate[row]);
+			printf(", rx: %u kbps\n", table.rx_rate[row]);
+		}
+
+		if (argc == 3)
+			kick_weak(ifname, &table, atoi(argv[2]));
+	}
+
+	wapi_ap_sta_mon_close(mon);
+	wapi_ap_sta_table_free(&table);
+	return EXIT_FAILURE;
+}
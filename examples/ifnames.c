@@ -14,15 +14,6 @@ getifnames(void)
 			printf(" %s", str->data);
 
 		/* free ifnames */
-		str = list.head.string;
-		while (str)
-		{
-			wapi_string_t *tmp;
-
-			tmp = str->next;
-			free(str->data);
-			free(str);
-			str = tmp;
-		}
+		wapi_list_free(&list);
 	}
 }
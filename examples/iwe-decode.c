@@ -0,0 +1,118 @@
+/*
+ * Feeds the same scan results laid out for native 64-bit readers (padded) and
+ * for compat 32-bit readers (packed) to wapi_scan_decode(), and checks that
+ * both decode alike.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/wireless.h>
+
+#include "wapi.h"
+
+
+#define ESSID "MyNetwork"
+
+
+/* Appends an event with a "lcp" bytes long header, "pad" bytes of padding,
+ * and "n" bytes of value. */
+static size_t
+put(char *buf, size_t off, uint16_t cmd, size_t lcp, size_t pad,
+	const void *value, size_t n)
+{
+	uint16_t len = lcp + pad + n;
+
+	memset(buf + off, 0, len);
+	memcpy(buf + off, &len, 2);
+	memcpy(buf + off + 2, &cmd, 2);
+	memcpy(buf + off + lcp + pad, value, n);
+	return off + len;
+}
+
+
+/* Appends an iw_point event, whose header is padded on both sides for native
+ * 64-bit readers. */
+static size_t
+put_point(char *buf, size_t off, uint16_t cmd, int padded,
+	const char *data, uint16_t length, uint16_t flags)
+{
+	size_t hdr = padded ? 16 : 8;
+	uint16_t len = hdr + length;
+	size_t lcp = padded ? 8 : 4;
+
+	memset(buf + off, 0, len);
+	memcpy(buf + off, &len, 2);
+	memcpy(buf + off + 2, &cmd, 2);
+	memcpy(buf + off + lcp, &length, 2);
+	memcpy(buf + off + lcp + 2, &flags, 2);
+	memcpy(buf + off + hdr, data, length);
+	return off + len;
+}
+
+
+static size_t
+build(char *buf, int padded)
+{
+	size_t lcp = padded ? 8 : 4;
+	struct sockaddr ap;
+	struct iw_freq freq;
+	struct iw_quality qual;
+	size_t off = 0;
+
+	memset(&ap, 0, sizeof(ap));
+	memcpy(ap.sa_data, "\x02\x11\x22\x33\x44\x55", 6);
+	memset(&freq, 0, sizeof(freq));
+	freq.m = 2412;
+	freq.e = 6;
+	memset(&qual, 0, sizeof(qual));
+	qual.level = 0x100 - 50;
+	qual.updated = IW_QUAL_DBM | IW_QUAL_LEVEL_UPDATED;
+
+	off = put(buf, off, SIOCGIWAP, lcp, 0, &ap, sizeof(ap));
+	off = put(buf, off, SIOCGIWFREQ, lcp, 0, &freq, sizeof(freq));
+	off = put_point(
+		buf, off, SIOCGIWESSID, padded, ESSID, strlen(ESSID), 1);
+	off = put(buf, off, IWEVQUAL, lcp, 0, &qual, sizeof(qual));
+
+	return off;
+}
+
+
+static int
+check_cb(const struct wapi_scan_info_t *info, void *arg)
+{
+	int *ok = arg;
+
+	*ok = info->has_essid && !strcmp(info->essid, ESSID) &&
+		info->has_freq && info->freq == 2.412e9 &&
+		info->has_signal && info->signal == -50 &&
+		info->ap.ether_addr_octet[5] == 0x55;
+	return 0;
+}
+
+
+int
+main(void)
+{
+	static const char *layouts[] = {"packed", "padded"};
+	char buf[256];
+	int failed = 0;
+	int padded;
+
+	for (padded = 0; padded <= 1; padded++)
+	{
+		size_t len = build(buf, padded);
+		int ok = 0;
+
+		if (wapi_scan_decode(buf, len, WIRELESS_EXT, check_cb, &ok) < 0)
+			ok = 0;
+		printf("%s: %s\n", layouts[padded], ok ? "ok" : "FAILED");
+		failed |= !ok;
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/ether.h>
+
+#include "wapi.h"
+
+
+int
+main(int argc, char *argv[])
+{
+	int errors[WAPI_SCAN_MULTI_MAX];
+	wapi_scan_table_t table;
+	size_t n;
+	size_t row;
+	size_t k;
+	int ret;
+
+	/* Parse command line arguments. */
+	if (argc < 3 || argc - 2 > WAPI_SCAN_MULTI_MAX)
+	{
+		fprintf(stderr, "Usage: %s <TIMEOUT> <IFNAME>...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	n = argc - 2;
+
+	/* Scan every radio at once. */
+	bzero(&table, sizeof(table));
+	ret = wapi_scan_multi(
+		(const char *const *) argv + 2, n, NULL, atoi(argv[1]), &table, errors);
+	if (ret < 0) return EXIT_FAILURE;
+
+	for (k = 0; k < n; k++)
+		printf("%s: %d\n", argv[2 + k], errors[k]);
+
+	for (row = 0; row < table.nbss; row++)
+	{
+		printf("%s", ether_ntoa(&table.bssid[row]));
+		printf(", freq: %u", table.freq[row]);
+		if (table.has[row] & WAPI_SCAN_HAS_SIGNAL)
+			printf(", signal: %d", table.signal[row]);
+		printf(", radio: %s", argv[2 + table.radio[row]]);
+		printf(", seen by: %#x", table.radios[row]);
+		printf(", essid: %s\n", wapi_scan_table_essid(&table, row));
+	}
+
+	wapi_scan_table_free(&table);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
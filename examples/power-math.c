@@ -0,0 +1,101 @@
+/*
+ * Compares the integer power conversions with their libm counterparts. Build
+ * it for a soft-float target (e.g. mips-openwrt-linux-gcc -msoft-float) to see
+ * what the libm versions cost where there is no FPU.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <net/if.h>
+
+#include "wapi.h"
+
+
+static inline double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int
+libm_mbm2mwatt(int mbm)
+{
+	return floor(pow(10, ((double) mbm) / 1000));
+}
+
+
+static int
+libm_mwatt2mbm(int mwatt)
+{
+	return ceil(1000 * log10(mwatt));
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int n = argc > 1 ? atoi(argv[1]) : 1000000;
+	int *mbms, *mwatts;
+	volatile int sink = 0;
+	double beg, libm_dur, int_dur;
+	int mismatches, maxerr;
+	int k;
+
+	/* Typical telemetry inputs: 0..30 dBm, 1 mW..1 W. */
+	srand(1);
+	mbms = malloc(n * sizeof(int));
+	mwatts = malloc(n * sizeof(int));
+	if (!mbms || !mwatts)
+		return EXIT_FAILURE;
+	for (k = 0; k < n; k++)
+	{
+		mbms[k] = rand() % 3001;
+		mwatts[k] = 1 + rand() % 1000;
+	}
+
+	/* Exactness of the integer dBm conversions over their whole domain. */
+	for (mismatches = 0, k = -100; k <= 93; k++)
+		if (wapi_dbm2mwatt(k) != (int) floor(pow(10, k / 10.0)))
+			mismatches++;
+	for (k = 1; k <= 10000000; k++)
+		if (wapi_mwatt2dbm(k) != (int) ceil(10 * log10(k)))
+			mismatches++;
+	printf("dBm mismatches: %d\n", mismatches);
+
+	/* Error of the mBm conversions. */
+	for (maxerr = 0, k = 0; k < 9332; k++)
+	{
+		int err = abs(wapi_mbm2mwatt(k) - libm_mbm2mwatt(k));
+		if (err > maxerr) maxerr = err;
+	}
+	printf("mbm2mwatt max error: %d mW\n", maxerr);
+	for (maxerr = 0, k = 1; k <= 10000000; k++)
+	{
+		int err = abs(wapi_mwatt2mbm(k) - libm_mwatt2mbm(k));
+		if (err > maxerr) maxerr = err;
+	}
+	printf("mwatt2mbm max error: %d mBm\n", maxerr);
+
+	beg = now();
+	for (k = 0; k < n; k++)
+		sink += libm_mbm2mwatt(mbms[k]) + libm_mwatt2mbm(mwatts[k]);
+	libm_dur = now() - beg;
+
+	beg = now();
+	for (k = 0; k < n; k++)
+		sink += wapi_mbm2mwatt(mbms[k]) + wapi_mwatt2mbm(mwatts[k]);
+	int_dur = now() - beg;
+
+	printf("libm: %.1f ns/pair\n", libm_dur * 1e9 / n);
+	printf("integer: %.1f ns/pair\n", int_dur * 1e9 / n);
+
+	free(mbms);
+	free(mwatts);
+	return EXIT_SUCCESS;
+}
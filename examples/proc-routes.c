@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+
+#include "wapi.h"
+
+
+static inline double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Writes a header and @a n random rows in @c /proc/net/route format to @a fp.
+ */
+static void
+fill(FILE *fp, int n)
+{
+	int k;
+
+	fprintf(
+		fp, "%-127s\n",
+		"Iface\tDestination\tGateway \tFlags\tRefCnt\tUse\tMetric\tMask"
+		"\t\tMTU\tWindow\tIRTT");
+	for (k = 0; k < n; k++)
+	{
+		char row[128];
+		int prefixlen = 8 + rand() % 25;
+		unsigned int mask = 0xFFFFFFFFu >> (32 - prefixlen);
+		snprintf(
+			row, sizeof(row), "eth%d\t%08X\t%08X\t%04X\t%d\t%d\t%d\t%08X\t%d\t%d\t%d",
+			k % 4, ((unsigned int) rand() << 1 ^ rand()) & mask,
+			0x0100000A + (k << 8), 0x0003, 0, rand() % 100, rand() % 4, mask,
+			0, 0, 0);
+		fprintf(fp, "%-127s\n", row);
+	}
+}
+
+
+/**
+ * The classic stdio parser, as wapi_get_routes_proc() used to do it.
+ */
+static int
+legacy(const char *path, wapi_list_t *list)
+{
+	char buf[WAPI_PROC_LINE_SIZE];
+	FILE *fp;
+
+	if (!(fp = fopen(path, "r")))
+		return -1;
+
+	/* Skip the header. */
+	if (!fgets(buf, sizeof(buf), fp))
+	{
+		fclose(fp);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), fp))
+	{
+		wapi_route_info_t *ri;
+		char ifname[WAPI_PROC_LINE_SIZE];
+		int refcnt, use, metric, mtu, window, irtt;
+		unsigned int dest, gw, flags, netmask;
+
+		if (!(ri = calloc(1, sizeof(wapi_route_info_t))))
+			break;
+		sscanf(
+			buf, "%s\t%x\t%x\t%x\t%d\t%d\t%d\t%x\t%d\t%d\t%d\t",
+			ifname, &dest, &gw, &flags, &refcnt, &use, &metric, &netmask, &mtu,
+			&window, &irtt);
+		ri->ifname = strdup(ifname);
+		ri->dest.s_addr = dest;
+		ri->gw.s_addr = gw;
+		ri->flags = flags;
+		ri->use = use;
+		ri->metric = metric;
+		ri->netmask.s_addr = netmask;
+		ri->next = list->head.route;
+		list->head.route = ri;
+	}
+
+	fclose(fp);
+	list->type = WAPI_LIST_ROUTE;
+	return 0;
+}
+
+
+/**
+ * Folds parsed fields, so that both parsers can be compared.
+ */
+static unsigned int
+sum(const wapi_list_t *list, int *n)
+{
+	const wapi_route_info_t *ri;
+	unsigned int s = 0;
+
+	for (*n = 0, ri = list->head.route; ri; ri = ri->next, (*n)++)
+		s = s * 31 + (ri->dest.s_addr ^ ri->gw.s_addr ^ ri->netmask.s_addr ^
+			ri->flags ^ ri->use ^ ri->metric ^ ri->ifname[3]);
+
+	return s;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int nrows = argc > 1 ? atoi(argv[1]) : 100000;
+	int nrounds = argc > 2 ? atoi(argv[2]) : 10;
+	char path[] = "/tmp/wapi-routes-XXXXXX";
+	double beg, legacy_dur, file_dur;
+	unsigned int legacy_sum = 0, file_sum = 0;
+	int legacy_n = 0, file_n = 0;
+	wapi_list_t list;
+	wapi_arena_t *arena;
+	FILE *fp;
+	int fd;
+	int k;
+
+	if (nrows < 0 || nrounds <= 0)
+	{
+		fprintf(stderr, "Usage: %s [nrows [nrounds]], nrounds > 0\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Write a synthetic table. */
+	srand(1);
+	if ((fd = mkstemp(path)) < 0 || !(fp = fdopen(fd, "w")))
+		return EXIT_FAILURE;
+	fill(fp, nrows);
+	fclose(fp);
+
+	/* stdio and sscanf(), one malloc() per node and string. */
+	bzero(&list, sizeof(wapi_list_t));
+	legacy_dur = 0;
+	for (k = 0; k < nrounds; k++)
+	{
+		beg = now();
+		legacy(path, &list);
+		legacy_dur += now() - beg;
+		legacy_sum = sum(&list, &legacy_n);
+		wapi_list_free(&list);
+	}
+
+	/* Whole file pread(), in place scanning, arena backed list. */
+	if (wapi_arena_create(0, &arena) < 0)
+		return EXIT_FAILURE;
+	wapi_list_init(&list, arena);
+	file_dur = 0;
+	for (k = 0; k < nrounds; k++)
+	{
+		beg = now();
+		if (wapi_get_routes_file(path, &list) < 0)
+			return EXIT_FAILURE;
+		file_dur += now() - beg;
+		file_sum = sum(&list, &file_n);
+		wapi_list_free(&list);
+		wapi_arena_reset(arena);
+	}
+	wapi_arena_destroy(arena);
+	unlink(path);
+
+	printf("rows: %d/%d, checksums: %08x/%08x\n", legacy_n, file_n, legacy_sum, file_sum);
+	printf("legacy: %.2f ms/file\n", legacy_dur * 1e3 / nrounds);
+	printf("pread: %.2f ms/file\n", file_dur * 1e3 / nrounds);
+
+	return (legacy_n == file_n && legacy_sum == file_sum) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
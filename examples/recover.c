@@ -2,7 +2,9 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/timeb.h>
+#include <netinet/ether.h>
 
 #include "wapi.h"
 
@@ -16,14 +18,93 @@ epoch_millitm(void)
 }
 
 
+/* Looks for an AP with the given ESSID among collected APs. */
+static double
+find_essid(const wapi_list_t *list, const char *essid)
+{
+	wapi_scan_info_t *info;
+
+	for (info = list->head.scan; info; info = info->next)
+		if (info->has_essid && info->has_freq && !strcmp(info->essid, essid))
+			return info->freq;
+
+	return -1;
+}
+
+
+/* Switches to the AP freq and ESSID. */
+static int
+recover_switch(int sock, const char *ifname, const char *essid, double freq)
+{
+	int ret;
+
+	if ((ret = wapi_set_freq(sock, ifname, freq, WAPI_FREQ_FIXED)) >= 0)
+		ret = wapi_set_essid(sock, ifname, essid, WAPI_ESSID_ON);
+
+	return ret;
+}
+
+
+/* Connects via nl80211, using cached scan results as BSS hints and probing
+ * only for the given ESSID on the given channels otherwise. Returns -ENOTSUP,
+ * if nl80211 is not available. */
+static int
+recover_for_essid_nl(
+	const char *ifname,
+	const char *essid,
+	const unsigned int *freqs,
+	size_t nfreqs,
+	unsigned int maxdur)
+{
+	wapi_connect_params_t params;
+	wapi_connect_info_t info;
+	int ret;
+
+	bzero(&params, sizeof(params));
+	params.essid = essid;
+	params.freqs = freqs;
+	params.nfreqs = nfreqs;
+	params.max_age = 1000;
+	params.timeout = maxdur;
+
+	ret = wapi_connect(ifname, &params, &info);
+	switch (ret)
+	{
+	case 0:
+		printf(
+			"bssid: %s, freq: %u, scanned: %d\n",
+			ether_ntoa(&info.bssid), info.freq, info.scanned);
+		printf(
+			"hint: %lu us, scan: %lu us, connect: %lu us, total: %lu us\n",
+			info.hint_time, info.scan_time, info.connect_time,
+			info.total_time);
+		return 0;
+
+	case -EALREADY:
+		return 0;
+
+	case -ENOENT:
+	case -ETIMEDOUT:
+		return 1;
+
+	case -ECONNREFUSED:
+	case -ECONNRESET:
+		return ret;
+
+	default:
+		return -ENOTSUP;
+	}
+}
+
+
+/* Sweeps every channel via wireless extensions. */
 static int
-recover_for_essid(
+recover_for_essid_we(
 	int sock, const char *ifname, const char *essid, unsigned int maxdur)
 {
 	const unsigned int maxtm = epoch_millitm() + maxdur;
 	const unsigned int sleepdur = 100;
 	wapi_list_t list;
-	wapi_scan_info_t *info;
 	double freq;
 	int ret;
 
@@ -33,42 +114,31 @@ scan:
 		return ret;
 
 	/* Wait for scan to complete. */
-	for (;epoch_millitm() <= maxtm; usleep(sleepdur * 1000))
-		switch ((ret = wapi_scan_stat(sock, ifname)))
-		{
-		case 0: break;
-		case 1: continue;
-		default: return ret;
-		}
-
-	/* Data is not ready. */
-	if (ret == 1) return 1;
+	while ((ret = wapi_scan_stat(sock, ifname)) == 1)
+	{
+		/* Data is not ready. */
+		if (epoch_millitm() > maxtm) return 1;
+		usleep(sleepdur * 1000);
+	}
+	if (ret < 0) return ret;
 
 	/* Collect results. */
+	bzero(&list, sizeof(wapi_list_t));
 	if ((ret = wapi_scan_coll(sock, ifname, &list)) < 0)
 		return ret;
 
 	/* See if we have an AP with the given ESSID. */
-	freq = -1;
-	for (info = list.head.scan; info; info = info->next)
-		if (info->has_essid && info->has_freq && !strcmp(info->essid, essid))
-		{
-			freq = info->freq;
-			break;
-		}
+	freq = find_essid(&list, essid);
+	wapi_list_free(&list);
 
-	/* If no such AP, try again. */
+	/* If no such AP, try again while time permits. */
 	if (freq < 0)
 	{
-		ret = 1;
+		if (epoch_millitm() > maxtm) return 1;
 		goto scan;
 	}
 
-	/* Switch to AP freq and ESSID. */
-	if ((ret = wapi_set_freq(sock, ifname, freq, WAPI_FREQ_FIXED)) > 0)
-		ret = wapi_set_essid(sock, ifname, essid, WAPI_ESSID_ON);
-
-	return ret;
+	return recover_switch(sock, ifname, essid, freq);
 }
 
 
@@ -78,22 +148,35 @@ main(int argc, char *argv[])
 	const char *ifname;
 	const char *essid;
 	unsigned int maxdur;
+	unsigned int *freqs;
+	size_t nfreqs;
+	size_t i;
 	int sock;
 	int ret;
 
 	/* Parse command line arguments. */
-	if (argc != 4)
+	if (argc < 4)
 	{
-		fprintf(stderr, "Usage: %s <IFNAME> <ESSID> <MAXDUR>\n", argv[0]);
+		fprintf(
+			stderr, "Usage: %s <IFNAME> <ESSID> <MAXDUR> [FREQ_MHZ...]\n",
+			argv[0]);
 		return EXIT_FAILURE;
 	}
 	ifname = argv[1];
 	essid = argv[2];
 	maxdur = atoi(argv[3]);
+	nfreqs = argc - 4;
+	freqs = calloc(nfreqs + 1, sizeof(unsigned int));
+	if (!freqs) return EXIT_FAILURE;
+	for (i = 0; i < nfreqs; i++)
+		freqs[i] = atoi(argv[4 + i]);
 
 	if ((sock = wapi_make_socket()) < 0) return EXIT_FAILURE;
-	ret = recover_for_essid(sock, ifname, essid, maxdur);
+	ret = recover_for_essid_nl(ifname, essid, freqs, nfreqs, maxdur);
+	if (ret == -ENOTSUP)
+		ret = recover_for_essid_we(sock, ifname, essid, maxdur);
 	close(sock);
+	free(freqs);
 
 	return ret;
 }
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <net/route.h>
+#include <arpa/inet.h>
+
+#include "wapi.h"
+
+
+static inline double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Finds the longest prefix match by walking the whole list, which is what one
+ * has to do without an index.
+ */
+static const wapi_route_info_t *
+walk(const wapi_list_t *list, const struct in_addr *addr)
+{
+	const wapi_route_info_t *best = NULL;
+	const wapi_route_info_t *ri;
+
+	for (ri = list->head.route; ri; ri = ri->next)
+		if ((addr->s_addr & ri->netmask.s_addr) == ri->dest.s_addr &&
+			(!best || ri->prefixlen > best->prefixlen ||
+			 (ri->prefixlen == best->prefixlen && ri->metric < best->metric)))
+			best = ri;
+
+	return best;
+}
+
+
+/**
+ * Pushes @a n random routes (plus a default route) into @a list.
+ */
+static int
+fill(wapi_list_t *list, int n)
+{
+	wapi_route_info_t *ri;
+	int k;
+
+	for (k = 0; k <= n; k++)
+	{
+		if (!(ri = calloc(1, sizeof(wapi_route_info_t))))
+			return -1;
+		ri->family = AF_INET;
+		ri->flags = RTF_UP | RTF_GATEWAY;
+		ri->prefixlen = k ? 8 + rand() % 25 : 0;
+		ri->netmask.s_addr =
+			ri->prefixlen ? htonl(0xFFFFFFFFu << (32 - ri->prefixlen)) : 0;
+		ri->dest.s_addr = ((unsigned int) rand() << 1 ^ rand()) & ri->netmask.s_addr;
+		ri->gw.s_addr = htonl(0x0A000001 + k);
+		ri->metric = rand() % 4;
+		ri->next = list->head.route;
+		list->head.route = ri;
+	}
+
+	return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int nroutes = argc > 1 ? atoi(argv[1]) : 10000;
+	int naddrs = argc > 2 ? atoi(argv[2]) : 100000;
+	wapi_route_index_t *index;
+	const wapi_route_info_t **found;
+	struct in_addr *addrs;
+	wapi_list_t list;
+	double beg, walk_dur, index_dur;
+	int mismatches;
+	int k;
+
+	/* Build a synthetic table and destinations. */
+	srand(1);
+	bzero(&list, sizeof(wapi_list_t));
+	addrs = malloc(naddrs * sizeof(struct in_addr));
+	found = malloc(naddrs * sizeof(wapi_route_info_t *));
+	if (!addrs || !found || fill(&list, nroutes) < 0)
+		return EXIT_FAILURE;
+	for (k = 0; k < naddrs; k++)
+		addrs[k].s_addr = (unsigned int) rand() << 1 ^ rand();
+
+	beg = now();
+	if (wapi_route_index_build(&list, &index) < 0)
+		return EXIT_FAILURE;
+	printf("build: %.3f ms\n", (now() - beg) * 1e3);
+
+	/* Linear list walk. */
+	beg = now();
+	for (k = 0; k < naddrs; k++)
+		found[k] = walk(&list, &addrs[k]);
+	walk_dur = now() - beg;
+
+	/* Compare with index lookups. */
+	for (mismatches = k = 0; k < naddrs; k++)
+	{
+		const wapi_route_info_t *ri = wapi_route_index_lookup(index, &addrs[k]);
+		if (ri != found[k] &&
+			(!ri || !found[k] || ri->prefixlen != found[k]->prefixlen ||
+			 ri->metric != found[k]->metric))
+			mismatches++;
+	}
+
+	/* Batch lookups. */
+	beg = now();
+	wapi_route_index_lookup_batch(index, addrs, naddrs, found);
+	index_dur = now() - beg;
+
+	printf("routes: %d, lookups: %d, mismatches: %d\n", nroutes, naddrs, mismatches);
+	printf("walk: %.1f ns/lookup\n", walk_dur * 1e9 / naddrs);
+	printf("index: %.1f ns/lookup\n", index_dur * 1e9 / naddrs);
+
+	wapi_route_index_free(index);
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
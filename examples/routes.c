@@ -15,15 +15,6 @@ getroutes(void)
 				inet_ntoa(ri->dest), inet_ntoa(ri->gw), inet_ntoa(ri->netmask));
 
 		/* free routes */
-		ri = list.head.route;
-		while (ri)
-		{
-			wapi_route_info_t *tmpri;
-
-			tmpri = ri->next;
-			free(ri->ifname);
-			free(ri);
-			ri = tmpri;
-		}
+		wapi_list_free(&list);
 	}
 }
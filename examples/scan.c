@@ -6,26 +6,42 @@ scan(int sock, const char *ifname)
 {
 	int sleepdur = 1;
 	int sleeptries = 5;
+	wapi_scan_mon_t *mon = NULL;
 	wapi_list_t list;
 	wapi_scan_info_t *info;
 	int ret;
 
+	/* subscribe to scan notifications, if nl80211 is around */
+	if (wapi_scan_mon_open(NULL, NULL, &mon) < 0)
+		mon = NULL;
+
 	/* start scan */
 	if (wapi_scan_init(sock, ifname) < 0)
+	{
+		wapi_scan_mon_close(mon);
 		return;
+	}
 
 	/* wait for completion */
-	do {
+	if (mon)
+	{
+		ret = wapi_scan_mon_wait(
+			mon, if_nametoindex(ifname), sleepdur * sleeptries * 1000);
+		wapi_scan_mon_close(mon);
+		if (ret == -ENOBUFS)
+			ret = wapi_scan_stat(sock, ifname);
+	}
+	else do {
 		printf("scan(): sleeptries: %d\n", sleeptries);
 		sleep(sleepdur);
 		ret = wapi_scan_stat(sock, ifname);
 	} while (--sleeptries > 0 && ret > 0);
 
 	/* check wait result */
-	if (ret < 0)
+	if (ret != 0)
 	{
-		if (!sleeptries)
-			fprintf(stderr, "scan(): sleeptries exceeded!\n");
+		if (ret > 0)
+			fprintf(stderr, "scan(): timed out!\n");
 		return;
 	}
 
@@ -44,13 +60,5 @@ scan(int sock, const char *ifname)
 				(info->has_essid ? info->essid : ""));
 
 	/* free ap list */
-	info = list.head.scan;
-	while (info)
-	{
-		wapi_scan_info_t *temp;
-
-		temp = info->next;
-		free(info);
-		info = temp;
-	}
+	wapi_list_free(&list);
 }
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netinet/ether.h>
+
+#include "wapi.h"
+
+
+#define MAX_STAS 64
+
+
+int
+main(int argc, char *argv[])
+{
+	wapi_sta_info_t stas[MAX_STAS];
+	const char *ifname;
+	unsigned int interval;
+	wapi_ctx_t *ctx;
+	int n;
+	int k;
+
+	/* Parse command line arguments. */
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <IFNAME> <INTERVAL_MS>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	ifname = argv[1];
+	interval = atoi(argv[2]);
+
+	/* The context keeps the nl80211 socket open between samples. */
+	if (wapi_ctx_create(&ctx) < 0) return EXIT_FAILURE;
+
+	while ((n = wapi_ctx_sta_dump(ctx, ifname, stas, MAX_STAS)) >= 0)
+	{
+		for (k = 0; k < n && k < MAX_STAS; k++)
+		{
+			const wapi_sta_info_t *sta = &stas[k];
+
+			printf("%s", ether_ntoa(&sta->mac));
+			if (sta->has & WAPI_STA_HAS_SIGNAL)
+				printf(", signal: %d", sta->signal);
+			if (sta->has & WAPI_STA_HAS_TX_RATE)
+				printf(", tx: %u kbps", sta->tx_rate.bitrate);
+			if (sta->has & WAPI_STA_HAS_RX_RATE)
+				printf(", rx: %u kbps", sta->rx_rate.bitrate);
+			if (sta->has & WAPI_STA_HAS_TX_RETRIES)
+				printf(", retries: %u", sta->tx_retries);
+			if (sta->has & WAPI_STA_HAS_TX_FAILED)
+				printf(", failed: %u", sta->tx_failed);
+			if (sta->has & WAPI_STA_HAS_BEACON_LOSS)
+				printf(", beacon loss: %u", sta->beacon_loss);
+			if (sta->has & WAPI_STA_HAS_EXPECTED_THROUGHPUT)
+				printf(", expected: %u kbps", sta->expected_throughput);
+			putchar('\n');
+		}
+		usleep(interval * 1000);
+	}
+
+	wapi_ctx_destroy(ctx);
+	return EXIT_FAILURE;
+}
@@ -95,6 +95,45 @@ int wapi_set_ifup(int sock, const char *ifname);
 int wapi_set_ifdown(int sock, const char *ifname);
 
 
+/** A single entry of an interface state batch. See wapi_set_ifstate(). */
+typedef struct wapi_ifstate_op_t {
+	const char *ifname;	/**< Interface name, used if @c ifindex is zero. */
+	int ifindex;		/**< Interface index. */
+	int up;				/**< Non-zero to activate, zero to shut down. */
+	int error;			/**< Set to zero on success, or to a negative @c errno. */
+} wapi_ifstate_op_t;
+
+
+/**
+ * Activates or shuts down interfaces via rtnetlink. Unlike wapi_set_ifup() and
+ * wapi_set_ifdown(), which read and then write back the whole flag set with
+ * two ioctl() calls, each interface is handled by a single @c RTM_NEWLINK
+ * message that touches nothing but @c IFF_UP (via @c ifi_change). Hence it
+ * does not race with concurrent flag changes. Messages of all entries are
+ * sent at once, and acks are collected in a single pass.
+ *
+ * @param[in,out] ops Interfaces to act on. Results are stored in @c error.
+ *
+ * @return number of failed entries, or negative if requests could not be
+ *     transferred.
+ */
+int wapi_set_ifstate(wapi_ifstate_op_t *ops, size_t n);
+
+
+/**
+ * Activates the interface with a single rtnetlink message.
+ * (See wapi_set_ifstate().)
+ */
+int wapi_set_ifup_nl(const char *ifname);
+
+
+/**
+ * Shuts down the interface with a single rtnetlink message.
+ * (See wapi_set_ifstate().)
+ */
+int wapi_set_ifdown_nl(const char *ifname);
+
+
 /** @} misc/ifaccessors */
 
 
@@ -129,9 +168,134 @@ int wapi_get_netmask(int sock, const char *ifname, struct in_addr *addr);
 int wapi_set_netmask(int sock, const char *ifname, const struct in_addr *addr);
 
 
+/** Address batch actions. */
+typedef enum {
+	WAPI_ADDR_ACT_ADD,		/**< Adds the address, fails if it already exists. */
+	WAPI_ADDR_ACT_REPLACE,	/**< Adds the address, or updates the existing one. */
+	WAPI_ADDR_ACT_DEL		/**< Deletes the address. */
+} wapi_addr_act_t;
+
+
+/** A single entry of an address batch. See wapi_addr_batch(). */
+typedef struct wapi_addr_op_t {
+	wapi_addr_act_t act;
+	const char *ifname;	/**< Interface name, used if @c ifindex is zero. */
+	int ifindex;		/**< Interface index. */
+	const struct wapi_if_addr_t *addr;	/**< Address to act on. */
+	unsigned int valid_lft;		/**< Valid lifetime in seconds, 0 for forever. */
+	unsigned int preferred_lft;	/**< Preferred lifetime in seconds, 0 for forever. */
+	int error;	/**< Set to zero on success, or to a negative @c errno value. */
+} wapi_addr_op_t;
+
+
+/**
+ * Adds, updates, or deletes interface addresses over rtnetlink. Each entry is
+ * a single @c RTM_NEWADDR/@c RTM_DELADDR message carrying address, prefix
+ * length, broadcast address, flags (e.g. @c IFA_F_NOPREFIXROUTE), and
+ * lifetimes at once, and messages of all entries are sent together. In
+ * contrast, wapi_set_ip() followed by wapi_set_netmask() takes two ioctl()
+ * calls, and the kernel installs a classful prefix route in between, which
+ * then gets torn down.
+ *
+ * Following @c wapi_if_addr_t fields are used: @c family, @c prefixlen,
+ * @c flags, @c scope, @c addr/@c addr6, and @c broadcast. For @c AF_INET, an
+ * unset broadcast address is derived from the prefix, as in
+ * <tt>ip addr add ... brd +</tt>.
+ *
+ * Entries that cannot be encoded fail alone without being sent, e.g. with @c
+ * -ENODEV for an unknown @c ifname, or @c -EINVAL for a missing @c addr.
+ *
+ * @param[in,out] ops Addresses to act on. Results are stored in @c error.
+ *
+ * @return number of failed entries, or negative if requests could not be
+ *     transferred.
+ */
+int wapi_addr_batch(wapi_addr_op_t *ops, size_t n);
+
+
+/**
+ * Assigns IPv4 address and prefix length to the interface with a single
+ * rtnetlink message. (See wapi_addr_batch().) Unlike wapi_set_ip(), other
+ * addresses of the interface are left untouched.
+ */
+int
+wapi_set_ip_nl(
+	const char *ifname,
+	const struct in_addr *addr,
+	unsigned int prefixlen);
+
+
 /** @} ip/ifaccessors */
 
 
+/**
+ * @defgroup iftable Interface Table
+ * @ingroup ifaccessors
+ *
+ * Collects link and address state of every interface at once. Instead of
+ * issuing a few @c SIOCGIF* ioctl() calls per interface, a single @c
+ * RTM_GETLINK and a single @c RTM_GETADDR rtnetlink dump is used, regardless
+ * of the number of interfaces.
+ *
+ * @{
+ */
+
+
+/** An interface address. */
+typedef struct wapi_if_addr_t {
+	int family;					/**< @c AF_INET or @c AF_INET6. */
+	unsigned int prefixlen;
+	unsigned int flags;			/**< See @c IFA_F_* in @c linux/if_addr.h. */
+	unsigned char scope;		/**< See @c RT_SCOPE_* in @c linux/rtnetlink.h. */
+	struct in_addr addr;		/**< Address, if @c family is @c AF_INET. */
+	struct in_addr broadcast;	/**< Broadcast, if @c family is @c AF_INET. */
+	struct in6_addr addr6;		/**< Address, if @c family is @c AF_INET6. */
+} wapi_if_addr_t;
+
+
+/** Link state of an interface along with its addresses. */
+typedef struct wapi_if_info_t {
+	int ifindex;
+	char ifname[IFNAMSIZ];
+	unsigned int flags;			/**< See @c IFF_* in @c net/if.h. */
+	unsigned char operstate;	/**< See @c IF_OPER_* in @c linux/if.h. */
+	unsigned short type;		/**< See @c ARPHRD_* in @c net/if_arp.h. */
+	unsigned int mtu;
+	int has_mac;
+	struct ether_addr mac;
+	unsigned int naddrs;
+	wapi_if_addr_t *addrs;		/**< Points into @c wapi_if_table_t::addrs. */
+} wapi_if_info_t;
+
+
+/** Interface table. Records are sorted by interface index. */
+typedef struct wapi_if_table_t {
+	size_t nifs;
+	wapi_if_info_t *ifs;
+	size_t naddrs;
+	wapi_if_addr_t *addrs;	/**< Addresses of all interfaces, grouped by owner. */
+} wapi_if_table_t;
+
+
+/**
+ * Fills @a table with the current state of every interface. Release it via
+ * wapi_free_if_table().
+ *
+ * @return 0 on success; @c -EAGAIN, if the dumps kept being interrupted by
+ *     concurrent changes; negative on other failures.
+ */
+int wapi_get_if_table(wapi_if_table_t *table);
+
+
+/**
+ * Releases the memory allocated by wapi_get_if_table().
+ */
+void wapi_free_if_table(wapi_if_table_t *table);
+
+
+/** @} iftable/ifaccessors */
+
+
 /**
  * @defgroup route Routing Table Accessors
  * @ingroup ifaccessors
@@ -140,7 +304,9 @@ int wapi_set_netmask(int sock, const char *ifname, const struct in_addr *addr);
 
 
 /**
- * Parses routing table rows from @c WAPI_PROC_NET_ROUTE.
+ * Collects IPv4 routing table rows of the main table. Rows are dumped via
+ * rtnetlink (see wapi_get_routes_nl()), and if that is not available, parsed
+ * from @c WAPI_PROC_NET_ROUTE (see wapi_get_routes_proc()).
  *
  * @param[out] list Pushes collected @c wapi_route_info_t into this list.
  *
@@ -158,6 +324,57 @@ int wapi_set_netmask(int sock, const char *ifname, const struct in_addr *addr);
 int wapi_get_routes(wapi_list_t *list);
 
 
+/**
+ * Parses routing table rows from @c WAPI_PROC_NET_ROUTE. This is the procfs
+ * backend of wapi_get_routes(), which is used when rtnetlink is unavailable.
+ *
+ * @param[out] list Pushes collected @c wapi_route_info_t into this list.
+ */
+int wapi_get_routes_proc(wapi_list_t *list);
+
+
+/**
+ * Parses a file in @c WAPI_PROC_NET_ROUTE format. The file is read at once
+ * into a buffer that is reused across calls, and scanned in place.
+ *
+ * @param[in] path Path of the file.
+ * @param[out] list Pushes collected @c wapi_route_info_t into this list.
+ *
+ * @return 0 on success, or a negative value on I/O, allocation or parse
+ * errors. Rows parsed before the failure are kept in @a list.
+ */
+int wapi_get_routes_file(const char *path, wapi_list_t *list);
+
+
+/** Filter for wapi_get_routes_nl() dumps. */
+typedef struct wapi_route_filter_t {
+	int family;			/**< @c AF_INET, @c AF_INET6, or @c AF_UNSPEC for both. */
+	unsigned int table;	/**< Routing table id (e.g. @c RT_TABLE_MAIN), or 0 for all. */
+	int ifindex;		/**< Output interface index, or 0 for any. */
+	unsigned char protocol;	/**< Route origin (e.g. @c RTPROT_STATIC), or 0 for any. */
+} wapi_route_filter_t;
+
+
+/**
+ * Dumps routing table rows via a single rtnetlink @c RTM_GETROUTE request.
+ * Route attributes are decoded directly into @c wapi_route_info_t nodes.
+ * Unlike @c WAPI_PROC_NET_ROUTE, IPv6 routes and non-main tables are covered
+ * as well.
+ *
+ * When supported by the kernel, @c NETLINK_GET_STRICT_CHK is enabled, so that
+ * table, interface, and protocol filtering is done on the kernel side. Otherwise, rows
+ * are filtered while being decoded.
+ *
+ * @param[out] list Pushes collected @c wapi_route_info_t into this list.
+ * @param[in] filter Dump filter. @c NULL dumps every table of every family.
+ *
+ * @return 0 on success; @c -EAGAIN, if the dump kept being interrupted by
+ *     concurrent route changes, in which case @a list is left untouched;
+ *     negative on other failures.
+ */
+int wapi_get_routes_nl(wapi_list_t *list, const wapi_route_filter_t *filter);
+
+
 /** Route target types. */
 typedef enum {
 	WAPI_ROUTE_TARGET_NET,	/**< The target is a network. */
@@ -189,9 +406,316 @@ wapi_del_route_gw(
 	const struct in_addr *gw);
 
 
+/** Route batch actions. */
+typedef enum {
+	WAPI_ROUTE_ACT_ADD,		/**< Adds the route, fails if it already exists. */
+	WAPI_ROUTE_ACT_REPLACE,	/**< Adds the route, or replaces the existing one. */
+	WAPI_ROUTE_ACT_DEL		/**< Deletes the route. */
+} wapi_route_act_t;
+
+
+/** Route batch action names. */
+extern const char *wapi_route_acts[];
+
+
+/**
+ * A single entry of a route batch. See wapi_route_batch().
+ */
+typedef struct wapi_route_op_t {
+	wapi_route_act_t act;
+	const struct wapi_route_info_t *route;	/**< Route to act on. */
+	int error;	/**< Set to zero on success, or to a negative @c errno value. */
+} wapi_route_op_t;
+
+
+/**
+ * Adds, replaces, or deletes routes in batches over rtnetlink. Up to a few
+ * hundred @c RTM_NEWROUTE/@c RTM_DELROUTE requests are packed into a single
+ * sendmsg(), and then acks of the whole batch are collected at once.
+ *
+ * Following @c wapi_route_info_t fields are used: @c family (0 means @c
+ * AF_INET), @c dest/@c dest6, @c prefixlen (for @c AF_INET, it is derived from
+ * @c netmask, if zero), @c gw/@c gw6 (only if @c flags has @c RTF_GATEWAY),
+ * @c ifindex (looked up from @c ifname, if zero), @c metric, @c mtu,
+ * @c window, @c table (0 means @c RT_TABLE_MAIN), @c protocol, @c scope, and
+ * @c type. Unset @c protocol, @c scope, and @c type fields are filled in the
+ * way @c ip(8) does. Routes without a gateway are device routes.
+ *
+ * Requests are processed one by one by the kernel, that is, a batch is not
+ * atomic: a failing entry does not roll back the preceding ones. Entries that
+ * cannot be encoded fail alone without being sent, e.g. with @c -ENODEV for
+ * an unknown @c ifname.
+ *
+ * @param[in,out] ops Actions to perform. Results are stored in @c error.
+ *
+ * @return number of failed entries, or negative if requests could not be
+ *     transferred.
+ */
+int wapi_route_batch(wapi_route_op_t *ops, size_t n);
+
+
 /** @} route/ifaccessors */
 
 
+/**
+ * @defgroup routeidx Route Lookup Index
+ * @ingroup route
+ *
+ * An immutable longest-prefix-match (LPM) index over an IPv4 routing table
+ * snapshot collected by wapi_get_routes() or wapi_get_routes_nl(). The index
+ * is a DIR-16-8-8 multibit table: a 2^16-entry first level addressed by the
+ * upper 16 bits of the destination, and 256-entry chunks for the remaining two
+ * bytes, allocated only for prefixes longer than 16 and 24 bits, respectively.
+ * A lookup hence costs at most three dependent memory reads, regardless of the
+ * table size. For equal prefixes, the route with the lowest metric wins.
+ *
+ * The index refers to the nodes of the snapshot, hence the snapshot must not
+ * be released before the index. Only @c AF_INET routes flagged with @c RTF_UP
+ * are indexed.
+ *
+ * Below is an example comparing the index against a linear list walk.
+ *
+ * @include route-lookup.c
+ *
+ * @{
+ */
+
+
+/** Opaque route lookup index. */
+typedef struct wapi_route_index_t wapi_route_index_t;
+
+
+/**
+ * Builds a lookup index over the routes in @a list.
+ *
+ * @param[out] index Set to the allocated index on success.
+ */
+int wapi_route_index_build(const wapi_list_t *list, wapi_route_index_t **index);
+
+
+/**
+ * Finds the longest prefix matching route for @a addr.
+ *
+ * @return matching route, or @c NULL if there is none.
+ */
+const struct wapi_route_info_t *
+wapi_route_index_lookup(
+	const wapi_route_index_t *index,
+	const struct in_addr *addr);
+
+
+/**
+ * Looks up @a n addresses at once.
+ *
+ * @param[out] routes Set to the matching route (or @c NULL) of each address.
+ *
+ * @return number of addresses with a matching route.
+ */
+size_t
+wapi_route_index_lookup_batch(
+	const wapi_route_index_t *index,
+	const struct in_addr *addrs,
+	size_t n,
+	const struct wapi_route_info_t **routes);
+
+
+/**
+ * Releases the index. (The indexed snapshot is left untouched.)
+ */
+void wapi_route_index_free(wapi_route_index_t *index);
+
+
+/** @} routeidx */
+
+
+/**
+ * @defgroup routecache Route Cache
+ * @ingroup route
+ *
+ * A routing table mirror kept in sync with the kernel. The cache takes a
+ * single @c RTM_GETROUTE dump on open, and from then on, applies @c
+ * RTM_NEWROUTE/@c RTM_DELROUTE notifications of @c RTNLGRP_IPV4_ROUTE (and @c
+ * RTNLGRP_IPV6_ROUTE) multicast groups incrementally. Routes are hashed by
+ * their kernel identity (family, table, destination, prefix length, and
+ * metric), hence every notification is applied in constant time. As the
+ * kernel flushes IPv4 routes of interfaces going down, and routes through
+ * gateways of removed addresses silently, the cache also listens to @c
+ * RTNLGRP_LINK and @c RTNLGRP_IPV4_IFADDR: routes of a downed interface are
+ * dropped, and an address removal results in a new dump.
+ *
+ * The cache is passive: notifications are consumed only by
+ * wapi_route_cache_process(), which is supposed to be called whenever
+ * wapi_route_cache_fd() becomes readable. Between two such calls, the route
+ * list returned by wapi_route_cache_routes() is a consistent snapshot that is
+ * accessed without any system calls. If notifications get lost due to a
+ * receive buffer overrun, the cache transparently resynchronizes itself with
+ * a new dump and reports only the differences.
+ *
+ * @{
+ */
+
+
+/** Route cache change events. */
+typedef enum {
+	WAPI_ROUTE_EVENT_ADD,		/**< A new route appeared. */
+	WAPI_ROUTE_EVENT_CHANGE,	/**< Attributes of an existing route changed. */
+	WAPI_ROUTE_EVENT_DEL		/**< The route is removed. */
+} wapi_route_event_t;
+
+
+/** Route cache change event names. */
+extern const char *wapi_route_events[];
+
+
+/** Opaque route cache. */
+typedef struct wapi_route_cache_t wapi_route_cache_t;
+
+
+/**
+ * Route cache change callback. @a route is owned by the cache, and in case of
+ * @c WAPI_ROUTE_EVENT_DEL, it is released right after the callback returns.
+ */
+typedef void (*wapi_route_cache_cb_t)(
+	wapi_route_event_t event,
+	const struct wapi_route_info_t *route,
+	void *arg);
+
+
+/**
+ * Subscribes to route notifications and loads the initial routing table.
+ *
+ * @param[in] filter Routes to mirror. @c NULL mirrors every table of every
+ *     family.
+ * @param[in] cb Change callback, might be @c NULL. It is also called for
+ *     routes of the initial dump.
+ * @param[out] cache Set to the allocated cache on success.
+ */
+int
+wapi_route_cache_open(
+	const wapi_route_filter_t *filter,
+	wapi_route_cache_cb_t cb,
+	void *arg,
+	wapi_route_cache_t **cache);
+
+
+/**
+ * Returns the notification socket of the cache to be polled for readability.
+ */
+int wapi_route_cache_fd(const wapi_route_cache_t *cache);
+
+
+/**
+ * Applies pending notifications without blocking.
+ *
+ * @return number of applied changes, or negative on failure. If a reload of
+ *     the routes failed (e.g. with @c -EAGAIN, as concurrent changes kept
+ *     interrupting the dump), the next call reloads them again.
+ */
+int wapi_route_cache_process(wapi_route_cache_t *cache);
+
+
+/**
+ * Returns the cached routes. The list and its nodes are owned by the cache,
+ * and are valid until the next wapi_route_cache_process() call.
+ */
+const wapi_list_t *wapi_route_cache_routes(const wapi_route_cache_t *cache);
+
+
+/**
+ * Returns a counter incremented on every change, so that pollers can tell
+ * whether anything changed since they last looked.
+ */
+unsigned long wapi_route_cache_generation(const wapi_route_cache_t *cache);
+
+
+/**
+ * Unsubscribes and releases the cache.
+ */
+void wapi_route_cache_close(wapi_route_cache_t *cache);
+
+
+/** @} routecache */
+
+
+/**
+ * @defgroup routesync Route Reconciliation
+ * @ingroup route
+ *
+ * Brings the routing table to a desired state with the minimal set of
+ * changes. Instead of deleting and re-adding every route, desired routes are
+ * matched against the current table by their kernel identity (family, table,
+ * destination, prefix length, and metric) through a hash table in O(n) time,
+ * and only missing routes are added, differing ones are replaced, and
+ * surplus ones are deleted. Additions and replacements are issued before
+ * deletions, so that traffic is never left without a route in between.
+ *
+ * Attributes left unset in a desired route (e.g. zero @c ifindex with no
+ * @c ifname, or zero @c protocol or @c scope) are not compared. A zero @c
+ * type stands for @c RTN_UNICAST, as it does while adding routes.
+ *
+ * @{
+ */
+
+
+/** Reconciliation result. */
+typedef struct wapi_route_diff_t {
+	size_t nops;
+	wapi_route_op_t *ops;	/**< Adds and replaces first, then deletes. */
+	size_t nadd;
+	size_t nreplace;
+	size_t ndel;
+	struct wapi_route_info_t *current;	/**< Snapshot taken by wapi_route_reconcile(). */
+} wapi_route_diff_t;
+
+
+/**
+ * Computes the changes required to turn @a current into @a desired. Routes in
+ * @a desired are expected to have unique identities.
+ *
+ * @param[out] diff Operations refer to the nodes of @a current and @a
+ *     desired, hence both must outlive @a diff. Release it via
+ *     wapi_route_diff_free().
+ */
+int
+wapi_route_diff(
+	const wapi_list_t *current,
+	const wapi_list_t *desired,
+	wapi_route_diff_t *diff);
+
+
+/**
+ * Reconciles the routes matching @a filter with @a desired. Current routes are
+ * dumped via wapi_get_routes_nl(), and the computed changes are applied via
+ * wapi_route_batch(). Routes outside of @a filter are never touched. The
+ * filter must set @c protocol to a value owned by the caller (e.g. @c
+ * RTPROT_STATIC), which keeps routes installed by the kernel and by others out
+ * of reach. Desired routes without a protocol are installed with that of the
+ * filter.
+ *
+ * @param[in] dry_run If non-zero, changes are computed, but not applied.
+ * @param[out] diff Applied (or to be applied) changes with their results.
+ *     Release it via wapi_route_diff_free().
+ *
+ * @return number of failed changes; @c -EINVAL, if @a filter is @c NULL, or
+ *     its @c protocol is zero or @c RTPROT_KERNEL; negative on other failures.
+ */
+int
+wapi_route_reconcile(
+	const wapi_list_t *desired,
+	const wapi_route_filter_t *filter,
+	int dry_run,
+	wapi_route_diff_t *diff);
+
+
+/**
+ * Releases the memory allocated by wapi_route_diff() and wapi_route_reconcile().
+ */
+void wapi_route_diff_free(wapi_route_diff_t *diff);
+
+
+/** @} routesync */
+
+
 /**
  * @defgroup wifaccessors Wireless Interface Accessors
  * @ingroup accessors
@@ -259,6 +783,28 @@ wapi_set_freq(
 	wapi_freq_flag_t flag);
 
 
+/**
+ * Gets the operating frequency of the device in kHz, using integer math only.
+ */
+int
+wapi_get_freq_khz(
+	int sock,
+	const char *ifname,
+	unsigned int *khz,
+	wapi_freq_flag_t *flag);
+
+
+/**
+ * Sets the operating frequency of the device in kHz, using integer math only.
+ */
+int
+wapi_set_freq_khz(
+	int sock,
+	const char *ifname,
+	unsigned int khz,
+	wapi_freq_flag_t flag);
+
+
 /**
  * Finds corresponding channel for the supplied @a freq.
  *
@@ -278,6 +824,58 @@ int wapi_chan2freq(int sock, const char *ifname, int chan, double *freq);
 /** @} freq/wifaccessors */
 
 
+/**
+ * @defgroup chanplan Channel Plans
+ * @ingroup wifaccessors
+ *
+ * Conversions between center frequencies (in MHz) and channel numbers of the
+ * standard 2.4, 5 and 6 GHz plans, as in @c ieee80211_freq_khz_to_channel()
+ * of the kernel. They are answered from a constant table, without any
+ * ioctl(). Since channel numbers repeat across bands, going from a channel to
+ * a frequency takes the band as well.
+ *
+ * @{
+ */
+
+
+/** Frequency bands. */
+typedef enum {
+	WAPI_BAND_2GHZ,
+	WAPI_BAND_5GHZ,
+	WAPI_BAND_6GHZ
+} wapi_band_t;
+
+
+/** Band names. */
+extern const char *wapi_bands[];
+
+
+/**
+ * Finds the band and the channel of the frequency @a mhz. @a band may be NULL.
+ *
+ * @return 0, on success; -2, if @a mhz is not in any plan.
+ */
+int wapi_freq_mhz2chan(unsigned int mhz, wapi_band_t *band, int *chan);
+
+
+/**
+ * Finds the frequency of channel @a chan in @a band.
+ *
+ * @return 0, on success; -2, if @a chan is not in the plan of @a band.
+ */
+int wapi_chan2freq_mhz(wapi_band_t band, int chan, unsigned int *mhz);
+
+
+/**
+ * Converts @a n frequencies at once. Unknown frequencies yield channel 0. The
+ * loop is free of branches, so that compilers can vectorize it.
+ */
+void wapi_freq_mhz2chan_bulk(const unsigned int *mhz, int *chans, size_t n);
+
+
+/** @} chanplan/wifaccessors */
+
+
 /**
  * @defgroup essid ESSID (Extended Service Set Identifier) Accessors
  * @ingroup wifaccessors
@@ -472,19 +1070,35 @@ extern const char *wapi_txpower_flags[];
 
 
 /**
- * Converts a value in dBm to a value in milliWatt.
+ * Converts a value in dBm to a value in milliWatt, rounding down.
  */
 int wapi_dbm2mwatt(int dbm);
 
 
 /**
- * Converts a value in milliWatt to a value in dBm.
+ * Converts a value in milliWatt to a value in dBm, rounding up.
  */
 int wapi_mwatt2dbm(int mwatt);
 
 
 /**
- * Gets txpower of the device.
+ * Converts a value in mBm (1/100 dBm) to a value in milliWatt, rounding down.
+ * Computed from constant exponent tables in integer arithmetic; relative error
+ * stays below 2e-8. Negative values yield 0, too large ones @c INT_MAX.
+ */
+int wapi_mbm2mwatt(int mbm);
+
+
+/**
+ * Converts a value in milliWatt to a value in mBm, rounding up. Inverse of
+ * wapi_mbm2mwatt(), seeded from a log2 table and settled in a step or two
+ * against wapi_mbm2mwatt() arithmetic. Non-positive values yield @c INT_MIN.
+ */
+int wapi_mwatt2mbm(int mwatt);
+
+
+/**
+ * Gets txpower of the device.
  */
 int
 wapi_get_txpower(
@@ -505,6 +1119,18 @@ wapi_set_txpower(
 	wapi_txpower_flag_t flag);
 
 
+/**
+ * Gets txpower of the device in mBm. Fails with -2 for relative values.
+ */
+int wapi_get_txpower_mbm(int sock, const char *ifname, int *mbm);
+
+
+/**
+ * Sets txpower of the device, rounded to the nearest dBm.
+ */
+int wapi_set_txpower_mbm(int sock, const char *ifname, int mbm);
+
+
 /** @} txpower/wifaccessors */
 
 
@@ -538,6 +1164,286 @@ wapi_if_del(int sock, const char *ifname);
 /** @} ifadddel/wifaccessors */
 
 
+/**
+ * @defgroup wiftable Wireless Interface Table
+ * @ingroup wifaccessors
+ *
+ * Enumerates every wireless interface known to nl80211 with a single @c
+ * NL80211_CMD_GET_INTERFACE dump. Unlike @c WAPI_PROC_NET_WIRELESS, the dump
+ * covers interfaces that are administratively down as well.
+ *
+ * @{
+ */
+
+
+/** An nl80211 interface. */
+typedef struct wapi_wif_info_t {
+	int ifindex;
+	char ifname[IFNAMSIZ];
+	unsigned int wiphy;		/**< Index of the physical device. */
+	int iftype;				/**< See @c NL80211_IFTYPE_* in @c linux/nl80211.h. */
+	int has_mac;
+	struct ether_addr mac;
+} wapi_wif_info_t;
+
+
+/** Wireless interface table. Records are in the order reported by the kernel. */
+typedef struct wapi_wif_table_t {
+	size_t nifs;
+	wapi_wif_info_t *ifs;
+} wapi_wif_table_t;
+
+
+/**
+ * Fills @a table with every wireless interface. Release it via
+ * wapi_free_wif_table().
+ */
+int wapi_get_wif_table(wapi_wif_table_t *table);
+
+
+/**
+ * Releases the memory allocated by wapi_get_wif_table().
+ */
+void wapi_free_wif_table(wapi_wif_table_t *table);
+
+
+/** @} wiftable/wifaccessors */
+
+
+/**
+ * @defgroup ctx Contexts
+ *
+ * A context owns the resources that plain accessors set up and tear down on
+ * every call: an ioctl() socket, an rtnetlink socket, and a generic netlink
+ * socket along with the resolved nl80211 family id. Netlink sockets are opened
+ * on first use. Create one context per thread and pass it to the @c wapi_ctx_*
+ * variants of the accessors.
+ *
+ * @{
+ */
+
+
+/** Opaque context handle. */
+typedef struct wapi_ctx_t wapi_ctx_t;
+
+
+/**
+ * Creates a context. Release it via wapi_ctx_destroy().
+ */
+int wapi_ctx_create(wapi_ctx_t **ctx);
+
+
+/**
+ * Closes the sockets of @a ctx and releases it.
+ */
+void wapi_ctx_destroy(wapi_ctx_t *ctx);
+
+
+/**
+ * Returns the ioctl() socket of @a ctx, to be passed as @c sock argument.
+ */
+int wapi_ctx_sock(const wapi_ctx_t *ctx);
+
+
+/**
+ * wapi_if_add() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_if_add(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	const char *name,
+	wapi_mode_t mode);
+
+
+/**
+ * wapi_if_del() over the nl80211 socket of @a ctx.
+ */
+int wapi_ctx_if_del(wapi_ctx_t *ctx, const char *ifname);
+
+
+/**
+ * wapi_get_wif_table() over the nl80211 socket of @a ctx.
+ */
+int wapi_ctx_get_wif_table(wapi_ctx_t *ctx, wapi_wif_table_t *table);
+
+
+/**
+ * wapi_get_routes_nl() over the rtnetlink socket of @a ctx.
+ */
+int
+wapi_ctx_get_routes_nl(
+	wapi_ctx_t *ctx,
+	wapi_list_t *list,
+	const wapi_route_filter_t *filter);
+
+
+/**
+ * wapi_route_batch() over the rtnetlink socket of @a ctx.
+ */
+int wapi_ctx_route_batch(wapi_ctx_t *ctx, wapi_route_op_t *ops, size_t n);
+
+
+/**
+ * wapi_route_reconcile() over the rtnetlink socket of @a ctx.
+ */
+int
+wapi_ctx_route_reconcile(
+	wapi_ctx_t *ctx,
+	const wapi_list_t *desired,
+	const wapi_route_filter_t *filter,
+	int dry_run,
+	wapi_route_diff_t *diff);
+
+
+/**
+ * wapi_route_cache_open(), taking dumps over the rtnetlink socket of @a ctx
+ * rather than a new socket on every resynchronization. The context must
+ * outlive the cache, and be used by the same thread.
+ */
+int
+wapi_ctx_route_cache_open(
+	wapi_ctx_t *ctx,
+	const wapi_route_filter_t *filter,
+	wapi_route_cache_cb_t cb,
+	void *arg,
+	wapi_route_cache_t **cache);
+
+
+/**
+ * wapi_set_ifstate() over the rtnetlink socket of @a ctx.
+ */
+int wapi_ctx_set_ifstate(wapi_ctx_t *ctx, wapi_ifstate_op_t *ops, size_t n);
+
+
+/**
+ * wapi_set_ifup_nl() over the rtnetlink socket of @a ctx. It takes a single
+ * round trip to the kernel, without any other system call.
+ */
+int wapi_ctx_set_ifup_nl(wapi_ctx_t *ctx, const char *ifname);
+
+
+/**
+ * wapi_set_ifdown_nl() over the rtnetlink socket of @a ctx. (See
+ * wapi_ctx_set_ifup_nl().)
+ */
+int wapi_ctx_set_ifdown_nl(wapi_ctx_t *ctx, const char *ifname);
+
+
+/**
+ * wapi_addr_batch() over the rtnetlink socket of @a ctx.
+ */
+int wapi_ctx_addr_batch(wapi_ctx_t *ctx, wapi_addr_op_t *ops, size_t n);
+
+
+/**
+ * wapi_get_if_table() over the rtnetlink socket of @a ctx.
+ */
+int wapi_ctx_get_if_table(wapi_ctx_t *ctx, wapi_if_table_t *table);
+
+
+/** @} ctx */
+
+
+/**
+ * @defgroup iface Interface Handles
+ * @ingroup wifaccessors
+ *
+ * A handle resolves the interface index, @c SIOCGIWRANGE data (along with the
+ * WE version in it) and the @c ifr_name of ioctl() requests once, and answers
+ * from this cache afterwards. Each handle listens to @c RTM_NEWLINK and @c
+ * RTM_DELLINK notifications: a renamed interface is followed by its index, and
+ * a removed one is resolved by name again on next use. Pending notifications
+ * are applied at the beginning of every call taking the handle, at the cost of
+ * a non-blocking recv(). wapi_iface_process() does the same for event loops
+ * polling wapi_iface_fd().
+ *
+ * @{
+ */
+
+
+/** Opaque interface handle. */
+typedef struct wapi_iface_t wapi_iface_t;
+
+
+/**
+ * Opens a handle for interface @a ifname, whose ioctl() and nl80211 requests
+ * go through @a ctx. The context must outlive the handle.
+ */
+int wapi_iface_open(wapi_ctx_t *ctx, const char *ifname, wapi_iface_t **iface);
+
+
+/**
+ * Releases the handle.
+ */
+void wapi_iface_close(wapi_iface_t *iface);
+
+
+/**
+ * Returns the file descriptor that becomes readable on link notifications.
+ */
+int wapi_iface_fd(const wapi_iface_t *iface);
+
+
+/**
+ * Applies pending link notifications without blocking.
+ */
+int wapi_iface_process(wapi_iface_t *iface);
+
+
+/**
+ * Returns the current interface index, or a negative value if the interface
+ * does not exist.
+ */
+int wapi_iface_ifindex(wapi_iface_t *iface);
+
+
+/**
+ * Returns the current interface name, to be passed to plain accessors.
+ */
+const char *wapi_iface_name(const wapi_iface_t *iface);
+
+
+/**
+ * Cached wapi_get_we_version().
+ */
+int wapi_iface_get_we_version(wapi_iface_t *iface, int *we_version);
+
+
+/**
+ * wapi_freq2chan() from a hash table built out of the cached range.
+ */
+int wapi_iface_freq2chan(wapi_iface_t *iface, double freq, int *chan);
+
+
+/**
+ * wapi_chan2freq() from a table built out of the cached range.
+ */
+int wapi_iface_chan2freq(wapi_iface_t *iface, int chan, double *freq);
+
+
+/**
+ * wapi_scan_coll() with the cached WE version. The results buffer is kept with
+ * the handle, sized after the largest result set seen on the interface.
+ */
+int wapi_iface_scan_coll(wapi_iface_t *iface, wapi_list_t *aps);
+
+
+/**
+ * wapi_if_add() with the cached interface index.
+ */
+int wapi_iface_if_add(wapi_iface_t *iface, const char *name, wapi_mode_t mode);
+
+
+/**
+ * wapi_if_del() with the cached interface index.
+ */
+int wapi_iface_if_del(wapi_iface_t *iface);
+
+
+/** @} iface */
+
+
 /**
  * @defgroup utils Utility Routines
  * @{
@@ -553,8 +1459,8 @@ int wapi_make_socket(void);
 
 
 /**
- * Parses @c WAPI_PROC_NET_WIRELESS according to hardcoded mechanisms in @c
- * linux/net/wireless/wext-proc.c sources.
+ * Collects names of the wireless interfaces via wapi_get_wif_table(). Falls
+ * back to wapi_get_ifnames_proc(), if nl80211 is not available.
  *
  * @param[out] list Pushes collected @c wapi_string_t into this list.
  *
@@ -565,6 +1471,70 @@ int wapi_make_socket(void);
 int wapi_get_ifnames(wapi_list_t *list);
 
 
+/**
+ * Parses @c WAPI_PROC_NET_WIRELESS according to hardcoded mechanisms in @c
+ * linux/net/wireless/wext-proc.c sources. Interfaces that are down are not
+ * listed there.
+ *
+ * @param[out] list Pushes collected @c wapi_string_t into this list.
+ */
+int wapi_get_ifnames_proc(wapi_list_t *list);
+
+
+/**
+ * A bump allocator backing the nodes of a @c wapi_list_t. Attach one with
+ * wapi_list_init() before filling the list, and every node (along with its
+ * strings) is carved out of a few large chunks. Nodes are then reclaimed all
+ * at once by wapi_arena_reset(), so that polling the same list over and over
+ * settles down to zero heap allocations. An arena may back several lists.
+ */
+typedef struct wapi_arena_t wapi_arena_t;
+
+
+/**
+ * Creates an arena whose first chunk spans @a size bytes. (0 for a default.)
+ */
+int wapi_arena_create(size_t size, wapi_arena_t **arena);
+
+
+/**
+ * Invalidates every allocation made from @a arena, keeping its memory for
+ * reuse. Chunks are merged into a single one, if the arena has outgrown it.
+ */
+void wapi_arena_reset(wapi_arena_t *arena);
+
+
+/**
+ * Releases @a arena. Lists allocated from it must not be used afterwards.
+ */
+void wapi_arena_destroy(wapi_arena_t *arena);
+
+
+/**
+ * Empties @a list and, if @a arena is not NULL, makes its nodes come from @a
+ * arena. Lists that are merely zeroed allocate their nodes with malloc().
+ */
+void wapi_list_init(wapi_list_t *list, wapi_arena_t *arena);
+
+
+/**
+ * Releases the nodes of a list filled by wapi_get_ifnames(), wapi_get_routes()
+ * or wapi_scan_coll() and friends, and resets its head. If the list is backed
+ * by an arena, the arena is left alone (it may back other lists as well) and
+ * stays attached to the list; call wapi_arena_reset() to reclaim its memory.
+ */
+void wapi_list_free(wapi_list_t *list);
+
+
+/**
+ * Frees the buffers kept by the calling thread across calls, namely the
+ * results buffer of wapi_scan_visit() and wapi_scan_coll(), and the read
+ * buffer of the @c /proc parsers. (See wapi_get_ifnames_proc().) Call it
+ * before the thread exits; later calls simply allocate them again.
+ */
+void wapi_release_buffers(void);
+
+
 /** @} utils */
 
 
@@ -580,9 +1550,11 @@ int wapi_get_ifnames(wapi_list_t *list);
  * it is not provided by libiw.) For this purpose, we needed to implement our
  * own scanning routines. Furthermore, scanning requires extracting binary
  * results returned from kernel over a @c char buffer, hence it causes dozens of
- * hairy binary compatibility issues. Luckily, libiw provides an API method to
- * cope with this: iw_extract_event_stream(). That's the only place in this
- * project relying on libiw.
+ * hairy binary compatibility issues. (Event layouts changed in WE-19, and
+ * native 64-bit readers get padded events, while compat 32-bit ones get packed
+ * events.) WAPI decodes this stream in place
+ * with its own bounds-checked walker, and wapi_scan_visit() hands out entries
+ * without building a list at all.
  *
  * The scanning operation disable normal network traffic, and therefore you
  * should not abuse of scan. The scan need to check the presence of network on
@@ -649,38 +1621,1045 @@ int wapi_scan_stat(int sock, const char *ifname);
 int wapi_scan_coll(int sock, const char *ifname, wapi_list_t *aps);
 
 
+/**
+ * Scan result visitor. @a info lives on the stack of the caller and is valid
+ * only during the call. Return negative to stop the walk.
+ */
+struct wapi_scan_info_t;
+typedef int (*wapi_scan_visit_cb_t)(
+	const struct wapi_scan_info_t *info,
+	void *arg);
+
+
+/**
+ * Feeds the results of a scan process to @a cb one by one in the order the
+ * driver reports them. Unlike wapi_scan_coll(), nothing is allocated per AP.
+ * Results are fetched into a per-thread buffer that is sized after the kernel
+ * hint and kept across calls, so periodic scans cost a single ioctl(). (See
+ * wapi_release_buffers().) @a cb may scan again, on a temporary buffer.
+ *
+ * @return zero on success, negative on failure, or what @a cb returned, if it
+ *     stopped the walk.
+ */
+int
+wapi_scan_visit(
+	int sock,
+	const char *ifname,
+	wapi_scan_visit_cb_t cb,
+	void *arg);
+
+
+/**
+ * wapi_scan_visit() with the cached WE version and results buffer of the
+ * interface handle. (See wapi_iface_scan_coll().)
+ */
+int
+wapi_iface_scan_visit(
+	wapi_iface_t *iface,
+	wapi_scan_visit_cb_t cb,
+	void *arg);
+
+
+/**
+ * Decodes a raw @c SIOCGIWSCAN results buffer of the given WE version, and
+ * feeds its entries to @a cb. Both the padded (native 64-bit) and the packed
+ * (compat 32-bit) event layouts are understood.
+ *
+ * @include iwe-decode.c
+ *
+ * @return zero on success, negative on a truncated stream, or what @a cb
+ *     returned, if it stopped the walk.
+ */
+int
+wapi_scan_decode(
+	const void *buf,
+	size_t len,
+	int we_version,
+	wapi_scan_visit_cb_t cb,
+	void *arg);
+
+
 /** @} scan */
 
 
 /**
- * @defgroup commons Common Data Structures & Definitions
+ * @defgroup scanevents Scan Events
+ * @ingroup scan
+ *
+ * Scan notifications of the nl80211 @c "scan" multicast group. Instead of
+ * polling wapi_scan_stat() in a sleep loop, callers open a monitor before
+ * triggering the scan, and wait for wapi_scan_mon_fd() to become readable in
+ * their own @c poll() or @c epoll loop. Results can be collected the moment
+ * @c WAPI_SCAN_EVENT_DONE is delivered for the interface.
+ *
  * @{
  */
 
 
-/** Path to @c /proc/net/wireless. (Requires procfs mounted.) */
-#define WAPI_PROC_NET_WIRELESS "/proc/net/wireless"
+/** Scan notification events. */
+typedef enum {
+	WAPI_SCAN_EVENT_TRIGGER,	/**< A scan is started. */
+	WAPI_SCAN_EVENT_DONE,		/**< Results are ready. */
+	WAPI_SCAN_EVENT_ABORTED,	/**< The scan is aborted without results. */
+	WAPI_SCAN_EVENT_OVERRUN		/**< Notifications are lost. */
+} wapi_scan_event_t;
 
-/** Path to @c /proc/net/route. (Requires procfs mounted.) */
-#define WAPI_PROC_NET_ROUTE "/proc/net/route"
 
-/** Buffer size while reading lines from PROC_NET_ files. */
-#define WAPI_PROC_LINE_SIZE	1024
+/** Scan notification event names. */
+extern const char *wapi_scan_events[];
 
 
-/** Linked list container for strings. */
-typedef struct wapi_string_t {
-	struct wapi_string_t *next;
-	char *data;
-} wapi_string_t;
+/** Opaque scan notification monitor. */
+typedef struct wapi_scan_mon_t wapi_scan_mon_t;
 
 
-/** Linked list container for scan results. */
-typedef struct wapi_scan_info_t {
-	struct wapi_scan_info_t *next;
-	struct ether_addr ap;
-	int has_essid;
-	char essid[WAPI_ESSID_MAX_SIZE+1];
+/**
+ * Scan notification callback. @a ifindex and @a wiphy are -1, if the
+ * notification does not carry them. (e.g. @c WAPI_SCAN_EVENT_OVERRUN)
+ */
+typedef void (*wapi_scan_mon_cb_t)(
+	wapi_scan_event_t event,
+	int ifindex,
+	int wiphy,
+	void *arg);
+
+
+/**
+ * Subscribes to nl80211 scan notifications.
+ *
+ * @param[in] cb Notification callback, might be @c NULL.
+ * @param[out] mon Set to the allocated monitor on success.
+ */
+int wapi_scan_mon_open(wapi_scan_mon_cb_t cb, void *arg, wapi_scan_mon_t **mon);
+
+
+/**
+ * Returns the notification socket of the monitor to be polled for readability.
+ */
+int wapi_scan_mon_fd(const wapi_scan_mon_t *mon);
+
+
+/**
+ * Delivers pending notifications without blocking.
+ *
+ * @return number of delivered notifications, or negative on failure.
+ */
+int wapi_scan_mon_process(wapi_scan_mon_t *mon);
+
+
+/**
+ * Blocks until the scan on the given interface completes. Notifications of
+ * other interfaces are still delivered to the callback meanwhile.
+ *
+ * @param[in] timeout In milliseconds. Negative to wait forever.
+ * @return zero, if results are ready; 1, on timeout; @c -ECANCELED, if the
+ *     scan is aborted; @c -ENOBUFS, if notifications are lost; negative on
+ *     other failures.
+ */
+int wapi_scan_mon_wait(wapi_scan_mon_t *mon, int ifindex, int timeout);
+
+
+/**
+ * Unsubscribes and releases the monitor.
+ */
+void wapi_scan_mon_close(wapi_scan_mon_t *mon);
+
+
+/** @} scanevents */
+
+
+/**
+ * @defgroup scantargeted Targeted Scans
+ * @ingroup scan
+ *
+ * nl80211 scans restricted to a set of channels and SSIDs. A full sweep of a
+ * dual-band radio takes seconds, whereas probing a known network on a couple
+ * of channels completes in a few hundred milliseconds. Completion is signalled
+ * through the @ref scanevents "scan notifications", and results are read back
+ * via wapi_scan_cached().
+ *
+ * @{
+ */
+
+
+/** Targeted scan flags. */
+typedef enum {
+	WAPI_SCAN_FLUSH = 1 << 0,			/**< Flush cached results first. */
+	WAPI_SCAN_LOW_PRIORITY = 1 << 1,	/**< Yield to traffic, if supported. */
+	WAPI_SCAN_PASSIVE = 1 << 2			/**< Listen for beacons, send no probes. */
+} wapi_scan_flag_t;
+
+
+/** Targeted scan parameters. Zero fields stand for driver defaults. */
+typedef struct wapi_scan_params_t {
+	const unsigned int *freqs;	/**< Channels to visit in MHz. */
+	size_t nfreqs;				/**< Zero to visit every channel. */
+	const char *const *ssids;	/**< SSIDs to send directed probes for. */
+	size_t nssids;				/**< Zero for a single wildcard probe. */
+	unsigned int dwell;			/**< Time spent on each channel in msecs. */
+	unsigned int flags;			/**< Bitwise OR of @c wapi_scan_flag_t. */
+} wapi_scan_params_t;
+
+
+/**
+ * Triggers an nl80211 scan on the given interface and returns immediately.
+ * Root privileges are required.
+ *
+ * @param[in] params Scan parameters, might be @c NULL for a full scan.
+ * @return zero on success; @c -EBUSY, if a scan is already running; @c
+ *     -EOPNOTSUPP, if the driver cannot honour the dwell time; negative on
+ *     other failures.
+ */
+int wapi_scan_trigger(const char *ifname, const wapi_scan_params_t *params);
+
+
+/**
+ * Collects the scan results cached by the kernel without triggering a scan.
+ *
+ * @param[in] max_age Skips entries last seen more than this many msecs ago.
+ *     Zero for no limit.
+ * @param[out] aps Pushes collected @c wapi_scan_info_t into this list.
+ */
+int wapi_scan_cached(const char *ifname, unsigned int max_age, wapi_list_t *aps);
+
+
+/**
+ * wapi_scan_cached() feeding entries to @a cb instead of building a list.
+ * (See wapi_scan_visit().)
+ */
+int
+wapi_scan_cached_visit(
+	const char *ifname,
+	unsigned int max_age,
+	wapi_scan_visit_cb_t cb,
+	void *arg);
+
+
+/**
+ * wapi_scan_trigger() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_scan_trigger(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	const wapi_scan_params_t *params);
+
+
+/**
+ * wapi_scan_cached() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_scan_cached(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	unsigned int max_age,
+	wapi_list_t *aps);
+
+
+/**
+ * wapi_scan_cached_visit() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_scan_cached_visit(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	unsigned int max_age,
+	wapi_scan_visit_cb_t cb,
+	void *arg);
+
+
+/** @} scantargeted */
+
+
+/**
+ * @defgroup scantable Scan Table
+ * @ingroup scan
+ *
+ * Scan results laid out column by column. Every BSS is a row index into
+ * parallel arrays, ESSIDs are packed into a single string pool, and a per-row
+ * presence byte tells which columns carry a value. Rows are kept in the order
+ * the driver reports them. A table is filled by passing wapi_scan_table_add()
+ * as the visitor of wapi_scan_visit() or wapi_scan_cached_visit(), and once
+ * allocated, it is reused across scans without further allocations.
+ *
+ * @{
+ */
+
+
+/** Column presence bits of a scan table row. */
+typedef enum {
+	WAPI_SCAN_HAS_FREQ = 1 << 0,
+	WAPI_SCAN_HAS_SIGNAL = 1 << 1,
+	WAPI_SCAN_HAS_MODE = 1 << 2,
+	WAPI_SCAN_HAS_RATE = 1 << 3,
+	WAPI_SCAN_HAS_ESSID = 1 << 4
+} wapi_scan_has_t;
+
+
+/** Columnar scan results. Zero to initialize. */
+typedef struct wapi_scan_table_t {
+	size_t nbss;				/**< Number of rows. */
+	size_t size;				/**< Number of allocated rows. */
+	struct ether_addr *bssid;
+	uint16_t *freq;				/**< Frequency in MHz. */
+	int16_t *signal;			/**< Signal level in dBm. */
+	uint8_t *mode;				/**< See @c wapi_mode_t. */
+	uint32_t *rate;				/**< Highest bitrate in bps. */
+	uint32_t *essid;			/**< Offset of the ESSID in @c pool. */
+	uint8_t *essid_len;			/**< Length of the ESSID. */
+	uint8_t *has;				/**< Bitwise OR of @c wapi_scan_has_t. */
+	uint8_t *radio;				/**< Radio hearing the BSS the strongest. */
+	uint32_t *radios;			/**< Bitwise OR of (1 << radio) over every
+								  *  radio hearing the BSS. */
+	char *pool;					/**< NUL-terminated ESSIDs back to back. */
+	size_t pool_len;
+	size_t pool_size;
+	void *block;				/**< Backing storage of the columns. */
+} wapi_scan_table_t;
+
+
+/** Row filter. Zero fields match everything. */
+typedef struct wapi_scan_filter_t {
+	unsigned int bands;			/**< Bitwise OR of (1 << @c wapi_band_t). */
+	const char *essid;			/**< Exact ESSID. */
+	const struct ether_addr *bssid;	/**< BSSID prefix. */
+	unsigned int bssid_len;		/**< Prefix length in bytes. (e.g. 3 for OUI) */
+} wapi_scan_filter_t;
+
+
+/**
+ * Appends a row. Has the signature of @c wapi_scan_visit_cb_t, with @a table
+ * pointing to a @c wapi_scan_table_t.
+ */
+int wapi_scan_table_add(const struct wapi_scan_info_t *info, void *table);
+
+
+/**
+ * Fills @a table with the results of a scan process. Previous rows are
+ * dropped, while allocated storage is kept.
+ */
+int wapi_scan_table_fill(int sock, const char *ifname, wapi_scan_table_t *table);
+
+
+/**
+ * Returns the ESSID of the given row, or an empty string if it has none.
+ */
+const char *wapi_scan_table_essid(const wapi_scan_table_t *table, size_t row);
+
+
+/**
+ * Collects the indices of rows passing the filter.
+ *
+ * @param[out] rows Room for @c table->nbss indices.
+ * @return number of matching rows.
+ */
+size_t
+wapi_scan_table_filter(
+	const wapi_scan_table_t *table,
+	const wapi_scan_filter_t *filter,
+	size_t *rows);
+
+
+/**
+ * Picks the @a k strongest rows among the given ones, strongest first. Rows
+ * without a signal level are never picked.
+ *
+ * @param[in] rows Candidate row indices, @c NULL for every row.
+ * @param[out] top Room for @a k indices.
+ * @return number of picked rows.
+ */
+size_t
+wapi_scan_table_topk(
+	const wapi_scan_table_t *table,
+	const size_t *rows,
+	size_t nrows,
+	size_t k,
+	size_t *top);
+
+
+/**
+ * Drops every row, keeping allocated storage.
+ */
+void wapi_scan_table_clear(wapi_scan_table_t *table);
+
+
+/**
+ * Releases the storage of the table.
+ */
+void wapi_scan_table_free(wapi_scan_table_t *table);
+
+
+/** @} scantable */
+
+
+/**
+ * @defgroup scanmulti Multi-Radio Scans
+ * @ingroup scan
+ *
+ * Scans several radios at once. Scans are triggered on every interface up
+ * front, their completions are awaited in a single @c epoll set, and results
+ * of each radio are merged into one scan table the moment it finishes. Hence
+ * the scan takes as long as the slowest radio, rather than the sum of all.
+ *
+ * Radios are driven via nl80211 and its scan events. Ones without nl80211
+ * support fall back to wireless extensions, where completion is taken from
+ * @c SIOCGIWSCAN link events, or from wapi_scan_stat() probes for drivers not
+ * sending those. If nl80211 scan events get lost, the pending radios are probed
+ * the same way, and their cached results are merged once they are done. A BSS
+ * heard by several radios takes a single row, carrying the values of the radio
+ * hearing it the strongest. Radios are identified by their index in the
+ * interface list.
+ *
+ * @include multiscan.c
+ *
+ * @{
+ */
+
+
+/** Maximum number of radios scanned at once. */
+#define WAPI_SCAN_MULTI_MAX 32
+
+
+/**
+ * Scans the given interfaces at once, and fills @a table with the merged
+ * results. Previous rows are dropped. Root privileges are required.
+ *
+ * @param[in] params Scan parameters for nl80211 radios, might be @c NULL.
+ * @param[in] timeout Deadline in msecs, negative for none.
+ * @param[out] errors Result of each radio: zero, if its results are merged;
+ *     one, if it did not finish in time; negative errno otherwise.
+ * @return number of radios whose results are missing, or negative on
+ *     failure.
+ */
+int
+wapi_scan_multi(
+	const char *const *ifnames,
+	size_t n,
+	const wapi_scan_params_t *params,
+	int timeout,
+	wapi_scan_table_t *table,
+	int *errors);
+
+
+/**
+ * wapi_scan_multi() over the sockets of @a ctx.
+ */
+int
+wapi_ctx_scan_multi(
+	wapi_ctx_t *ctx,
+	const char *const *ifnames,
+	size_t n,
+	const wapi_scan_params_t *params,
+	int timeout,
+	wapi_scan_table_t *table,
+	int *errors);
+
+
+/** @} scanmulti */
+
+
+/**
+ * @defgroup bsscache BSS Cache
+ * @ingroup scan
+ *
+ * A view of the neighbourhood kept across scans. Entries are keyed by BSSID in
+ * an open-addressing hash table. Each scan is merged into the cache between
+ * wapi_bss_cache_begin() and wapi_bss_cache_commit(), with wapi_bss_cache_add()
+ * as the scan visitor, and only the differences are reported to the callback:
+ * BSSes that appeared, that changed, and that were not seen for longer than
+ * the maximum age. Since targeted scans visit a subset of channels, entries
+ * missing from a single scan are not dropped right away.
+ *
+ * @{
+ */
+
+
+/** BSS cache change events. */
+typedef enum {
+	WAPI_BSS_EVENT_ADD,			/**< A new BSS appeared. */
+	WAPI_BSS_EVENT_CHANGE,		/**< Channel, ESSID, mode, rate or signal changed. */
+	WAPI_BSS_EVENT_DEL			/**< The BSS aged out. */
+} wapi_bss_event_t;
+
+
+/** BSS cache change event names. */
+extern const char *wapi_bss_events[];
+
+
+/** Number of signal samples kept per BSS. */
+#define WAPI_BSS_HISTORY 8
+
+
+/** A cached BSS. */
+typedef struct wapi_bss_info_t {
+	struct ether_addr bssid;
+	unsigned int freq;			/**< Frequency in MHz, zero if unknown. */
+	int has_essid;
+	char essid[WAPI_ESSID_MAX_SIZE+1];
+	int has_mode;
+	wapi_mode_t mode;
+	int bitrate;				/**< Highest bitrate in bps, zero if unknown. */
+	int has_signal;
+	int signal;					/**< Last signal level in dBm. */
+	signed char history[WAPI_BSS_HISTORY];	/**< Signal samples, a ring. */
+	unsigned int nsamples;		/**< Samples taken so far. */
+	uint64_t first_seen;		/**< @c CLOCK_MONOTONIC msecs. */
+	uint64_t last_seen;
+} wapi_bss_info_t;
+
+
+/**
+ * Returns the k-th most recent signal sample of @a bss, @a k being less than
+ * both @c WAPI_BSS_HISTORY and @c nsamples.
+ */
+#define WAPI_BSS_SAMPLE(bss, k) \
+	((bss)->history[((bss)->nsamples - 1 - (k)) % WAPI_BSS_HISTORY])
+
+
+/** Opaque BSS cache. */
+typedef struct wapi_bss_cache_t wapi_bss_cache_t;
+
+
+/**
+ * BSS cache change callback. In case of @c WAPI_BSS_EVENT_DEL, @a bss is
+ * released right after the callback returns.
+ */
+typedef void (*wapi_bss_cache_cb_t)(
+	wapi_bss_event_t event,
+	const wapi_bss_info_t *bss,
+	void *arg);
+
+
+/**
+ * Creates an empty cache.
+ *
+ * @param[in] max_age Drops entries not seen for this many msecs. Zero drops
+ *     every entry missing from the latest scan.
+ * @param[in] signal_delta Reports signal changes of at least this many dB.
+ *     Zero to leave signal changes unreported.
+ * @param[in] cb Change callback, might be @c NULL.
+ * @param[out] cache Set to the allocated cache on success.
+ */
+int
+wapi_bss_cache_create(
+	unsigned int max_age,
+	unsigned int signal_delta,
+	wapi_bss_cache_cb_t cb,
+	void *arg,
+	wapi_bss_cache_t **cache);
+
+
+/**
+ * Starts merging a new scan.
+ */
+void wapi_bss_cache_begin(wapi_bss_cache_t *cache);
+
+
+/**
+ * Merges a scan entry. Has the signature of @c wapi_scan_visit_cb_t, with @a
+ * cache pointing to a @c wapi_bss_cache_t.
+ */
+int wapi_bss_cache_add(const struct wapi_scan_info_t *info, void *cache);
+
+
+/**
+ * Finishes merging the scan, and ages out stale entries.
+ *
+ * @return number of changes reported since wapi_bss_cache_begin().
+ */
+int wapi_bss_cache_commit(wapi_bss_cache_t *cache);
+
+
+/**
+ * Merges the results of a scan process. (wapi_scan_visit() between
+ * wapi_bss_cache_begin() and wapi_bss_cache_commit().)
+ *
+ * @return number of changes, or negative on failure.
+ */
+int wapi_bss_cache_update(int sock, const char *ifname, wapi_bss_cache_t *cache);
+
+
+/**
+ * Finds the entry of the given BSSID. Entries are valid until the next merge.
+ */
+const wapi_bss_info_t *
+wapi_bss_cache_lookup(
+	const wapi_bss_cache_t *cache,
+	const struct ether_addr *bssid);
+
+
+/**
+ * Iterates over the cached entries in no particular order. Start with @a pos
+ * set to zero.
+ *
+ * @return next entry, or @c NULL at the end.
+ */
+const wapi_bss_info_t *
+wapi_bss_cache_next(const wapi_bss_cache_t *cache, size_t *pos);
+
+
+/**
+ * Returns the number of cached entries.
+ */
+size_t wapi_bss_cache_count(const wapi_bss_cache_t *cache);
+
+
+/**
+ * Releases the cache.
+ */
+void wapi_bss_cache_destroy(wapi_bss_cache_t *cache);
+
+
+/** @} bsscache */
+
+
+/**
+ * @defgroup connect Fast Connect
+ * @ingroup wifaccessors
+ *
+ * Joins a network via @c NL80211_CMD_CONNECT. The BSS and its channel are
+ * taken from cached scan results, if they are fresh enough, which pins the
+ * kernel to that BSS and lets it skip scanning altogether. Otherwise, a scan
+ * targeted at the ESSID runs first. Completion is awaited on the nl80211 @c
+ * "mlme" multicast group, and the time spent in each phase is reported.
+ *
+ * Only open networks are joined on their own. Secured ones need a supplicant
+ * to carry out the key exchange afterwards.
+ *
+ * @include recover.c
+ *
+ * @{
+ */
+
+
+/** Connection deadline in msecs, used if none is given. */
+#define WAPI_CONNECT_TIMEOUT 10000
+
+
+/** Connection parameters. Zero fields stand for defaults. */
+typedef struct wapi_connect_params_t {
+	const char *essid;				/**< Network to join. */
+	const struct ether_addr *bssid;	/**< BSS to join, @c NULL to pick one. */
+	unsigned int freq;				/**< Channel in MHz, zero to look it up. */
+	const unsigned int *freqs;		/**< Channels to scan, if needed. */
+	size_t nfreqs;					/**< Zero to scan every channel. */
+	unsigned int max_age;			/**< Cached results older than this many
+									  *  msecs are not used. Zero to always
+									  *  scan. */
+	int timeout;					/**< Deadline in msecs, negative for none.
+									  *  Zero for @c WAPI_CONNECT_TIMEOUT. */
+} wapi_connect_params_t;
+
+
+/** Outcome of a connection attempt. Times are in usecs. */
+typedef struct wapi_connect_info_t {
+	struct ether_addr bssid;		/**< BSS the connection is requested for. */
+	unsigned int freq;				/**< Its channel in MHz, zero if unknown. */
+	int scanned;					/**< Whether a scan was needed. */
+	unsigned long hint_time;		/**< Reading cached scan results. */
+	unsigned long scan_time;		/**< Scanning, zero if skipped. */
+	unsigned long connect_time;		/**< From request to association. */
+	unsigned long total_time;
+} wapi_connect_info_t;
+
+
+/**
+ * Connects the interface to the given network and waits for the outcome.
+ * Lost notifications are not fatal: a scan settles for the results gathered
+ * so far, and the connection is waited for until the deadline.
+ *
+ * @param[out] info Filled with the selected BSS and phase timings, might be
+ *     @c NULL. Timings are valid on failures as well.
+ * @return zero on success; @c -ENOENT, if the network is not found; @c
+ *     -ETIMEDOUT, if the deadline expires; @c -ECONNREFUSED, if the AP
+ *     rejects the association; @c -ECONNRESET, if the attempt is torn
+ *     down; @c -EALREADY, if the interface is already connected; negative
+ *     on other failures.
+ */
+int
+wapi_connect(
+	const char *ifname,
+	const wapi_connect_params_t *params,
+	wapi_connect_info_t *info);
+
+
+/**
+ * wapi_connect() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_connect(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	const wapi_connect_params_t *params,
+	wapi_connect_info_t *info);
+
+
+/** @} connect */
+
+
+/**
+ * @defgroup stations Station Statistics
+ * @ingroup wifaccessors
+ *
+ * Per-station link statistics of @c NL80211_CMD_GET_STATION, covering what
+ * wireless extensions cannot tell: signal averages, retries, failures,
+ * bitrates in both directions, beacon loss and expected throughput. Replies
+ * are decoded into fixed-layout structures supplied by the caller, so that no
+ * allocation takes place per station. For sampling at high rates, use the
+ * @c wapi_ctx_ variants, which keep the nl80211 socket of the context open
+ * between calls.
+ *
+ * A managed interface has a single station, its AP. An AP interface has one
+ * per associated client.
+ *
+ * @include stations.c
+ *
+ * @{
+ */
+
+
+/** Field presence bits of @c wapi_sta_info_t. */
+typedef enum {
+	WAPI_STA_HAS_INACTIVE_TIME = 1 << 0,
+	WAPI_STA_HAS_CONNECTED_TIME = 1 << 1,
+	WAPI_STA_HAS_RX_BYTES = 1 << 2,
+	WAPI_STA_HAS_TX_BYTES = 1 << 3,
+	WAPI_STA_HAS_RX_PACKETS = 1 << 4,
+	WAPI_STA_HAS_TX_PACKETS = 1 << 5,
+	WAPI_STA_HAS_TX_RETRIES = 1 << 6,
+	WAPI_STA_HAS_TX_FAILED = 1 << 7,
+	WAPI_STA_HAS_SIGNAL = 1 << 8,
+	WAPI_STA_HAS_SIGNAL_AVG = 1 << 9,
+	WAPI_STA_HAS_TX_RATE = 1 << 10,
+	WAPI_STA_HAS_RX_RATE = 1 << 11,
+	WAPI_STA_HAS_BEACON_LOSS = 1 << 12,
+	WAPI_STA_HAS_BEACON_RX = 1 << 13,
+	WAPI_STA_HAS_EXPECTED_THROUGHPUT = 1 << 14,
+	WAPI_STA_HAS_FLAGS = 1 << 15
+} wapi_sta_has_t;
+
+
+/** Bitrate of the last frame in one direction. */
+typedef struct wapi_sta_rate_t {
+	uint32_t bitrate;			/**< In kbps, zero if unknown. */
+	uint8_t mcs;				/**< HT or VHT MCS index, 0xff for legacy. */
+	uint8_t nss;				/**< VHT spatial streams, zero if unknown. */
+	uint16_t width;				/**< Channel width in MHz. */
+	uint8_t short_gi;
+} wapi_sta_rate_t;
+
+
+/** Statistics of a station. */
+typedef struct wapi_sta_info_t {
+	struct ether_addr mac;
+	uint32_t has;				/**< Bitwise OR of @c wapi_sta_has_t. */
+	uint32_t inactive_time;		/**< In msecs. */
+	uint32_t connected_time;	/**< In secs. */
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint32_t rx_packets;
+	uint32_t tx_packets;
+	uint32_t tx_retries;
+	uint32_t tx_failed;
+	int8_t signal;				/**< Of the last frame in dBm. */
+	int8_t signal_avg;			/**< In dBm. */
+	wapi_sta_rate_t tx_rate;
+	wapi_sta_rate_t rx_rate;
+	uint32_t beacon_loss;		/**< Beacons lost in a row. */
+	uint64_t beacon_rx;
+	uint32_t expected_throughput;	/**< In kbps. */
+	uint32_t flags;				/**< Bitwise OR of (1 << @c NL80211_STA_FLAG_*)
+								  *  set for the station. */
+} wapi_sta_info_t;
+
+
+/** Station visitor. Negative return values stop the walk. */
+typedef int (*wapi_sta_visit_cb_t)(const wapi_sta_info_t *info, void *arg);
+
+
+/**
+ * Fetches the statistics of the station with the given address.
+ *
+ * @return zero on success; @c -ENOENT, if there is no such station; negative
+ *     on other failures.
+ */
+int
+wapi_sta_get(
+	const char *ifname,
+	const struct ether_addr *mac,
+	wapi_sta_info_t *info);
+
+
+/**
+ * Fetches the statistics of every station of the interface.
+ *
+ * @param[out] stas Room for @a size stations, the first ones are filled.
+ * @return number of stations, which might exceed @a size; negative on
+ *     failure.
+ */
+int wapi_sta_dump(const char *ifname, wapi_sta_info_t *stas, size_t size);
+
+
+/**
+ * Hands the statistics of every station of the interface to the visitor, one
+ * by one.
+ */
+int wapi_sta_visit(const char *ifname, wapi_sta_visit_cb_t cb, void *arg);
+
+
+/**
+ * wapi_sta_get() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_sta_get(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	const struct ether_addr *mac,
+	wapi_sta_info_t *info);
+
+
+/**
+ * wapi_sta_dump() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_sta_dump(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	wapi_sta_info_t *stas,
+	size_t size);
+
+
+/**
+ * wapi_sta_visit() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_sta_visit(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	wapi_sta_visit_cb_t cb,
+	void *arg);
+
+
+/** @} stations */
+
+
+/**
+ * @defgroup aptable AP Station Table
+ * @ingroup wifaccessors
+ *
+ * Clients associated to an interface in @c WAPI_MODE_MASTER, laid out column
+ * by column like scan tables. A table is filled by a single station dump, and
+ * a monitor listening to @c NL80211_CMD_NEW_STATION and @c
+ * NL80211_CMD_DEL_STATION events on the nl80211 @c "mlme" multicast group keeps
+ * it up to date afterwards, touching only the stations that come and go.
+ * Statistics of a row are as fresh as the dump or the event that brought it.
+ *
+ * Rows are looked up by MAC address via an index kept along with the table.
+ * Removal moves the last row into the place of the removed one, hence row
+ * indices are stable only until the next change.
+ *
+ * @include aptable.c
+ *
+ * @{
+ */
+
+
+/** Columnar station table. Zero to initialize. */
+typedef struct wapi_ap_sta_table_t {
+	size_t nsta;				/**< Number of rows. */
+	size_t size;				/**< Number of allocated rows. */
+	struct ether_addr *mac;
+	uint32_t *inactive_time;	/**< In msecs. */
+	int8_t *signal;				/**< Of the last frame in dBm. */
+	uint64_t *rx_bytes;
+	uint64_t *tx_bytes;
+	uint32_t *rx_rate;			/**< In kbps. */
+	uint32_t *tx_rate;			/**< In kbps. */
+	uint32_t *flags;			/**< See @c wapi_sta_info_t. */
+	uint32_t *has;				/**< Bitwise OR of @c wapi_sta_has_t. */
+	size_t *index;				/**< Rows by MAC address, internal. */
+	size_t index_size;
+	void *block;				/**< Backing storage of the columns. */
+} wapi_ap_sta_table_t;
+
+
+/**
+ * Inserts the station, or updates its row if it is already present. Has the
+ * signature of @c wapi_sta_visit_cb_t, with @a table pointing to a @c
+ * wapi_ap_sta_table_t.
+ */
+int wapi_ap_sta_table_add(const wapi_sta_info_t *info, void *table);
+
+
+/**
+ * Removes the station.
+ *
+ * @return zero on success; @c -ENOENT, if there is no such station.
+ */
+int
+wapi_ap_sta_table_del(
+	wapi_ap_sta_table_t *table,
+	const struct ether_addr *mac);
+
+
+/**
+ * Looks the station up.
+ *
+ * @return zero on success; @c -ENOENT, if there is no such station.
+ */
+int
+wapi_ap_sta_table_find(
+	const wapi_ap_sta_table_t *table,
+	const struct ether_addr *mac,
+	size_t *row);
+
+
+/**
+ * Fills @a table with a station dump of the interface. Previous rows are
+ * dropped, while allocated storage is kept.
+ */
+int wapi_ap_sta_table_fill(const char *ifname, wapi_ap_sta_table_t *table);
+
+
+/**
+ * wapi_ap_sta_table_fill() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_ap_sta_table_fill(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	wapi_ap_sta_table_t *table);
+
+
+/**
+ * Drops every row, keeping allocated storage.
+ */
+void wapi_ap_sta_table_clear(wapi_ap_sta_table_t *table);
+
+
+/**
+ * Releases the storage of the table.
+ */
+void wapi_ap_sta_table_free(wapi_ap_sta_table_t *table);
+
+
+/** Opaque station table monitor. */
+typedef struct wapi_ap_sta_mon_t wapi_ap_sta_mon_t;
+
+
+/**
+ * Subscribes to station events and fills @a table, which is kept up to date
+ * by wapi_ap_sta_mon_process() from then on. The table must outlive the
+ * monitor.
+ *
+ * @param[in] ctx Context whose nl80211 socket fetches new stations, might be
+ *     @c NULL.
+ */
+int
+wapi_ap_sta_mon_open(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	wapi_ap_sta_table_t *table,
+	wapi_ap_sta_mon_t **mon);
+
+
+/**
+ * Returns the descriptor to wait on for readability.
+ */
+int wapi_ap_sta_mon_fd(const wapi_ap_sta_mon_t *mon);
+
+
+/**
+ * Applies pending station events to the table without blocking. Lost events
+ * result in a refill.
+ *
+ * @return number of changes applied, or negative on failure.
+ */
+int wapi_ap_sta_mon_process(wapi_ap_sta_mon_t *mon);
+
+
+/**
+ * Releases the monitor. The table is left as is.
+ */
+void wapi_ap_sta_mon_close(wapi_ap_sta_mon_t *mon);
+
+
+/** Ways to drop a station. */
+typedef enum {
+	WAPI_STA_DISASSOC,			/**< Disassociation frame. */
+	WAPI_STA_DEAUTH				/**< Deauthentication frame. */
+} wapi_sta_kick_t;
+
+
+/**
+ * Drops the given stations with a single batch of @c NL80211_CMD_DEL_STATION
+ * requests, whose replies are collected afterwards. Stations are dropped
+ * behind the back of the AP daemon, which learns about it from the very
+ * events the monitor listens to.
+ *
+ * @param[in] reason IEEE 802.11 reason code, zero for 5 (AP is unable to
+ *     handle all associated stations).
+ * @param[out] errors Result of each station, zero or a negative errno. Might
+ *     be @c NULL.
+ * @return number of stations that could not be dropped, or negative on
+ *     failure.
+ */
+int
+wapi_ap_sta_kick(
+	const char *ifname,
+	const struct ether_addr *macs,
+	size_t n,
+	wapi_sta_kick_t kind,
+	unsigned int reason,
+	int *errors);
+
+
+/**
+ * wapi_ap_sta_kick() over the nl80211 socket of @a ctx.
+ */
+int
+wapi_ctx_ap_sta_kick(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	const struct ether_addr *macs,
+	size_t n,
+	wapi_sta_kick_t kind,
+	unsigned int reason,
+	int *errors);
+
+
+/** @} aptable */
+
+
+/**
+ * @defgroup commons Common Data Structures & Definitions
+ * @{
+ */
+
+
+/** Path to @c /proc/net/wireless. (Requires procfs mounted.) */
+#define WAPI_PROC_NET_WIRELESS "/proc/net/wireless"
+
+/** Path to @c /proc/net/route. (Requires procfs mounted.) */
+#define WAPI_PROC_NET_ROUTE "/proc/net/route"
+
+/** Buffer size while reading lines from PROC_NET_ files. */
+#define WAPI_PROC_LINE_SIZE	1024
+
+
+/** Linked list container for strings. */
+typedef struct wapi_string_t {
+	struct wapi_string_t *next;
+	char *data;
+} wapi_string_t;
+
+
+/** Linked list container for scan results. */
+typedef struct wapi_scan_info_t {
+	struct wapi_scan_info_t *next;
+	struct ether_addr ap;
+	int has_essid;
+	char essid[WAPI_ESSID_MAX_SIZE+1];
 	wapi_essid_flag_t essid_flag;
 	int has_freq;
 	double freq;
@@ -688,6 +2667,8 @@ typedef struct wapi_scan_info_t {
 	wapi_mode_t mode;
 	int has_bitrate;
 	int bitrate;
+	int has_signal;
+	int signal;		/**< Signal level in dBm. */
 } wapi_scan_info_t;
 
 
@@ -705,12 +2686,31 @@ typedef struct wapi_route_info_t {
 	unsigned int mtu;
 	unsigned int window;
 	unsigned int irtt;
+	int family;				/**< @c AF_INET or @c AF_INET6. */
+	unsigned int table;		/**< Routing table id. (See @c RT_TABLE_*.) */
+	int ifindex;			/**< Output interface index, 0 if unknown. */
+	unsigned int prefixlen;	/**< Destination prefix length. */
+	unsigned char protocol;	/**< See @c RTPROT_* in @c linux/rtnetlink.h. */
+	unsigned char scope;	/**< See @c RT_SCOPE_* in @c linux/rtnetlink.h. */
+	unsigned char type;		/**< See @c RTN_* in @c linux/rtnetlink.h. */
+	struct in6_addr dest6;	/**< Destination, if @c family is @c AF_INET6. */
+	struct in6_addr gw6;	/**< Gateway, if @c family is @c AF_INET6. */
 } wapi_route_info_t;
 
 
+/** Type of the nodes kept in a @c wapi_list_t. */
+typedef enum {
+	WAPI_LIST_NONE,		/**< Empty, or filled by the caller. */
+	WAPI_LIST_STRING,
+	WAPI_LIST_SCAN,
+	WAPI_LIST_ROUTE
+} wapi_list_type_t;
+
+
 /**
  * A generic linked list container. For functions taking @c wapi_list_t type of
- * argument, caller is resposible for releasing allocated memory.
+ * argument, caller is resposible for releasing allocated memory, which is
+ * what wapi_list_free() does.
  */
 struct wapi_list_t {
 	union wapi_list_head_t {
@@ -718,6 +2718,9 @@ struct wapi_list_t {
 		wapi_scan_info_t *scan;
 		wapi_route_info_t *route;
 	} head;
+	wapi_list_type_t type;	/**< Set by the functions filling the list. */
+	wapi_arena_t *arena;	/**< Set by wapi_list_init(), private. */
+	uint32_t tag;		/**< Set by wapi_list_init(), private. */
 };
 
 
@@ -0,0 +1,71 @@
+/**
+ * @file
+ * Reusable per-thread contexts.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "wapi.h"
+#include "netlink.h"
+#include "context.h"
+
+
+int
+wapi_ctx_create(wapi_ctx_t **ctx)
+{
+	wapi_ctx_t *c;
+
+	WAPI_VALIDATE_PTR(ctx);
+
+	c = malloc(sizeof(wapi_ctx_t));
+	if (!c)
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
+	}
+
+	if ((c->sock = wapi_make_socket()) < 0)
+	{
+		free(c);
+		return -1;
+	}
+	c->rtnl = -1;
+	c->genl = NULL;
+	c->nl80211 = -1;
+
+	*ctx = c;
+	return 0;
+}
+
+
+void
+wapi_ctx_destroy(wapi_ctx_t *ctx)
+{
+	if (!ctx) return;
+
+	close(ctx->sock);
+	if (ctx->rtnl >= 0) close(ctx->rtnl);
+	if (ctx->genl) wapi_ctx_nl80211_close(ctx);
+	free(ctx);
+}
+
+
+int
+wapi_ctx_sock(const wapi_ctx_t *ctx)
+{
+	WAPI_VALIDATE_PTR(ctx);
+	return ctx->sock;
+}
+
+
+int
+wapi_ctx_rtnl(wapi_ctx_t *ctx)
+{
+	if (ctx->rtnl < 0)
+		ctx->rtnl = wapi_rtnl_open(0);
+	return ctx->rtnl;
+}
@@ -0,0 +1,34 @@
+/**
+ * @file
+ * Internal wapi_ctx_t layout shared by the accessors.
+ */
+
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+
+#include "wapi.h"
+
+
+struct wapi_ctx_t {
+	int sock;		/* ioctl() socket. */
+	int rtnl;		/* NETLINK_ROUTE socket, -1 until first use. */
+	void *genl;		/* Generic netlink socket, NULL until first use. */
+	int nl80211;	/* Resolved nl80211 family id. */
+};
+
+
+/* Returns the rtnetlink socket of the context, opening it on first use. */
+int wapi_ctx_rtnl(wapi_ctx_t *ctx);
+
+
+/* Connects the generic netlink socket and resolves nl80211, if not yet done. */
+int wapi_ctx_nl80211(wapi_ctx_t *ctx);
+
+
+/* Releases the generic netlink socket. (Implemented next to libnl users.) */
+void wapi_ctx_nl80211_close(wapi_ctx_t *ctx);
+
+
+#endif /* CONTEXT_H */
@@ -0,0 +1,543 @@
+/**
+ * @file
+ * Internal rtnetlink (NETLINK_ROUTE) helper routines.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/route.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "netlink.h"
+
+
+int
+wapi_rtnl_open(unsigned int groups)
+{
+	struct sockaddr_nl snl;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (fd < 0)
+	{
+		WAPI_STRERROR("socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)");
+		return fd;
+	}
+
+	bzero(&snl, sizeof(struct sockaddr_nl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = groups;
+	if (bind(fd, (struct sockaddr *) &snl, sizeof(struct sockaddr_nl)) < 0)
+	{
+		WAPI_STRERROR("bind(AF_NETLINK)");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+int
+wapi_rtnl_strict(int fd)
+{
+	int one = 1;
+	return setsockopt(fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+}
+
+
+unsigned int
+wapi_rtnl_seq(unsigned int n)
+{
+	static unsigned int seq;
+	return __sync_add_and_fetch(&seq, n) - n + 1;
+}
+
+
+int
+wapi_rtnl_dump(int fd, struct nlmsghdr *req, wapi_rtnl_cb_t cb, void *arg)
+{
+	char buf[WAPI_RTNL_BUFSIZ] __attribute__((aligned(NLMSG_ALIGNTO)));
+	int intr;
+	int ret;
+
+	req->nlmsg_flags |= NLM_F_REQUEST | NLM_F_DUMP;
+	req->nlmsg_seq = wapi_rtnl_seq(1);
+	if (send(fd, req, req->nlmsg_len, 0) < 0)
+	{
+		WAPI_STRERROR("send(NETLINK_ROUTE)");
+		return -1;
+	}
+
+	/* Consume replies until NLMSG_DONE. Even after a callback failure, we keep
+	 * on draining the socket, so that it can be reused for other requests. */
+	ret = intr = 0;
+	for (;;)
+	{
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0)
+		{
+			if (errno == EINTR) continue;
+			WAPI_STRERROR("recv(NETLINK_ROUTE)");
+			return -1;
+		}
+
+		for (nlh = (struct nlmsghdr *) buf;
+			 NLMSG_OK(nlh, (size_t) len);
+			 nlh = NLMSG_NEXT(nlh, len))
+		{
+			if (nlh->nlmsg_seq != req->nlmsg_seq)
+				continue;
+
+			/* Tables changed in the middle of the dump. */
+			if (nlh->nlmsg_flags & NLM_F_DUMP_INTR)
+				intr = 1;
+
+			switch (nlh->nlmsg_type)
+			{
+			case NLMSG_DONE:
+				return (ret >= 0 && intr) ? -EAGAIN : ret;
+
+			case NLMSG_ERROR:
+			{
+				struct nlmsgerr *err = NLMSG_DATA(nlh);
+				errno = -err->error;
+				WAPI_STRERROR("NLMSG_ERROR");
+				return -1;
+			}
+
+			default:
+				if (ret >= 0 && (ret = cb(nlh, arg)) > 0)
+					ret = 0;
+			}
+		}
+	}
+}
+
+
+void
+wapi_netlink_drain(int fd)
+{
+	char buf[4096];
+
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0 ||
+		   errno == EINTR || errno == ENOBUFS);
+}
+
+
+int
+wapi_netlink_process(
+	int fd,
+	wapi_rtnl_cb_t cb,
+	wapi_netlink_overrun_cb_t overrun,
+	void *arg)
+{
+	char buf[WAPI_RTNL_BUFSIZ] __attribute__((aligned(NLMSG_ALIGNTO)));
+	int sum = 0;
+
+	for (;;)
+	{
+		struct nlmsghdr *nlh;
+		ssize_t len;
+		int ret;
+
+		len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len < 0)
+		{
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			if (errno != ENOBUFS)
+			{
+				WAPI_STRERROR("recv(AF_NETLINK)");
+				return -1;
+			}
+			if (!overrun) continue;
+			if ((ret = overrun(arg)) < 0)
+				return ret;
+			sum += ret;
+			continue;
+		}
+
+		for (nlh = (struct nlmsghdr *) buf;
+			 NLMSG_OK(nlh, (size_t) len);
+			 nlh = NLMSG_NEXT(nlh, len))
+		{
+			if ((ret = cb(nlh, arg)) < 0)
+				return ret;
+			sum += ret;
+		}
+	}
+
+	return sum;
+}
+
+
+int
+wapi_rtnl_batch(
+	int fd,
+	const void *buf,
+	size_t len,
+	unsigned int seq,
+	unsigned int n,
+	int *errors)
+{
+	char rbuf[WAPI_RTNL_BUFSIZ] __attribute__((aligned(NLMSG_ALIGNTO)));
+	unsigned int pending;
+	unsigned int k;
+	int nfailed;
+	int one = 1;
+	int rcvbuf = 1 << 20;
+
+	/* Make room for the acks, which needn't echo requests back. (Both are best
+	 * effort, the latter is available since 4.3.) A single ack always fits,
+	 * hence lone requests spare the system calls. */
+	if (n > 1)
+	{
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		setsockopt(fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+	}
+
+	if (send(fd, buf, len, 0) < 0)
+	{
+		WAPI_STRERROR("send(NETLINK_ROUTE)");
+		return -1;
+	}
+
+	for (k = 0; k < n; k++)
+		errors[k] = 1;
+
+	for (nfailed = 0, pending = n; pending; )
+	{
+		struct nlmsghdr *nlh;
+		ssize_t rlen;
+
+		rlen = recv(fd, rbuf, sizeof(rbuf), 0);
+		if (rlen < 0)
+		{
+			if (errno == EINTR) continue;
+			WAPI_STRERROR("recv(NETLINK_ROUTE)");
+			return -1;
+		}
+
+		for (nlh = (struct nlmsghdr *) rbuf;
+			 NLMSG_OK(nlh, (size_t) rlen);
+			 nlh = NLMSG_NEXT(nlh, rlen))
+		{
+			struct nlmsgerr *err = NLMSG_DATA(nlh);
+
+			k = nlh->nlmsg_seq - seq;
+			if (nlh->nlmsg_type != NLMSG_ERROR || k >= n || errors[k] != 1)
+				continue;
+
+			errors[k] = err->error;
+			if (err->error) nfailed++;
+			pending--;
+		}
+	}
+
+	return nfailed;
+}
+
+
+int
+wapi_rtnl_transact(
+	int fd,
+	size_t n,
+	wapi_rtnl_build_cb_t build,
+	wapi_rtnl_done_cb_t done,
+	void *arg)
+{
+	char *buf;
+	int errors[WAPI_RTNL_BATCH_MAX];
+	size_t index[WAPI_RTNL_BATCH_MAX];
+	size_t k;
+	int nfailed;
+
+	if (!n) return 0;
+
+	buf = malloc(WAPI_RTNL_BATCH_MAX * WAPI_RTNL_REQSIZ);
+	if (!buf)
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
+	}
+
+	for (nfailed = 0, k = 0; k < n; )
+	{
+		unsigned int cnt;
+		unsigned int nsent;
+		unsigned int seq;
+		size_t len = 0;
+		unsigned int i;
+		int ret;
+
+		cnt = n - k < WAPI_RTNL_BATCH_MAX ? n - k : WAPI_RTNL_BATCH_MAX;
+		seq = wapi_rtnl_seq(cnt);
+
+		/* Pack requests back to back. Rejected ones fail on their own, since
+		 * earlier chunks might have been committed already. */
+		for (nsent = 0, i = 0; i < cnt; i++)
+		{
+			struct nlmsghdr *nlh = (struct nlmsghdr *) (buf + len);
+
+			if ((ret = build(nlh, WAPI_RTNL_REQSIZ, k + i, arg)) < 0)
+			{
+				done(k + i, ret < -1 ? ret : -EINVAL, arg);
+				nfailed++;
+				continue;
+			}
+			nlh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+			nlh->nlmsg_seq = seq + nsent;
+			len += NLMSG_ALIGN(nlh->nlmsg_len);
+			index[nsent++] = k + i;
+		}
+		k += cnt;
+		if (!nsent) continue;
+
+		/* Ship them and collect per-entry results. */
+		if ((ret = wapi_rtnl_batch(fd, buf, len, seq, nsent, errors)) < 0)
+		{
+			nfailed = ret;
+			break;
+		}
+		for (i = 0; i < nsent; i++)
+			done(index[i], errors[i], arg);
+		nfailed += ret;
+	}
+
+	free(buf);
+	return nfailed;
+}
+
+
+int
+wapi_rtnl_addattr(
+	struct nlmsghdr *nlh,
+	size_t maxlen,
+	int type,
+	const void *data,
+	size_t len)
+{
+	struct rtattr *rta;
+	size_t rtalen = RTA_LENGTH(len);
+
+	if (NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rtalen) > maxlen)
+	{
+		WAPI_ERROR("Attribute %d does not fit into the message!\n", type);
+		return -1;
+	}
+
+	rta = (struct rtattr *) (((char *) nlh) + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = rtalen;
+	if (len) memcpy(RTA_DATA(rta), data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rtalen);
+
+	return 0;
+}
+
+
+struct rtattr *
+wapi_rtnl_nest(struct nlmsghdr *nlh, size_t maxlen, int type)
+{
+	struct rtattr *nest =
+		(struct rtattr *) (((char *) nlh) + NLMSG_ALIGN(nlh->nlmsg_len));
+
+	if (wapi_rtnl_addattr(nlh, maxlen, type, NULL, 0) < 0)
+		return NULL;
+
+	return nest;
+}
+
+
+void
+wapi_rtnl_nest_end(struct nlmsghdr *nlh, struct rtattr *nest)
+{
+	nest->rta_len = ((char *) nlh) + nlh->nlmsg_len - (char *) nest;
+}
+
+
+void
+wapi_rtnl_parse(struct rtattr *tb[], int max, struct rtattr *rta, int len)
+{
+	memset(tb, 0, sizeof(struct rtattr *) * (max + 1));
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+	{
+		int type = rta->rta_type & NLA_TYPE_MASK;
+		if (type <= max) tb[type] = rta;
+	}
+}
+
+
+const char *
+wapi_ifname_cache_get(wapi_ifname_cache_t *cache, int ifindex)
+{
+	static char unknown[] = "*";
+	char ifname[IFNAMSIZ];
+	int k;
+
+	if (!ifindex) return unknown;
+
+	for (k = 0; k < cache->len; k++)
+		if (cache->entries[k].ifindex == ifindex)
+			return cache->entries[k].ifname;
+
+	if (!if_indextoname(ifindex, ifname))
+		snprintf(ifname, IFNAMSIZ, "if%d", ifindex);
+
+	/* Recycle a slot, if the cache is full. */
+	k = cache->len < WAPI_IFNAME_CACHE_SIZE
+		? cache->len++
+		: ifindex % WAPI_IFNAME_CACHE_SIZE;
+	cache->entries[k].ifindex = ifindex;
+	memcpy(cache->entries[k].ifname, ifname, IFNAMSIZ);
+
+	return cache->entries[k].ifname;
+}
+
+
+int
+wapi_rtnl_route_dump(
+	int fd,
+	const wapi_route_filter_t *filter,
+	wapi_rtnl_cb_t cb,
+	void *arg)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct rtmsg rtm;
+		char attrs[64];
+	} req;
+
+	bzero(&req, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.nlh.nlmsg_type = RTM_GETROUTE;
+	req.rtm.rtm_family = filter ? filter->family : AF_UNSPEC;
+
+	/* Let the kernel filter by table, output interface, and protocol, if it
+	 * can. */
+	if (filter && !wapi_rtnl_strict(fd))
+	{
+		req.rtm.rtm_protocol = filter->protocol;
+		if (filter->table)
+		{
+			__u32 table = filter->table;
+			req.rtm.rtm_table = table < 256 ? table : RT_TABLE_UNSPEC;
+			wapi_rtnl_addattr(
+				&req.nlh, sizeof(req), RTA_TABLE, &table, sizeof(table));
+		}
+		if (filter->ifindex)
+			wapi_rtnl_addattr(
+				&req.nlh, sizeof(req), RTA_OIF,
+				&filter->ifindex, sizeof(filter->ifindex));
+	}
+
+	return wapi_rtnl_dump(fd, &req.nlh, cb, arg);
+}
+
+
+int
+wapi_rtnl_route_match(
+	const wapi_route_filter_t *filter,
+	const wapi_route_info_t *ri)
+{
+	return !filter ||
+		((filter->family == AF_UNSPEC || filter->family == ri->family) &&
+		 (!filter->table || filter->table == ri->table) &&
+		 (!filter->ifindex || filter->ifindex == ri->ifindex) &&
+		 (!filter->protocol || filter->protocol == ri->protocol));
+}
+
+
+int
+wapi_rtnl_route_parse(const struct nlmsghdr *nlh, wapi_route_info_t *ri)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nlh);
+	struct rtattr *tb[RTA_MAX + 1];
+	struct rtattr *gw;
+	int len;
+
+	len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct rtmsg));
+	if (len < 0 || (rtm->rtm_flags & RTM_F_CLONED) ||
+		(rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6))
+		return 1;
+
+	wapi_rtnl_parse(tb, RTA_MAX, RTM_RTA(rtm), len);
+
+	ri->family = rtm->rtm_family;
+	ri->table = tb[RTA_TABLE] ? *(__u32 *) RTA_DATA(tb[RTA_TABLE]) : rtm->rtm_table;
+	ri->prefixlen = rtm->rtm_dst_len;
+	ri->protocol = rtm->rtm_protocol;
+	ri->scope = rtm->rtm_scope;
+	ri->type = rtm->rtm_type;
+	ri->ifindex = tb[RTA_OIF] ? *(int *) RTA_DATA(tb[RTA_OIF]) : 0;
+	ri->metric = tb[RTA_PRIORITY] ? *(__u32 *) RTA_DATA(tb[RTA_PRIORITY]) : 0;
+	gw = tb[RTA_GATEWAY];
+
+	/* For multipath routes, report the first next hop. */
+	if (tb[RTA_MULTIPATH] && !ri->ifindex)
+	{
+		struct rtnexthop *nh = RTA_DATA(tb[RTA_MULTIPATH]);
+		if (RTA_PAYLOAD(tb[RTA_MULTIPATH]) >= sizeof(struct rtnexthop))
+		{
+			struct rtattr *nhtb[RTA_MAX + 1];
+
+			ri->ifindex = nh->rtnh_ifindex;
+			wapi_rtnl_parse(
+				nhtb, RTA_MAX, RTNH_DATA(nh),
+				nh->rtnh_len - sizeof(struct rtnexthop));
+			if (!gw) gw = nhtb[RTA_GATEWAY];
+		}
+	}
+
+	/* Metrics. */
+	if (tb[RTA_METRICS])
+	{
+		struct rtattr *mxtb[RTAX_MAX + 1];
+
+		wapi_rtnl_parse(
+			mxtb, RTAX_MAX, RTA_DATA(tb[RTA_METRICS]),
+			RTA_PAYLOAD(tb[RTA_METRICS]));
+		if (mxtb[RTAX_MTU]) ri->mtu = *(__u32 *) RTA_DATA(mxtb[RTAX_MTU]);
+		if (mxtb[RTAX_WINDOW]) ri->window = *(__u32 *) RTA_DATA(mxtb[RTAX_WINDOW]);
+		if (mxtb[RTAX_RTT]) ri->irtt = *(__u32 *) RTA_DATA(mxtb[RTAX_RTT]);
+	}
+
+	/* Addresses. */
+	if (ri->family == AF_INET)
+	{
+		if (tb[RTA_DST])
+			memcpy(&ri->dest, RTA_DATA(tb[RTA_DST]), sizeof(struct in_addr));
+		if (gw)
+			memcpy(&ri->gw, RTA_DATA(gw), sizeof(struct in_addr));
+		ri->netmask.s_addr =
+			ri->prefixlen ? htonl(0xFFFFFFFFu << (32 - ri->prefixlen)) : 0;
+	}
+	else
+	{
+		if (tb[RTA_DST])
+			memcpy(&ri->dest6, RTA_DATA(tb[RTA_DST]), sizeof(struct in6_addr));
+		if (gw)
+			memcpy(&ri->gw6, RTA_DATA(gw), sizeof(struct in6_addr));
+	}
+
+	/* Translate into RTF_* flags the way fib_route_seq_show() does. */
+	ri->flags = (rtm->rtm_flags & RTNH_F_DEAD) ? 0 : RTF_UP;
+	if (gw) ri->flags |= RTF_GATEWAY;
+	if (ri->prefixlen == (ri->family == AF_INET ? 32 : 128))
+		ri->flags |= RTF_HOST;
+	if (ri->type == RTN_UNREACHABLE || ri->type == RTN_PROHIBIT ||
+		ri->type == RTN_BLACKHOLE)
+		ri->flags |= RTF_REJECT;
+
+	return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * @file
+ * Internal rtnetlink (NETLINK_ROUTE) helper declarations.
+ */
+
+
+#ifndef NETLINK_H
+#define NETLINK_H
+
+
+#include <stddef.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "wapi.h"
+
+
+/* Older kernel headers (e.g. OpenWrt toolchains) miss strict dump checking. */
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+
+
+/* Receive buffer size. Kernel never packs more than 32K into a dump skb. */
+#define WAPI_RTNL_BUFSIZ 32768
+
+
+/* Request buffer size for single rtnetlink messages. */
+#define WAPI_RTNL_REQSIZ 512
+
+
+/* Per-message callback used by wapi_rtnl_dump(). Non-negative to continue. */
+typedef int (*wapi_rtnl_cb_t)(const struct nlmsghdr *nlh, void *arg);
+
+
+/* Opens a NETLINK_ROUTE socket subscribed to the given multicast groups. */
+int wapi_rtnl_open(unsigned int groups);
+
+
+/* Enables NETLINK_GET_STRICT_CHK on the socket. Returns 0, if supported. */
+int wapi_rtnl_strict(int fd);
+
+
+/* Reserves "n" consecutive sequence numbers and returns the first one. */
+unsigned int wapi_rtnl_seq(unsigned int n);
+
+
+/* Sends a dump request and feeds every reply message to the callback. Returns
+ * -EAGAIN if the dump was interrupted by a concurrent change, in which case the
+ * messages fed so far may not form a consistent snapshot. */
+int wapi_rtnl_dump(int fd, struct nlmsghdr *req, wapi_rtnl_cb_t cb, void *arg);
+
+
+/* Times an interrupted dump is retried before giving up with -EAGAIN. */
+#define WAPI_RTNL_DUMP_TRIES 3
+
+
+/* Discards whatever is queued on a netlink socket without blocking. */
+void wapi_netlink_drain(int fd);
+
+
+/* Called by wapi_netlink_process() when notifications got lost. Returns the
+ * number of changes it made, or negative to stop. */
+typedef int (*wapi_netlink_overrun_cb_t)(void *arg);
+
+
+/* Feeds the messages queued on a netlink socket (of any protocol) to "cb"
+ * without blocking, until the queue is empty or a callback returns negative.
+ * Lost notifications (ENOBUFS) are reported to "overrun", or ignored if it is
+ * NULL. Returns the sum of the non-negative callback results, or the negative
+ * one that stopped the loop (-1 on receive failures). */
+int
+wapi_netlink_process(
+	int fd,
+	wapi_rtnl_cb_t cb,
+	wapi_netlink_overrun_cb_t overrun,
+	void *arg);
+
+
+/* Maximum number of requests sent with a single wapi_rtnl_batch() call. Each
+ * ack occupies a separate skb on the receive queue, hence the limit. */
+#define WAPI_RTNL_BATCH_MAX 256
+
+
+/* Sends "n" requests packed back to back in "buf" with a single sendmsg(), and
+ * collects their acks. Requests must carry NLM_F_ACK and consecutive sequence
+ * numbers starting from "seq". errors[k] is set to 0 or to a negative errno for
+ * the k-th request. Returns the number of failed requests, or -1 if the batch
+ * could not be transferred. */
+int
+wapi_rtnl_batch(
+	int fd,
+	const void *buf,
+	size_t len,
+	unsigned int seq,
+	unsigned int n,
+	int *errors);
+
+
+/* Builds the k-th request of a transaction into "nlh", which has room for
+ * "maxlen" bytes. Sequence number, NLM_F_REQUEST and NLM_F_ACK are set by
+ * wapi_rtnl_transact() afterwards. On failure, returns a negative errno (or
+ * -1 for -EINVAL) to be reported for the request. */
+typedef int (*wapi_rtnl_build_cb_t)(
+	struct nlmsghdr *nlh,
+	size_t maxlen,
+	size_t k,
+	void *arg);
+
+
+/* Receives the result (0 or a negative errno) of the k-th request. */
+typedef void (*wapi_rtnl_done_cb_t)(size_t k, int error, void *arg);
+
+
+/* Runs "n" requests in chunks of WAPI_RTNL_BATCH_MAX via wapi_rtnl_batch().
+ * Requests rejected by "build" fail alone, without being sent. Returns the
+ * number of failed requests, or -1 on transfer failures. */
+int
+wapi_rtnl_transact(
+	int fd,
+	size_t n,
+	wapi_rtnl_build_cb_t build,
+	wapi_rtnl_done_cb_t done,
+	void *arg);
+
+
+/* Appends an attribute to the message. Fails, if maxlen would be exceeded. */
+int
+wapi_rtnl_addattr(
+	struct nlmsghdr *nlh,
+	size_t maxlen,
+	int type,
+	const void *data,
+	size_t len);
+
+
+/* Starts a nested attribute. Close it with wapi_rtnl_nest_end(). */
+struct rtattr *wapi_rtnl_nest(struct nlmsghdr *nlh, size_t maxlen, int type);
+
+
+/* Closes a nested attribute started by wapi_rtnl_nest(). */
+void wapi_rtnl_nest_end(struct nlmsghdr *nlh, struct rtattr *nest);
+
+
+/* Indexes attributes of the given stream by type into tb[0..max]. */
+void wapi_rtnl_parse(struct rtattr *tb[], int max, struct rtattr *rta, int len);
+
+
+/* Number of ifindex to ifname mappings kept by wapi_ifname_cache_t. */
+#define WAPI_IFNAME_CACHE_SIZE 32
+
+
+/* Small ifindex to ifname cache, so that decoding thousands of routes over a
+ * handful of interfaces results in a handful of lookups. Zero to initialize. */
+typedef struct wapi_ifname_cache_t {
+	int len;
+	struct {
+		int ifindex;
+		char ifname[IFNAMSIZ];
+	} entries[WAPI_IFNAME_CACHE_SIZE];
+} wapi_ifname_cache_t;
+
+
+/* Resolves the name of the interface. Never fails, "*" is returned for the
+ * zero index, and "if<N>" for unknown interfaces. */
+const char *wapi_ifname_cache_get(wapi_ifname_cache_t *cache, int ifindex);
+
+
+/* Issues an RTM_GETROUTE dump with the given filter. (NULL for everything.) */
+int
+wapi_rtnl_route_dump(
+	int fd,
+	const wapi_route_filter_t *filter,
+	wapi_rtnl_cb_t cb,
+	void *arg);
+
+
+/* Checks whether the decoded route passes the filter. (NULL for everything.) */
+int
+wapi_rtnl_route_match(
+	const wapi_route_filter_t *filter,
+	const wapi_route_info_t *ri);
+
+
+/* Runs a wapi_get_routes_nl() over "fd". */
+int
+wapi_rtnl_get_routes(
+	int fd,
+	wapi_list_t *list,
+	const wapi_route_filter_t *filter);
+
+
+/* Runs a wapi_route_batch() over "fd". Added routes without a protocol get
+ * "protocol", or RTPROT_BOOT if it is zero. */
+int
+wapi_rtnl_route_batch(
+	int fd,
+	wapi_route_op_t *ops,
+	size_t n,
+	unsigned char protocol);
+
+
+/* Decodes an RTM_NEWROUTE/RTM_DELROUTE message into "ri". (Except "ifname" and
+ * "next" fields.) Returns 1, if the message does not carry a plain route. */
+int wapi_rtnl_route_parse(const struct nlmsghdr *nlh, wapi_route_info_t *ri);
+
+
+#endif /* NETLINK_H */
@@ -11,9 +11,13 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
+#include <net/if.h>
 
 #include "util.h"
 #include "wapi.h"
+#include "netlink.h"
+#include "context.h"
 
 
 /*-- Up & Down ---------------------------------------------------------------*/
@@ -72,6 +76,167 @@ wapi_set_ifdown(int sock, const char *ifname)
 }
 
 
+static int
+wapi_ifstate_msg(struct nlmsghdr *nlh, size_t maxlen, size_t k, void *arg)
+{
+	const wapi_ifstate_op_t *op = &((const wapi_ifstate_op_t *) arg)[k];
+	struct ifinfomsg *ifi;
+
+	bzero(nlh, NLMSG_LENGTH(sizeof(struct ifinfomsg)));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	nlh->nlmsg_type = RTM_NEWLINK;
+	ifi = NLMSG_DATA(nlh);
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_index = op->ifindex;
+	ifi->ifi_flags = op->up ? IFF_UP : 0;
+	ifi->ifi_change = IFF_UP;
+
+	/* Kernel looks the device up by name, if no index is given. */
+	if (!op->ifindex)
+	{
+		if (!op->ifname)
+		{
+			WAPI_ERROR("Neither ifindex nor ifname is given!\n");
+			return -1;
+		}
+		return wapi_rtnl_addattr(
+			nlh, maxlen, IFLA_IFNAME, op->ifname,
+			strnlen(op->ifname, IFNAMSIZ - 1) + 1);
+	}
+
+	return 0;
+}
+
+
+static void
+wapi_ifstate_done(size_t k, int error, void *arg)
+{
+	((wapi_ifstate_op_t *) arg)[k].error = error;
+}
+
+
+int
+wapi_set_ifstate(wapi_ifstate_op_t *ops, size_t n)
+{
+	int fd;
+	int ret;
+
+	WAPI_VALIDATE_PTR(ops);
+
+	if ((fd = wapi_rtnl_open(0)) < 0)
+		return fd;
+
+	ret = wapi_rtnl_transact(fd, n, wapi_ifstate_msg, wapi_ifstate_done, ops);
+	close(fd);
+
+	return ret;
+}
+
+
+int
+wapi_ctx_set_ifstate(wapi_ctx_t *ctx, wapi_ifstate_op_t *ops, size_t n)
+{
+	int fd;
+
+	WAPI_VALIDATE_PTR(ctx);
+	WAPI_VALIDATE_PTR(ops);
+
+	if ((fd = wapi_ctx_rtnl(ctx)) < 0)
+		return fd;
+	return wapi_rtnl_transact(fd, n, wapi_ifstate_msg, wapi_ifstate_done, ops);
+}
+
+
+/**
+ * Sends a single request built on the stack, and awaits its ack. That is, a
+ * send() and a recv() over @a fd.
+ */
+static int
+wapi_set_ifstate_one(int fd, const char *ifname, int up)
+{
+	char buf[WAPI_RTNL_REQSIZ] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh = (struct nlmsghdr *) buf;
+	wapi_ifstate_op_t op;
+	int ret;
+
+	WAPI_VALIDATE_PTR(ifname);
+
+	op.ifname = ifname;
+	op.ifindex = 0;
+	op.up = up;
+	op.error = 0;
+	if ((ret = wapi_ifstate_msg(nlh, sizeof(buf), 0, &op)) < 0)
+		return ret;
+	nlh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+	nlh->nlmsg_seq = wapi_rtnl_seq(1);
+
+	if ((ret = wapi_rtnl_batch(
+			 fd, buf, nlh->nlmsg_len, nlh->nlmsg_seq, 1, &op.error)) > 0)
+	{
+		errno = -op.error;
+		WAPI_STRERROR("RTM_NEWLINK(\"%s\")", ifname);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+
+static int
+wapi_set_ifstate_nl(const char *ifname, int up)
+{
+	int fd;
+	int ret;
+
+	if ((fd = wapi_rtnl_open(0)) < 0)
+		return fd;
+	ret = wapi_set_ifstate_one(fd, ifname, up);
+	close(fd);
+
+	return ret;
+}
+
+
+int
+wapi_set_ifup_nl(const char *ifname)
+{
+	return wapi_set_ifstate_nl(ifname, 1);
+}
+
+
+int
+wapi_set_ifdown_nl(const char *ifname)
+{
+	return wapi_set_ifstate_nl(ifname, 0);
+}
+
+
+int
+wapi_ctx_set_ifup_nl(wapi_ctx_t *ctx, const char *ifname)
+{
+	int fd;
+
+	WAPI_VALIDATE_PTR(ctx);
+
+	if ((fd = wapi_ctx_rtnl(ctx)) < 0)
+		return fd;
+	return wapi_set_ifstate_one(fd, ifname, 1);
+}
+
+
+int
+wapi_ctx_set_ifdown_nl(wapi_ctx_t *ctx, const char *ifname)
+{
+	int fd;
+
+	WAPI_VALIDATE_PTR(ctx);
+
+	if ((fd = wapi_ctx_rtnl(ctx)) < 0)
+		return fd;
+	return wapi_set_ifstate_one(fd, ifname, 0);
+}
+
+
 /*-- IP & Netmask ------------------------------------------------------------*/
 
 
@@ -143,104 +308,818 @@ wapi_set_netmask(int sock, const char *ifname, const struct in_addr *addr)
 }
 
 
-/*-- Routing -----------------------------------------------------------------*/
+/*-- Address Batches ---------------------------------------------------------*/
+
+
+typedef struct wapi_addr_batch_ctx_t {
+	wapi_addr_op_t *ops;
+	const char *ifname;	/* Last resolved interface name and its index. */
+	int ifindex;
+} wapi_addr_batch_ctx_t;
+
+
+static int
+wapi_addr_batch_msg(struct nlmsghdr *nlh, size_t maxlen, size_t k, void *arg)
+{
+	wapi_addr_batch_ctx_t *ctx = arg;
+	const wapi_addr_op_t *op = &ctx->ops[k];
+	const wapi_if_addr_t *addr = op->addr;
+	struct ifaddrmsg *ifa;
+	const void *data;
+	size_t addrlen;
+	int ifindex;
+
+	WAPI_VALIDATE_PTR(addr);
+
+	/* Resolve interface index. Aliases usually come in runs of the same
+	 * interface, hence the last resolution is remembered. */
+	if (!(ifindex = op->ifindex))
+	{
+		WAPI_VALIDATE_PTR(op->ifname);
+		if (!ctx->ifname || strcmp(ctx->ifname, op->ifname))
+		{
+			/* Only this entry fails, the rest of the batch goes on. */
+			if (!(ifindex = if_nametoindex(op->ifname)))
+			{
+				WAPI_STRERROR("if_nametoindex(\"%s\")", op->ifname);
+				return -ENODEV;
+			}
+			ctx->ifname = op->ifname;
+			ctx->ifindex = ifindex;
+		}
+		ifindex = ctx->ifindex;
+	}
+
+	switch (addr->family)
+	{
+	case AF_INET:
+		addrlen = sizeof(struct in_addr);
+		data = &addr->addr;
+		break;
+	case AF_INET6:
+		addrlen = sizeof(struct in6_addr);
+		data = &addr->addr6;
+		break;
+	default:
+		WAPI_ERROR("Unsupported address family: %d.\n", addr->family);
+		return -EAFNOSUPPORT;
+	}
+
+	/* Header. */
+	bzero(nlh, NLMSG_LENGTH(sizeof(struct ifaddrmsg)));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	switch (op->act)
+	{
+	case WAPI_ADDR_ACT_ADD:
+		nlh->nlmsg_type = RTM_NEWADDR;
+		nlh->nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+		break;
+	case WAPI_ADDR_ACT_REPLACE:
+		nlh->nlmsg_type = RTM_NEWADDR;
+		nlh->nlmsg_flags = NLM_F_CREATE | NLM_F_REPLACE;
+		break;
+	case WAPI_ADDR_ACT_DEL:
+		nlh->nlmsg_type = RTM_DELADDR;
+		break;
+	default:
+		WAPI_ERROR("Unknown address action: %d.\n", op->act);
+		return -1;
+	}
+	ifa = NLMSG_DATA(nlh);
+	ifa->ifa_family = addr->family;
+	ifa->ifa_prefixlen = addr->prefixlen;
+	ifa->ifa_flags = addr->flags & 0xFF;
+	ifa->ifa_scope = addr->scope;
+	ifa->ifa_index = ifindex;
+
+	/* Attributes. */
+	if (wapi_rtnl_addattr(nlh, maxlen, IFA_LOCAL, data, addrlen) < 0 ||
+		wapi_rtnl_addattr(nlh, maxlen, IFA_ADDRESS, data, addrlen) < 0 ||
+		(addr->flags > 0xFF && wapi_rtnl_addattr(
+			nlh, maxlen, IFA_FLAGS, &addr->flags, sizeof(addr->flags)) < 0))
+		return -1;
+
+	if (op->act == WAPI_ADDR_ACT_DEL)
+		return 0;
+
+	if (addr->family == AF_INET && addr->prefixlen < 31)
+	{
+		struct in_addr brd = addr->broadcast;
+		if (!brd.s_addr)
+			brd.s_addr = addr->addr.s_addr | ~htonl(
+				addr->prefixlen ? 0xFFFFFFFFu << (32 - addr->prefixlen) : 0);
+		if (wapi_rtnl_addattr(
+				nlh, maxlen, IFA_BROADCAST, &brd, sizeof(struct in_addr)) < 0)
+			return -1;
+	}
+
+	if (op->valid_lft || op->preferred_lft)
+	{
+		struct ifa_cacheinfo ci;
+
+		bzero(&ci, sizeof(ci));
+		ci.ifa_valid = op->valid_lft ? op->valid_lft : 0xFFFFFFFFu;
+		ci.ifa_prefered = op->preferred_lft ? op->preferred_lft : ci.ifa_valid;
+		if (wapi_rtnl_addattr(nlh, maxlen, IFA_CACHEINFO, &ci, sizeof(ci)) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static void
+wapi_addr_batch_done(size_t k, int error, void *arg)
+{
+	((wapi_addr_batch_ctx_t *) arg)->ops[k].error = error;
+}
+
+
+static int
+wapi_addr_batch_fd(int fd, wapi_addr_op_t *ops, size_t n)
+{
+	wapi_addr_batch_ctx_t ctx;
+
+	bzero(&ctx, sizeof(ctx));
+	ctx.ops = ops;
+	return wapi_rtnl_transact(
+		fd, n, wapi_addr_batch_msg, wapi_addr_batch_done, &ctx);
+}
 
 
 int
-wapi_get_routes(wapi_list_t *list)
+wapi_addr_batch(wapi_addr_op_t *ops, size_t n)
 {
-	FILE *fp;
+	int fd;
 	int ret;
-	size_t bufsiz = WAPI_PROC_LINE_SIZE * sizeof(char);
-	char buf[WAPI_PROC_LINE_SIZE];
 
-	WAPI_VALIDATE_PTR(list);
+	WAPI_VALIDATE_PTR(ops);
+
+	if ((fd = wapi_rtnl_open(0)) < 0)
+		return fd;
+	ret = wapi_addr_batch_fd(fd, ops, n);
+	close(fd);
+
+	return ret;
+}
+
+
+int
+wapi_ctx_addr_batch(wapi_ctx_t *ctx, wapi_addr_op_t *ops, size_t n)
+{
+	int fd;
 
-	/* Open file for reading. */
-	fp = fopen(WAPI_PROC_NET_ROUTE, "r");
-	if (!fp)
+	WAPI_VALIDATE_PTR(ctx);
+	WAPI_VALIDATE_PTR(ops);
+
+	if ((fd = wapi_ctx_rtnl(ctx)) < 0)
+		return fd;
+	return wapi_addr_batch_fd(fd, ops, n);
+}
+
+
+int
+wapi_set_ip_nl(
+	const char *ifname,
+	const struct in_addr *addr,
+	unsigned int prefixlen)
+{
+	wapi_if_addr_t ifaddr;
+	wapi_addr_op_t op;
+	int ret;
+
+	WAPI_VALIDATE_PTR(ifname);
+	WAPI_VALIDATE_PTR(addr);
+
+	bzero(&ifaddr, sizeof(wapi_if_addr_t));
+	ifaddr.family = AF_INET;
+	ifaddr.prefixlen = prefixlen;
+	memcpy(&ifaddr.addr, addr, sizeof(struct in_addr));
+
+	bzero(&op, sizeof(wapi_addr_op_t));
+	op.act = WAPI_ADDR_ACT_REPLACE;
+	op.ifname = ifname;
+	op.addr = &ifaddr;
+	if ((ret = wapi_addr_batch(&op, 1)) > 0)
 	{
-		WAPI_STRERROR("fopen(\"%s\", \"r\")", WAPI_PROC_NET_ROUTE);
-		return -1;
+		errno = -op.error;
+		WAPI_STRERROR("RTM_NEWADDR(\"%s\")", ifname);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+
+/*-- Interface Table ---------------------------------------------------------*/
+
+
+typedef struct wapi_if_table_ctx_t {
+	wapi_if_table_t *table;
+	size_t maxifs;
+	size_t maxaddrs;
+	int *owners;	/* Interface index of each address. */
+	size_t maxowners;
+} wapi_if_table_ctx_t;
+
+
+static int
+wapi_if_table_link_cb(const struct nlmsghdr *nlh, void *arg)
+{
+	wapi_if_table_ctx_t *ctx = arg;
+	wapi_if_table_t *table = ctx->table;
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_MAX + 1];
+	wapi_if_info_t *info;
+	int len;
+
+	len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	if (nlh->nlmsg_type != RTM_NEWLINK || len < 0)
+		return 0;
+
+	/* Grow the table. */
+	if (table->nifs == ctx->maxifs)
+	{
+		size_t maxifs = ctx->maxifs ? ctx->maxifs * 2 : 16;
+		wapi_if_info_t *tmp = realloc(table->ifs, maxifs * sizeof(wapi_if_info_t));
+		if (!tmp)
+		{
+			WAPI_STRERROR("realloc()");
+			return -1;
+		}
+		table->ifs = tmp;
+		ctx->maxifs = maxifs;
 	}
 
-	/* Skip header line. */
-	if (!fgets(buf, bufsiz, fp))
+	info = &table->ifs[table->nifs++];
+	bzero(info, sizeof(wapi_if_info_t));
+	wapi_rtnl_parse(tb, IFLA_MAX, IFLA_RTA(ifi), len);
+
+	info->ifindex = ifi->ifi_index;
+	info->flags = ifi->ifi_flags;
+	info->type = ifi->ifi_type;
+	if (tb[IFLA_IFNAME])
+		snprintf(info->ifname, IFNAMSIZ, "%s", (char *) RTA_DATA(tb[IFLA_IFNAME]));
+	if (tb[IFLA_MTU])
+		info->mtu = *(__u32 *) RTA_DATA(tb[IFLA_MTU]);
+	if (tb[IFLA_OPERSTATE])
+		info->operstate = *(__u8 *) RTA_DATA(tb[IFLA_OPERSTATE]);
+	if (tb[IFLA_ADDRESS] &&
+		RTA_PAYLOAD(tb[IFLA_ADDRESS]) == sizeof(struct ether_addr))
 	{
-		WAPI_ERROR("Invalid \"%s\" content!\n", WAPI_PROC_NET_ROUTE);
+		info->has_mac = 1;
+		memcpy(&info->mac, RTA_DATA(tb[IFLA_ADDRESS]), sizeof(struct ether_addr));
+	}
+
+	return 0;
+}
+
+
+static int
+wapi_if_table_addr_cb(const struct nlmsghdr *nlh, void *arg)
+{
+	wapi_if_table_ctx_t *ctx = arg;
+	wapi_if_table_t *table = ctx->table;
+	struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFA_MAX + 1];
+	struct rtattr *local;
+	wapi_if_addr_t *addr;
+	int len;
+
+	len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	if (nlh->nlmsg_type != RTM_NEWADDR || len < 0 ||
+		(ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6))
+		return 0;
+
+	/* Grow the table. */
+	if (table->naddrs == ctx->maxaddrs)
+	{
+		size_t maxaddrs = ctx->maxaddrs ? ctx->maxaddrs * 2 : 32;
+		wapi_if_addr_t *tmp =
+			realloc(table->addrs, maxaddrs * sizeof(wapi_if_addr_t));
+		if (!tmp)
+		{
+			WAPI_STRERROR("realloc()");
+			return -1;
+		}
+		table->addrs = tmp;
+		ctx->maxaddrs = maxaddrs;
+	}
+
+	wapi_rtnl_parse(tb, IFA_MAX, IFA_RTA(ifa), len);
+
+	/* IFA_LOCAL is the address itself, IFA_ADDRESS might be the peer. */
+	local = tb[IFA_LOCAL] ? tb[IFA_LOCAL] : tb[IFA_ADDRESS];
+	if (!local) return 0;
+
+	addr = &table->addrs[table->naddrs++];
+	bzero(addr, sizeof(wapi_if_addr_t));
+
+	addr->family = ifa->ifa_family;
+	addr->prefixlen = ifa->ifa_prefixlen;
+	addr->scope = ifa->ifa_scope;
+	addr->flags = tb[IFA_FLAGS] ? *(__u32 *) RTA_DATA(tb[IFA_FLAGS]) : ifa->ifa_flags;
+	if (addr->family == AF_INET)
+	{
+		memcpy(&addr->addr, RTA_DATA(local), sizeof(struct in_addr));
+		if (tb[IFA_BROADCAST])
+			memcpy(
+				&addr->broadcast, RTA_DATA(tb[IFA_BROADCAST]),
+				sizeof(struct in_addr));
+	}
+	else memcpy(&addr->addr6, RTA_DATA(local), sizeof(struct in6_addr));
+
+	/* Remember the owner for grouping. */
+	if (table->naddrs > ctx->maxowners)
+	{
+		size_t maxowners = ctx->maxaddrs;
+		int *tmp = realloc(ctx->owners, maxowners * sizeof(int));
+		if (!tmp)
+		{
+			WAPI_STRERROR("realloc()");
+			return -1;
+		}
+		ctx->owners = tmp;
+		ctx->maxowners = maxowners;
+	}
+	ctx->owners[table->naddrs - 1] = ifa->ifa_index;
+
+	return 0;
+}
+
+
+static int
+wapi_if_table_cmp(const void *a, const void *b)
+{
+	return ((const wapi_if_info_t *) a)->ifindex
+		- ((const wapi_if_info_t *) b)->ifindex;
+}
+
+
+static wapi_if_info_t *
+wapi_if_table_find(const wapi_if_table_t *table, int ifindex)
+{
+	wapi_if_info_t key;
+	key.ifindex = ifindex;
+	return bsearch(
+		&key, table->ifs, table->nifs, sizeof(wapi_if_info_t),
+		wapi_if_table_cmp);
+}
+
+
+/**
+ * Groups addresses by their owners (in interface order) with a counting sort,
+ * and points each interface to its own range.
+ */
+static int
+wapi_if_table_group(wapi_if_table_t *table, const int *owners)
+{
+	wapi_if_addr_t *addrs;
+	size_t *pos;
+	size_t k;
+
+	qsort(table->ifs, table->nifs, sizeof(wapi_if_info_t), wapi_if_table_cmp);
+	if (!table->naddrs) return 0;
+
+	addrs = malloc(table->naddrs * sizeof(wapi_if_addr_t));
+	pos = calloc(table->naddrs, sizeof(size_t));
+	if (!addrs || !pos)
+	{
+		WAPI_STRERROR("malloc()");
+		free(addrs);
+		free(pos);
 		return -1;
 	}
 
-	/* Read lines. */
+	/* Count. Addresses of vanished interfaces are dropped. */
+	for (k = 0; k < table->naddrs; k++)
+	{
+		wapi_if_info_t *info = wapi_if_table_find(table, owners[k]);
+		pos[k] = info ? (size_t) (info - table->ifs) : table->nifs;
+		if (info) info->naddrs++;
+	}
+
+	/* Assign ranges. */
+	{
+		wapi_if_addr_t *next = addrs;
+		for (k = 0; k < table->nifs; k++)
+		{
+			table->ifs[k].addrs = next;
+			next += table->ifs[k].naddrs;
+			table->ifs[k].naddrs = 0;
+		}
+	}
+
+	/* Scatter. */
+	for (k = 0; k < table->naddrs; k++)
+		if (pos[k] < table->nifs)
+		{
+			wapi_if_info_t *info = &table->ifs[pos[k]];
+			memcpy(
+				&info->addrs[info->naddrs++], &table->addrs[k],
+				sizeof(wapi_if_addr_t));
+		}
+
+	/* Count what is left. */
+	for (table->naddrs = k = 0; k < table->nifs; k++)
+		table->naddrs += table->ifs[k].naddrs;
+
+	free(table->addrs);
+	free(pos);
+	table->addrs = addrs;
+	return 0;
+}
+
+
+static int
+wapi_get_if_table_once(int fd, wapi_if_table_t *table)
+{
+	struct {
+		struct nlmsghdr nlh;
+		union {
+			struct ifinfomsg ifi;
+			struct ifaddrmsg ifa;
+		} u;
+	} req;
+	wapi_if_table_ctx_t ctx;
+	int ret;
+
+	bzero(&ctx, sizeof(ctx));
+	ctx.table = table;
+
+	/* Dump links. */
+	bzero(&req, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.u.ifi.ifi_family = AF_UNSPEC;
+	ret = wapi_rtnl_dump(fd, &req.nlh, wapi_if_table_link_cb, &ctx);
+
+	/* Dump addresses. */
+	if (ret >= 0)
+	{
+		bzero(&req, sizeof(req));
+		req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+		req.nlh.nlmsg_type = RTM_GETADDR;
+		req.u.ifa.ifa_family = AF_UNSPEC;
+		ret = wapi_rtnl_dump(fd, &req.nlh, wapi_if_table_addr_cb, &ctx);
+	}
+
+	if (ret >= 0)
+		ret = wapi_if_table_group(table, ctx.owners);
+	free(ctx.owners);
+	if (ret < 0)
+		wapi_free_if_table(table);
+
+	return ret;
+}
+
+
+/* Reruns dumps interrupted by concurrent changes, failures empty the table. */
+static int
+wapi_get_if_table_fd(int fd, wapi_if_table_t *table)
+{
+	int tries;
+	int ret;
+
+	for (tries = 1; ; tries++)
+	{
+		ret = wapi_get_if_table_once(fd, table);
+		if (ret != -EAGAIN || tries == WAPI_RTNL_DUMP_TRIES)
+			return ret;
+	}
+}
+
+
+int
+wapi_get_if_table(wapi_if_table_t *table)
+{
+	int fd;
+	int ret;
+
+	WAPI_VALIDATE_PTR(table);
+
+	bzero(table, sizeof(wapi_if_table_t));
+	if ((fd = wapi_rtnl_open(0)) < 0)
+		return fd;
+	ret = wapi_get_if_table_fd(fd, table);
+	close(fd);
+
+	return ret;
+}
+
+
+int
+wapi_ctx_get_if_table(wapi_ctx_t *ctx, wapi_if_table_t *table)
+{
+	int fd;
+
+	WAPI_VALIDATE_PTR(ctx);
+	WAPI_VALIDATE_PTR(table);
+
+	bzero(table, sizeof(wapi_if_table_t));
+	if ((fd = wapi_ctx_rtnl(ctx)) < 0)
+		return fd;
+	return wapi_get_if_table_fd(fd, table);
+}
+
+
+void
+wapi_free_if_table(wapi_if_table_t *table)
+{
+	if (!table) return;
+	free(table->ifs);
+	free(table->addrs);
+	bzero(table, sizeof(wapi_if_table_t));
+}
+
+
+/*-- Routing -----------------------------------------------------------------*/
+
+
+int
+wapi_get_routes_proc(wapi_list_t *list)
+{
+	return wapi_get_routes_file(WAPI_PROC_NET_ROUTE, list);
+}
+
+
+/* Parses a single /proc/net/route row. Returns 0 on success. */
+static int
+wapi_route_proc_line(
+	const char *p,
+	const char *end,
+	wapi_route_info_t *ri,
+	const char **ifname,
+	size_t *ifnamelen)
+{
+	unsigned int dest, gw, flags, netmask;
+	int refcnt, use, metric, mtu, window, irtt;
+
+	/* Interface name runs up to the first blank. */
+	for (*ifname = p; p < end && *p != '\t' && *p != ' '; p++);
+	if (p == *ifname) return -1;
+	*ifnamelen = p - *ifname;
+
+	if (!(p = wapi_scan_hex(p, end, &dest)) ||
+		!(p = wapi_scan_hex(p, end, &gw)) ||
+		!(p = wapi_scan_hex(p, end, &flags)) ||
+		!(p = wapi_scan_dec(p, end, &refcnt)) ||
+		!(p = wapi_scan_dec(p, end, &use)) ||
+		!(p = wapi_scan_dec(p, end, &metric)) ||
+		!(p = wapi_scan_hex(p, end, &netmask)) ||
+		!(p = wapi_scan_dec(p, end, &mtu)) ||
+		!(p = wapi_scan_dec(p, end, &window)) ||
+		!(p = wapi_scan_dec(p, end, &irtt)))
+		return -1;
+
+	bzero(ri, sizeof(wapi_route_info_t));
+	ri->dest.s_addr = dest;
+	ri->gw.s_addr = gw;
+	ri->flags = flags;
+	ri->refcnt = refcnt;
+	ri->use = use;
+	ri->metric = metric;
+	ri->netmask.s_addr = netmask;
+	ri->mtu = mtu;
+	ri->window = window;
+	ri->irtt = irtt;
+	ri->family = AF_INET;
+	ri->table = RT_TABLE_MAIN;
+	ri->prefixlen = __builtin_popcount(netmask);
+	ri->type = (flags & RTF_REJECT) ? RTN_UNREACHABLE : RTN_UNICAST;
+
+	return 0;
+}
+
+
+int
+wapi_get_routes_file(const char *path, wapi_list_t *list)
+{
+	const char *data;
+	const char *end;
+	const char *line;
+	size_t len;
+	int nlines;
+	int ret;
+
+	WAPI_VALIDATE_PTR(path);
+	WAPI_VALIDATE_PTR(list);
+
+	if (wapi_proc_read(path, &data, &len) < 0)
+		return -1;
+
+	list->type = WAPI_LIST_ROUTE;
+
+	/* Iterate over lines, skipping the header. */
 	ret = 0;
-	while (fgets(buf, bufsiz, fp))
+	end = data + len;
+	for (nlines = 0, line = data; line < end; nlines++)
 	{
+		wapi_route_info_t route;
 		wapi_route_info_t *ri;
-		char ifname[WAPI_PROC_LINE_SIZE];
-		int refcnt, use, metric, mtu, window, irtt;
-		unsigned int dest, gw, flags, netmask;
+		const char *eol;
+		const char *ifname;
+		size_t ifnamelen;
 
-		/* Allocate route row buffer. */
-		ri = malloc(sizeof(wapi_route_info_t));
-		if (!ri)
+		if (!(eol = memchr(line, '\n', end - line)))
+			eol = end;
+		if (!nlines)
 		{
-			WAPI_STRERROR("malloc()");
+			line = eol + 1;
+			continue;
+		}
+
+		if (wapi_route_proc_line(line, eol, &route, &ifname, &ifnamelen) < 0)
+		{
+			WAPI_ERROR("Invalid \"%s\" content at line %d!\n", path, nlines + 1);
 			ret = -1;
 			break;
 		}
 
-		/* Read and tokenize fields. */
-		sscanf(
-			buf,
-			"%s\t"	/* ifname */
-			"%x\t"	/* dest */
-			"%x\t"	/* gw */
-			"%x\t"	/* flags */
-			"%d\t"	/* refcnt */
-			"%d\t"	/* use */
-			"%d\t"	/* metric */
-			"%x\t"	/* mask */
-			"%d\t"	/* mtu */
-			"%d\t"	/* window */
-			"%d\t",	/* irtt */
-			ifname, &dest, &gw, &flags, &refcnt, &use, &metric, &netmask, &mtu,
-			&window, &irtt);
-
-		/* Allocate "ifname". */
-		ri->ifname = malloc((strlen(ifname) + 1) * sizeof(char));
-		if (!ri->ifname)
+		/* Allocate route row buffer and "ifname". */
+		ri = wapi_list_alloc(list, sizeof(wapi_route_info_t));
+		if (ri) *ri = route;
+		if (ri && !(ri->ifname = wapi_list_strndup(list, ifname, ifnamelen)))
+		{
+			wapi_list_release(list, ri);
+			ri = NULL;
+		}
+		if (!ri)
 		{
 			WAPI_STRERROR("malloc()");
-			free(ri);
 			ret = -1;
 			break;
 		}
 
-		/* Copy fields. */
-		sprintf(ri->ifname, "%s", ifname);
-		ri->dest.s_addr = dest;
-		ri->gw.s_addr = gw;
-		ri->flags = flags;
-		ri->refcnt = refcnt;
-		ri->use = use;
-		ri->metric = metric;
-		ri->netmask.s_addr = netmask;
-		ri->mtu = mtu;
-		ri->window = window;
-		ri->irtt = irtt;
-
 		/* Push parsed node to the list. */
 		ri->next = list->head.route;
 		list->head.route = ri;
+
+		line = eol + 1;
+	}
+
+	if (!nlines)
+	{
+		WAPI_ERROR("Invalid \"%s\" content!\n", path);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+
+typedef struct wapi_route_dump_ctx_t {
+	wapi_list_t *list;
+	const wapi_route_filter_t *filter;
+	wapi_route_info_t *head;
+	wapi_route_info_t *tail;
+	wapi_ifname_cache_t ifnames;
+} wapi_route_dump_ctx_t;
+
+
+static int
+wapi_route_dump_cb(const struct nlmsghdr *nlh, void *arg)
+{
+	wapi_route_dump_ctx_t *ctx = arg;
+	const wapi_route_filter_t *filter = ctx->filter;
+	wapi_route_info_t route;
+	wapi_route_info_t *ri;
+	const char *ifname;
+
+	if (nlh->nlmsg_type != RTM_NEWROUTE)
+		return 0;
+
+	/* Decode and filter. (Kernel might not support strict checking.) */
+	bzero(&route, sizeof(wapi_route_info_t));
+	if (wapi_rtnl_route_parse(nlh, &route) ||
+		!wapi_rtnl_route_match(filter, &route))
+		return 0;
+
+	/* Allocate route row buffer. */
+	ri = wapi_list_alloc(ctx->list, sizeof(wapi_route_info_t));
+	if (!ri)
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
+	}
+	*ri = route;
+
+	/* Allocate "ifname". */
+	ifname = wapi_ifname_cache_get(&ctx->ifnames, ri->ifindex);
+	ri->ifname = wapi_list_strndup(ctx->list, ifname, strlen(ifname));
+	if (!ri->ifname)
+	{
+		WAPI_STRERROR("malloc()");
+		wapi_list_release(ctx->list, ri);
+		return -1;
 	}
 
-	/* Close file. */
-	fclose(fp);
+	/* Push parsed node to the list. */
+	ri->next = ctx->head;
+	ctx->head = ri;
+	if (!ctx->tail) ctx->tail = ri;
 
 	return 0;
 }
 
 
+int
+wapi_rtnl_get_routes(
+	int fd,
+	wapi_list_t *list,
+	const wapi_route_filter_t *filter)
+{
+	wapi_route_dump_ctx_t ctx;
+	int tries;
+	int ret;
+
+	/* Partial results are dropped, so interrupted dumps can be rerun. */
+	for (tries = 1; ; tries++)
+	{
+		bzero(&ctx, sizeof(ctx));
+		ctx.list = list;
+		ctx.filter = filter;
+		ret = wapi_rtnl_route_dump(fd, filter, wapi_route_dump_cb, &ctx);
+		if (ret >= 0)
+			break;
+
+		while (ctx.head)
+		{
+			wapi_route_info_t *ri = ctx.head->next;
+			wapi_list_release(list, ctx.head->ifname);
+			wapi_list_release(list, ctx.head);
+			ctx.head = ri;
+		}
+		if (ret != -EAGAIN || tries == WAPI_RTNL_DUMP_TRIES)
+			return ret;
+	}
+
+	list->type = WAPI_LIST_ROUTE;
+
+	/* Splice collected rows in front of the list. */
+	if (ctx.head)
+	{
+		ctx.tail->next = list->head.route;
+		list->head.route = ctx.head;
+	}
+
+	return ret;
+}
+
+
+int
+wapi_get_routes_nl(wapi_list_t *list, const wapi_route_filter_t *filter)
+{
+	int fd;
+	int ret;
+
+	WAPI_VALIDATE_PTR(list);
+
+	if ((fd = wapi_rtnl_open(0)) < 0)
+		return fd;
+	ret = wapi_rtnl_get_routes(fd, list, filter);
+	close(fd);
+
+	return ret;
+}
+
+
+int
+wapi_ctx_get_routes_nl(
+	wapi_ctx_t *ctx,
+	wapi_list_t *list,
+	const wapi_route_filter_t *filter)
+{
+	int fd;
+
+	WAPI_VALIDATE_PTR(ctx);
+	WAPI_VALIDATE_PTR(list);
+
+	if ((fd = wapi_ctx_rtnl(ctx)) < 0)
+		return fd;
+	return wapi_rtnl_get_routes(fd, list, filter);
+}
+
+
+int
+wapi_get_routes(wapi_list_t *list)
+{
+	wapi_route_filter_t filter;
+
+	WAPI_VALIDATE_PTR(list);
+
+	filter.family = AF_INET;
+	filter.table = RT_TABLE_MAIN;
+	filter.ifindex = 0;
+	filter.protocol = 0;
+	if (wapi_get_routes_nl(list, &filter) >= 0)
+		return 0;
+
+	/* Fall back to procfs. */
+	return wapi_get_routes_proc(list);
+}
+
+
 static int
 wapi_act_route_gw(
 	int sock,
@@ -305,3 +1184,185 @@ wapi_del_route_gw(
 {
 	return wapi_act_route_gw(sock, SIOCDELRT, targettype, target, netmask, gw);
 }
+
+
+/*-- Route Batches -----------------------------------------------------------*/
+
+
+const char *wapi_route_acts[] = {
+	"WAPI_ROUTE_ACT_ADD",
+	"WAPI_ROUTE_ACT_REPLACE",
+	"WAPI_ROUTE_ACT_DEL"
+};
+
+
+/* Route batch in progress. */
+typedef struct wapi_route_batch_t {
+	wapi_route_op_t *ops;
+	unsigned char protocol;		/* For added routes without one, 0 for boot. */
+} wapi_route_batch_t;
+
+
+/**
+ * Builds an RTM_NEWROUTE/RTM_DELROUTE request for the @a k-th operation.
+ */
+static int
+wapi_route_batch_msg(struct nlmsghdr *nlh, size_t maxlen, size_t k, void *arg)
+{
+	const wapi_route_batch_t *batch = arg;
+	const wapi_route_op_t *op = &batch->ops[k];
+	const wapi_route_info_t *ri = op->route;
+	struct rtmsg *rtm;
+	int family = ri->family ? ri->family : AF_INET;
+	int has_gw = (ri->flags & RTF_GATEWAY) == RTF_GATEWAY;
+	int ifindex = ri->ifindex;
+	unsigned int prefixlen = ri->prefixlen;
+	__u32 table = ri->table ? ri->table : RT_TABLE_MAIN;
+	size_t addrlen;
+
+	if (family != AF_INET && family != AF_INET6)
+	{
+		WAPI_ERROR("Unsupported address family: %d.\n", family);
+		return -EAFNOSUPPORT;
+	}
+
+	/* Resolve missing fields. */
+	if (family == AF_INET)
+	{
+		addrlen = sizeof(struct in_addr);
+		if (!prefixlen)
+			prefixlen = (ri->flags & RTF_HOST)
+				? 32 : __builtin_popcount(ri->netmask.s_addr);
+	}
+	else addrlen = sizeof(struct in6_addr);
+	if (!ifindex && ri->ifname && strcmp(ri->ifname, "*") &&
+		!(ifindex = if_nametoindex(ri->ifname)))
+	{
+		WAPI_ERROR("Unknown interface: %s.\n", ri->ifname);
+		return -ENODEV;
+	}
+
+	/* Header. */
+	bzero(nlh, NLMSG_LENGTH(sizeof(struct rtmsg)));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	rtm = NLMSG_DATA(nlh);
+	rtm->rtm_family = family;
+	rtm->rtm_dst_len = prefixlen;
+	rtm->rtm_table = table < 256 ? table : RT_TABLE_UNSPEC;
+
+	switch (op->act)
+	{
+	case WAPI_ROUTE_ACT_ADD:
+	case WAPI_ROUTE_ACT_REPLACE:
+		nlh->nlmsg_type = RTM_NEWROUTE;
+		nlh->nlmsg_flags = NLM_F_CREATE |
+			(op->act == WAPI_ROUTE_ACT_ADD ? NLM_F_EXCL : NLM_F_REPLACE);
+		rtm->rtm_protocol = ri->protocol ? ri->protocol
+			: batch->protocol ? batch->protocol : RTPROT_BOOT;
+		rtm->rtm_type = ri->type ? ri->type : RTN_UNICAST;
+		rtm->rtm_scope = ri->scope ? ri->scope
+			: (has_gw || rtm->rtm_type != RTN_UNICAST)
+			? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+		break;
+
+	case WAPI_ROUTE_ACT_DEL:
+		/* Unset fields match any route. */
+		nlh->nlmsg_type = RTM_DELROUTE;
+		rtm->rtm_protocol = ri->protocol;
+		rtm->rtm_type = ri->type;
+		rtm->rtm_scope = ri->scope ? ri->scope : RT_SCOPE_NOWHERE;
+		break;
+
+	default:
+		WAPI_ERROR("Unknown route action: %d.\n", op->act);
+		return -1;
+	}
+
+	/* Attributes. */
+	if (wapi_rtnl_addattr(
+			nlh, maxlen, RTA_TABLE, &table, sizeof(table)) < 0 ||
+		(prefixlen && wapi_rtnl_addattr(
+			nlh, maxlen, RTA_DST,
+			family == AF_INET ? (void *) &ri->dest : (void *) &ri->dest6,
+			addrlen) < 0) ||
+		(has_gw && wapi_rtnl_addattr(
+			nlh, maxlen, RTA_GATEWAY,
+			family == AF_INET ? (void *) &ri->gw : (void *) &ri->gw6,
+			addrlen) < 0) ||
+		(ifindex && wapi_rtnl_addattr(
+			nlh, maxlen, RTA_OIF, &ifindex, sizeof(ifindex)) < 0) ||
+		(ri->metric && wapi_rtnl_addattr(
+			nlh, maxlen, RTA_PRIORITY, &ri->metric, sizeof(ri->metric)) < 0))
+		return -1;
+
+	/* Metrics are only meaningful while adding. */
+	if (op->act != WAPI_ROUTE_ACT_DEL && (ri->mtu || ri->window))
+	{
+		struct rtattr *nest;
+
+		if (!(nest = wapi_rtnl_nest(nlh, maxlen, RTA_METRICS)) ||
+			(ri->mtu && wapi_rtnl_addattr(
+				nlh, maxlen, RTAX_MTU, &ri->mtu, sizeof(ri->mtu)) < 0) ||
+			(ri->window && wapi_rtnl_addattr(
+				nlh, maxlen, RTAX_WINDOW, &ri->window, sizeof(ri->window)) < 0))
+			return -1;
+		wapi_rtnl_nest_end(nlh, nest);
+	}
+
+	return 0;
+}
+
+
+static void
+wapi_route_batch_done(size_t k, int error, void *arg)
+{
+	((wapi_route_batch_t *) arg)->ops[k].error = error;
+}
+
+
+int
+wapi_rtnl_route_batch(
+	int fd,
+	wapi_route_op_t *ops,
+	size_t n,
+	unsigned char protocol)
+{
+	wapi_route_batch_t batch;
+
+	batch.ops = ops;
+	batch.protocol = protocol;
+	return wapi_rtnl_transact(
+		fd, n, wapi_route_batch_msg, wapi_route_batch_done, &batch);
+}
+
+
+int
+wapi_route_batch(wapi_route_op_t *ops, size_t n)
+{
+	int fd;
+	int ret;
+
+	WAPI_VALIDATE_PTR(ops);
+
+	if ((fd = wapi_rtnl_open(0)) < 0)
+		return fd;
+
+	ret = wapi_rtnl_route_batch(fd, ops, n, 0);
+	close(fd);
+
+	return ret;
+}
+
+
+int
+wapi_ctx_route_batch(wapi_ctx_t *ctx, wapi_route_op_t *ops, size_t n)
+{
+	int fd;
+
+	WAPI_VALIDATE_PTR(ctx);
+	WAPI_VALIDATE_PTR(ops);
+
+	if ((fd = wapi_ctx_rtnl(ctx)) < 0)
+		return fd;
+	return wapi_rtnl_route_batch(fd, ops, n, 0);
+}
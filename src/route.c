@@ -0,0 +1,1111 @@
+/**
+ * @file
+ * Routing table indexing and caching.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <net/route.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "wapi.h"
+#include "netlink.h"
+#include "context.h"
+
+
+/*-- Lookup Index ------------------------------------------------------------*/
+
+
+/* Entry encoding: 0 for no route, route position + 1 for a leaf, or chunk
+ * number with the high bit set for a pointer to the next level. */
+#define WAPI_ROUTE_INDEX_CHUNK		0x80000000u
+#define WAPI_ROUTE_INDEX_CHUNK_SIZE	256
+
+
+struct wapi_route_index_t {
+	const wapi_route_info_t **routes;
+	uint32_t *tbl16;
+	uint32_t *chunks;
+	unsigned int nchunks;
+	unsigned int maxchunks;
+};
+
+
+/**
+ * Orders routes by ascending prefix length, and for equal lengths, by
+ * descending metric. Inserting in this order lets longer prefixes (and lower
+ * metrics) overwrite what has been written before.
+ */
+static int
+wapi_route_index_cmp(const void *a, const void *b)
+{
+	const wapi_route_info_t *ra = *(const wapi_route_info_t **) a;
+	const wapi_route_info_t *rb = *(const wapi_route_info_t **) b;
+
+	if (ra->prefixlen != rb->prefixlen)
+		return ra->prefixlen < rb->prefixlen ? -1 : 1;
+	if (ra->metric != rb->metric)
+		return ra->metric > rb->metric ? -1 : 1;
+	return 0;
+}
+
+
+/**
+ * Makes room for at least two more chunks, which is the most an insertion can
+ * allocate. Growing the chunks up front keeps entry pointers valid while
+ * descending.
+ */
+static int
+wapi_route_index_reserve(wapi_route_index_t *index)
+{
+	unsigned int maxchunks;
+	uint32_t *tmp;
+
+	if (index->nchunks + 2 <= index->maxchunks)
+		return 0;
+
+	maxchunks = index->maxchunks ? index->maxchunks * 2 : 64;
+	tmp = realloc(
+		index->chunks,
+		maxchunks * WAPI_ROUTE_INDEX_CHUNK_SIZE * sizeof(uint32_t));
+	if (!tmp)
+	{
+		WAPI_STRERROR("realloc()");
+		return -1;
+	}
+
+	index->chunks = tmp;
+	index->maxchunks = maxchunks;
+	return 0;
+}
+
+
+/**
+ * Makes sure that @a *entry points to a chunk, and returns that chunk. A leaf
+ * is expanded into a new chunk inheriting the leaf.
+ */
+static uint32_t *
+wapi_route_index_descend(wapi_route_index_t *index, uint32_t *entry)
+{
+	uint32_t leaf = *entry;
+	uint32_t *chunk;
+	int k;
+
+	if (leaf & WAPI_ROUTE_INDEX_CHUNK)
+		return &index->chunks[
+			(leaf & ~WAPI_ROUTE_INDEX_CHUNK) * WAPI_ROUTE_INDEX_CHUNK_SIZE];
+
+	chunk = &index->chunks[index->nchunks * WAPI_ROUTE_INDEX_CHUNK_SIZE];
+	for (k = 0; k < WAPI_ROUTE_INDEX_CHUNK_SIZE; k++)
+		chunk[k] = leaf;
+
+	*entry = WAPI_ROUTE_INDEX_CHUNK | index->nchunks++;
+	return chunk;
+}
+
+
+static int
+wapi_route_index_insert(
+	wapi_route_index_t *index,
+	uint32_t prefix,
+	unsigned int len,
+	uint32_t leaf)
+{
+	uint32_t *tbl;
+	unsigned int start;
+	unsigned int count;
+	unsigned int k;
+
+	if (len <= 16)
+	{
+		tbl = index->tbl16;
+		start = prefix >> 16;
+		count = 1u << (16 - len);
+	}
+	else
+	{
+		if (wapi_route_index_reserve(index) < 0)
+			return -1;
+
+		/* Entries are inserted in ascending prefix length order, hence there
+		 * are no third level chunks while filling in the second level. */
+		tbl = wapi_route_index_descend(index, &index->tbl16[prefix >> 16]);
+		if (len <= 24)
+		{
+			start = (prefix >> 8) & 0xFF;
+			count = 1u << (24 - len);
+		}
+		else
+		{
+			tbl = wapi_route_index_descend(index, &tbl[(prefix >> 8) & 0xFF]);
+			start = prefix & 0xFF;
+			count = 1u << (32 - len);
+		}
+	}
+
+	for (k = 0; k < count; k++)
+		tbl[start + k] = leaf;
+
+	return 0;
+}
+
+
+int
+wapi_route_index_build(const wapi_list_t *list, wapi_route_index_t **index)
+{
+	wapi_route_index_t *idx;
+	wapi_route_info_t *ri;
+	unsigned int nroutes;
+	unsigned int k;
+
+	WAPI_VALIDATE_PTR(list);
+	WAPI_VALIDATE_PTR(index);
+
+	idx = calloc(1, sizeof(wapi_route_index_t));
+	if (!idx)
+	{
+		WAPI_STRERROR("calloc()");
+		return -1;
+	}
+
+	/* Collect indexable routes. */
+	for (nroutes = 0, ri = list->head.route; ri; ri = ri->next)
+		if (ri->family == AF_INET && (ri->flags & RTF_UP) && ri->prefixlen <= 32)
+			nroutes++;
+	idx->routes = malloc((nroutes ? nroutes : 1) * sizeof(wapi_route_info_t *));
+	idx->tbl16 = calloc(1 << 16, sizeof(uint32_t));
+	if (!idx->routes || !idx->tbl16)
+	{
+		WAPI_STRERROR("malloc()");
+		goto fail;
+	}
+	for (nroutes = 0, ri = list->head.route; ri; ri = ri->next)
+		if (ri->family == AF_INET && (ri->flags & RTF_UP) && ri->prefixlen <= 32)
+			idx->routes[nroutes++] = ri;
+	qsort(idx->routes, nroutes, sizeof(wapi_route_info_t *), wapi_route_index_cmp);
+
+	/* Fill in the tables. */
+	for (k = 0; k < nroutes; k++)
+	{
+		unsigned int len = idx->routes[k]->prefixlen;
+		uint32_t prefix = ntohl(idx->routes[k]->dest.s_addr);
+		if (len < 32) prefix &= len ? ~(0xFFFFFFFFu >> len) : 0;
+		if (wapi_route_index_insert(idx, prefix, len, k + 1) < 0)
+			goto fail;
+	}
+
+	*index = idx;
+	return 0;
+
+fail:
+	wapi_route_index_free(idx);
+	return -1;
+}
+
+
+static inline uint32_t
+wapi_route_index_find(const wapi_route_index_t *index, uint32_t addr)
+{
+	uint32_t entry = index->tbl16[addr >> 16];
+
+	if (entry & WAPI_ROUTE_INDEX_CHUNK)
+	{
+		entry = index->chunks[
+			((entry & ~WAPI_ROUTE_INDEX_CHUNK) << 8) | ((addr >> 8) & 0xFF)];
+		if (entry & WAPI_ROUTE_INDEX_CHUNK)
+			entry = index->chunks[
+				((entry & ~WAPI_ROUTE_INDEX_CHUNK) << 8) | (addr & 0xFF)];
+	}
+
+	return entry;
+}
+
+
+const wapi_route_info_t *
+wapi_route_index_lookup(
+	const wapi_route_index_t *index,
+	const struct in_addr *addr)
+{
+	uint32_t entry;
+
+	if (!index || !addr) return NULL;
+
+	entry = wapi_route_index_find(index, ntohl(addr->s_addr));
+	return entry ? index->routes[entry - 1] : NULL;
+}
+
+
+size_t
+wapi_route_index_lookup_batch(
+	const wapi_route_index_t *index,
+	const struct in_addr *addrs,
+	size_t n,
+	const wapi_route_info_t **routes)
+{
+	size_t found = 0;
+	size_t k;
+
+	if (!index || !addrs || !routes) return 0;
+
+	for (k = 0; k < n; k++)
+	{
+		uint32_t entry;
+
+		/* Issue the first level read of a later address ahead of time, so that
+		 * cache misses of consecutive lookups overlap. */
+		if (k + 8 < n)
+			__builtin_prefetch(&index->tbl16[ntohl(addrs[k + 8].s_addr) >> 16]);
+
+		entry = wapi_route_index_find(index, ntohl(addrs[k].s_addr));
+		routes[k] = entry ? index->routes[entry - 1] : NULL;
+		found += entry != 0;
+	}
+
+	return found;
+}
+
+
+void
+wapi_route_index_free(wapi_route_index_t *index)
+{
+	if (!index) return;
+	free(index->routes);
+	free(index->tbl16);
+	free(index->chunks);
+	free(index);
+}
+
+
+/*-- Cache -------------------------------------------------------------------*/
+
+
+const char *wapi_route_events[] = {
+	"WAPI_ROUTE_EVENT_ADD",
+	"WAPI_ROUTE_EVENT_CHANGE",
+	"WAPI_ROUTE_EVENT_DEL"
+};
+
+
+typedef struct wapi_route_cache_node_t {
+	wapi_route_info_t ri;	/* Must be the first member, see the casts. */
+	struct wapi_route_cache_node_t *hnext;
+	wapi_route_info_t **pprev;
+	unsigned int hash;
+	int stale;
+	char ifname[IFNAMSIZ];
+} wapi_route_cache_node_t;
+
+
+struct wapi_route_cache_t {
+	int fd;
+	int has_filter;
+	wapi_route_filter_t filter;
+	wapi_route_cache_cb_t cb;
+	void *arg;
+	wapi_list_t list;
+	wapi_route_cache_node_t **buckets;
+	unsigned int nbuckets;
+	unsigned int nnodes;
+	unsigned long generation;
+	int nchanges;
+	int resync;
+	wapi_ctx_t *ctx;	/* Dumps go over its rtnetlink socket, if given. */
+	wapi_ifname_cache_t ifnames;
+};
+
+
+static inline unsigned int
+wapi_route_cache_fnv(unsigned int hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	while (len--) hash = (hash ^ *p++) * 16777619u;
+	return hash;
+}
+
+
+/**
+ * Hashes the kernel identity of the route.
+ */
+static unsigned int
+wapi_route_cache_hash(const wapi_route_info_t *ri)
+{
+	unsigned int hash = 2166136261u;
+
+	hash = wapi_route_cache_fnv(hash, &ri->family, sizeof(ri->family));
+	hash = wapi_route_cache_fnv(hash, &ri->table, sizeof(ri->table));
+	hash = wapi_route_cache_fnv(hash, &ri->prefixlen, sizeof(ri->prefixlen));
+	hash = wapi_route_cache_fnv(hash, &ri->metric, sizeof(ri->metric));
+	return ri->family == AF_INET
+		? wapi_route_cache_fnv(hash, &ri->dest, sizeof(struct in_addr))
+		: wapi_route_cache_fnv(hash, &ri->dest6, sizeof(struct in6_addr));
+}
+
+
+static int
+wapi_route_cache_same_key(const wapi_route_info_t *a, const wapi_route_info_t *b)
+{
+	return a->family == b->family &&
+		a->table == b->table &&
+		a->prefixlen == b->prefixlen &&
+		a->metric == b->metric &&
+		(a->family == AF_INET
+		 ? a->dest.s_addr == b->dest.s_addr
+		 : !memcmp(&a->dest6, &b->dest6, sizeof(struct in6_addr)));
+}
+
+
+static wapi_route_cache_node_t *
+wapi_route_cache_find(
+	const wapi_route_cache_t *cache,
+	const wapi_route_info_t *ri,
+	unsigned int hash)
+{
+	wapi_route_cache_node_t *node;
+
+	for (node = cache->buckets[hash & (cache->nbuckets - 1)];
+		 node;
+		 node = node->hnext)
+		if (node->hash == hash && wapi_route_cache_same_key(&node->ri, ri))
+			return node;
+
+	return NULL;
+}
+
+
+static int
+wapi_route_cache_grow(wapi_route_cache_t *cache)
+{
+	wapi_route_cache_node_t **buckets;
+	unsigned int nbuckets = cache->nbuckets * 2;
+	unsigned int k;
+
+	buckets = calloc(nbuckets, sizeof(wapi_route_cache_node_t *));
+	if (!buckets)
+	{
+		WAPI_STRERROR("calloc()");
+		return -1;
+	}
+
+	for (k = 0; k < cache->nbuckets; k++)
+		while (cache->buckets[k])
+		{
+			wapi_route_cache_node_t *node = cache->buckets[k];
+			cache->buckets[k] = node->hnext;
+			node->hnext = buckets[node->hash & (nbuckets - 1)];
+			buckets[node->hash & (nbuckets - 1)] = node;
+		}
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->nbuckets = nbuckets;
+	return 0;
+}
+
+
+static void
+wapi_route_cache_remove(wapi_route_cache_t *cache, wapi_route_cache_node_t *node)
+{
+	wapi_route_cache_node_t **pnode;
+
+	/* Unlink from the bucket. */
+	for (pnode = &cache->buckets[node->hash & (cache->nbuckets - 1)];
+		 *pnode != node;
+		 pnode = &(*pnode)->hnext);
+	*pnode = node->hnext;
+
+	/* Unlink from the list. */
+	*node->pprev = node->ri.next;
+	if (node->ri.next)
+		((wapi_route_cache_node_t *) node->ri.next)->pprev = node->pprev;
+
+	cache->nnodes--;
+	cache->generation++;
+	if (cache->cb) cache->cb(WAPI_ROUTE_EVENT_DEL, &node->ri, cache->arg);
+	free(node);
+}
+
+
+/**
+ * Applies an RTM_NEWROUTE/RTM_DELROUTE message.
+ *
+ * @return 1, if the cache changed; 0, if not; negative on failure.
+ */
+static int
+wapi_route_cache_apply(wapi_route_cache_t *cache, const struct nlmsghdr *nlh)
+{
+	wapi_route_cache_node_t *node;
+	wapi_route_info_t ri;
+	unsigned int hash;
+
+	if (nlh->nlmsg_type != RTM_NEWROUTE && nlh->nlmsg_type != RTM_DELROUTE)
+		return 0;
+
+	bzero(&ri, sizeof(wapi_route_info_t));
+	if (wapi_rtnl_route_parse(nlh, &ri) ||
+		!wapi_rtnl_route_match(cache->has_filter ? &cache->filter : NULL, &ri))
+		return 0;
+
+	hash = wapi_route_cache_hash(&ri);
+	node = wapi_route_cache_find(cache, &ri, hash);
+
+	if (nlh->nlmsg_type == RTM_DELROUTE)
+	{
+		if (!node) return 0;
+		wapi_route_cache_remove(cache, node);
+		return 1;
+	}
+
+	/* Update an existing route in place. */
+	if (node)
+	{
+		node->stale = 0;
+		ri.next = node->ri.next;
+		if (ri.ifindex == node->ri.ifindex)
+			ri.ifname = node->ri.ifname;
+		if (!memcmp(&ri, &node->ri, sizeof(wapi_route_info_t)))
+			return 0;
+
+		memcpy(&node->ri, &ri, sizeof(wapi_route_info_t));
+		if (node->ri.ifname != node->ifname)
+		{
+			snprintf(
+				node->ifname, IFNAMSIZ, "%s",
+				wapi_ifname_cache_get(&cache->ifnames, ri.ifindex));
+			node->ri.ifname = node->ifname;
+		}
+
+		cache->generation++;
+		if (cache->cb) cache->cb(WAPI_ROUTE_EVENT_CHANGE, &node->ri, cache->arg);
+		return 1;
+	}
+
+	/* Insert a new one. */
+	if (cache->nnodes >= cache->nbuckets && wapi_route_cache_grow(cache) < 0)
+		return -1;
+	node = malloc(sizeof(wapi_route_cache_node_t));
+	if (!node)
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
+	}
+	memcpy(&node->ri, &ri, sizeof(wapi_route_info_t));
+	snprintf(
+		node->ifname, IFNAMSIZ, "%s",
+		wapi_ifname_cache_get(&cache->ifnames, ri.ifindex));
+	node->ri.ifname = node->ifname;
+	node->hash = hash;
+	node->stale = 0;
+
+	node->hnext = cache->buckets[hash & (cache->nbuckets - 1)];
+	cache->buckets[hash & (cache->nbuckets - 1)] = node;
+
+	node->ri.next = cache->list.head.route;
+	if (node->ri.next)
+		((wapi_route_cache_node_t *) node->ri.next)->pprev = &node->ri.next;
+	node->pprev = &cache->list.head.route;
+	cache->list.head.route = &node->ri;
+
+	cache->nnodes++;
+	cache->generation++;
+	if (cache->cb) cache->cb(WAPI_ROUTE_EVENT_ADD, &node->ri, cache->arg);
+	return 1;
+}
+
+
+/**
+ * Applies an RTM_NEWLINK/RTM_DELLINK/RTM_DELADDR message. The kernel flushes
+ * IPv4 routes of interfaces going down, and routes through gateways of removed
+ * addresses, without sending any RTM_DELROUTE for them.
+ *
+ * @return number of changes.
+ */
+static int
+wapi_route_cache_link(wapi_route_cache_t *cache, const struct nlmsghdr *nlh)
+{
+	const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	wapi_route_info_t *ri;
+	int nchanges = 0;
+
+	if (nlh->nlmsg_type == RTM_DELADDR)
+	{
+		/* Which routes went with the address is not told, take a new dump. */
+		cache->resync = 1;
+		return 0;
+	}
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+		return 0;
+
+	/* Interfaces might get renamed, or their indices reused. */
+	cache->ifnames.len = 0;
+	if (nlh->nlmsg_type == RTM_NEWLINK && (ifi->ifi_flags & IFF_UP))
+		return 0;
+
+	for (ri = cache->list.head.route; ri; )
+	{
+		wapi_route_cache_node_t *node = (wapi_route_cache_node_t *) ri;
+		ri = ri->next;
+		if (node->ri.family == AF_INET && node->ri.ifindex == ifi->ifi_index)
+		{
+			wapi_route_cache_remove(cache, node);
+			nchanges++;
+		}
+	}
+
+	return nchanges;
+}
+
+
+static int
+wapi_route_cache_dump_cb(const struct nlmsghdr *nlh, void *arg)
+{
+	wapi_route_cache_t *cache = arg;
+	int ret = wapi_route_cache_apply(cache, nlh);
+	if (ret > 0) cache->nchanges++;
+	return ret;
+}
+
+
+/**
+ * Reloads the cache from a fresh dump, and drops routes missing in the dump.
+ *
+ * @return number of changes, or negative on failure.
+ */
+static int
+wapi_route_cache_resync(wapi_route_cache_t *cache)
+{
+	wapi_route_info_t *ri;
+	int tries;
+	int fd;
+	int ret;
+
+	/* Until it succeeds, wapi_route_cache_process() tries again. */
+	cache->resync = 1;
+	if ((fd = cache->ctx ? wapi_ctx_rtnl(cache->ctx) : wapi_rtnl_open(0)) < 0)
+		return fd;
+
+	/* Rows of an interrupted dump are refreshed by the next one. */
+	cache->nchanges = 0;
+	for (tries = 1; ; tries++)
+	{
+		for (ri = cache->list.head.route; ri; ri = ri->next)
+			((wapi_route_cache_node_t *) ri)->stale = 1;
+
+		ret = wapi_rtnl_route_dump(
+			fd, cache->has_filter ? &cache->filter : NULL,
+			wapi_route_cache_dump_cb, cache);
+		if (ret != -EAGAIN || tries == WAPI_RTNL_DUMP_TRIES)
+			break;
+	}
+	if (!cache->ctx) close(fd);
+	if (ret < 0) return ret;
+	cache->resync = 0;
+
+	for (ri = cache->list.head.route; ri; )
+	{
+		wapi_route_cache_node_t *node = (wapi_route_cache_node_t *) ri;
+		ri = ri->next;
+		if (node->stale)
+		{
+			wapi_route_cache_remove(cache, node);
+			cache->nchanges++;
+		}
+	}
+
+	return cache->nchanges;
+}
+
+
+static int
+wapi_route_cache_open_with(
+	wapi_ctx_t *ctx,
+	const wapi_route_filter_t *filter,
+	wapi_route_cache_cb_t cb,
+	void *arg,
+	wapi_route_cache_t **cache)
+{
+	wapi_route_cache_t *c;
+	unsigned int groups;
+	int rcvbuf = 1 << 20;
+
+	WAPI_VALIDATE_PTR(cache);
+
+	c = calloc(1, sizeof(wapi_route_cache_t));
+	if (c) c->buckets = calloc(64, sizeof(wapi_route_cache_node_t *));
+	if (!c || !c->buckets)
+	{
+		WAPI_STRERROR("calloc()");
+		free(c);
+		return -1;
+	}
+	c->nbuckets = 64;
+	c->cb = cb;
+	c->arg = arg;
+	c->ctx = ctx;
+	if (filter)
+	{
+		c->has_filter = 1;
+		memcpy(&c->filter, filter, sizeof(wapi_route_filter_t));
+	}
+
+	/* Subscribe before the dump, so that no change goes unnoticed. Link and
+	 * address events stand for IPv4 routes flushed without notification. */
+	groups = 0;
+	if (!filter || filter->family != AF_INET6)
+		groups |= RTMGRP_IPV4_ROUTE | RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+	if (!filter || filter->family != AF_INET) groups |= RTMGRP_IPV6_ROUTE;
+	if ((c->fd = wapi_rtnl_open(groups)) < 0)
+	{
+		free(c->buckets);
+		free(c);
+		return -1;
+	}
+	setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	if (wapi_route_cache_resync(c) < 0)
+	{
+		wapi_route_cache_close(c);
+		return -1;
+	}
+
+	*cache = c;
+	return 0;
+}
+
+
+int
+wapi_route_cache_open(
+	const wapi_route_filter_t *filter,
+	wapi_route_cache_cb_t cb,
+	void *arg,
+	wapi_route_cache_t **cache)
+{
+	return wapi_route_cache_open_with(NULL, filter, cb, arg, cache);
+}
+
+
+int
+wapi_ctx_route_cache_open(
+	wapi_ctx_t *ctx,
+	const wapi_route_filter_t *filter,
+	wapi_route_cache_cb_t cb,
+	void *arg,
+	wapi_route_cache_t **cache)
+{
+	WAPI_VALIDATE_PTR(ctx);
+	return wapi_route_cache_open_with(ctx, filter, cb, arg, cache);
+}
+
+
+int
+wapi_route_cache_fd(const wapi_route_cache_t *cache)
+{
+	WAPI_VALIDATE_PTR(cache);
+	return cache->fd;
+}
+
+
+static int
+wapi_route_cache_event(const struct nlmsghdr *nlh, void *arg)
+{
+	wapi_route_cache_t *cache = arg;
+
+	if (nlh->nlmsg_type == RTM_NEWLINK ||
+		nlh->nlmsg_type == RTM_DELLINK ||
+		nlh->nlmsg_type == RTM_DELADDR)
+		return wapi_route_cache_link(cache, nlh);
+	return wapi_route_cache_apply(cache, nlh);
+}
+
+
+/* Notifications are lost. Queued ones predate the dump we are about to take,
+ * hence discard them first. */
+static int
+wapi_route_cache_overrun(void *arg)
+{
+	wapi_route_cache_t *cache = arg;
+
+	wapi_netlink_drain(cache->fd);
+	return wapi_route_cache_resync(cache);
+}
+
+
+int
+wapi_route_cache_process(wapi_route_cache_t *cache)
+{
+	int nchanges;
+	int ret;
+
+	WAPI_VALIDATE_PTR(cache);
+
+	nchanges = wapi_netlink_process(
+		cache->fd, wapi_route_cache_event, wapi_route_cache_overrun, cache);
+	if (nchanges < 0)
+		return nchanges;
+
+	/* Address removals are coalesced into a single dump. */
+	if (cache->resync)
+	{
+		if ((ret = wapi_route_cache_resync(cache)) < 0)
+			return ret;
+		nchanges += ret;
+	}
+
+	return nchanges;
+}
+
+
+const wapi_list_t *
+wapi_route_cache_routes(const wapi_route_cache_t *cache)
+{
+	return cache ? &cache->list : NULL;
+}
+
+
+unsigned long
+wapi_route_cache_generation(const wapi_route_cache_t *cache)
+{
+	return cache ? cache->generation : 0;
+}
+
+
+void
+wapi_route_cache_close(wapi_route_cache_t *cache)
+{
+	wapi_route_info_t *ri;
+
+	if (!cache) return;
+
+	close(cache->fd);
+	for (ri = cache->list.head.route; ri; )
+	{
+		wapi_route_info_t *next = ri->next;
+		free(ri);
+		ri = next;
+	}
+	free(cache->buckets);
+	free(cache);
+}
+
+
+/*-- Reconciliation ----------------------------------------------------------*/
+
+
+/* Kernel identity of a route. Destination is masked, and IPv4 ones are
+ * stored in the first four bytes. */
+typedef struct wapi_route_key_t {
+	int family;
+	unsigned int table;
+	unsigned int prefixlen;
+	unsigned int metric;
+	struct in6_addr dest;
+} wapi_route_key_t;
+
+
+typedef struct wapi_route_slot_t {
+	unsigned int hash;
+	unsigned int pos;	/* Position in the current route array plus one. */
+} wapi_route_slot_t;
+
+
+/**
+ * Normalizes the identity of the route the way the kernel does while
+ * installing it.
+ */
+static void
+wapi_route_key(const wapi_route_info_t *ri, wapi_route_key_t *key)
+{
+	bzero(key, sizeof(wapi_route_key_t));
+	key->family = ri->family ? ri->family : AF_INET;
+	key->table = ri->table ? ri->table : RT_TABLE_MAIN;
+	key->metric = ri->metric;
+
+	if (key->family == AF_INET)
+	{
+		uint32_t mask;
+
+		key->prefixlen = ri->prefixlen;
+		if (!key->prefixlen)
+			key->prefixlen = (ri->flags & RTF_HOST)
+				? 32 : __builtin_popcount(ri->netmask.s_addr);
+		mask = key->prefixlen ? htonl(0xFFFFFFFFu << (32 - key->prefixlen)) : 0;
+		((struct in_addr *) &key->dest)->s_addr = ri->dest.s_addr & mask;
+	}
+	else
+	{
+		unsigned char *dest = (unsigned char *) &key->dest;
+		size_t k;
+
+		/* IPv6 routes without a metric get IP6_RT_PRIO_USER. */
+		if (!key->metric) key->metric = 1024;
+		key->prefixlen = ri->prefixlen > 128 ? 128 : ri->prefixlen;
+		memcpy(dest, &ri->dest6, sizeof(struct in6_addr));
+		for (k = key->prefixlen / 8; k < sizeof(struct in6_addr); k++)
+			dest[k] &= k == key->prefixlen / 8
+				? (unsigned char) (0xFF00 >> (key->prefixlen % 8)) : 0;
+	}
+}
+
+
+/**
+ * Checks whether @a cur deviates from what @a want specifies.
+ */
+static int
+wapi_route_differs(
+	const wapi_route_info_t *want,
+	int want_ifindex,
+	const wapi_route_info_t *cur)
+{
+	int want_gw = (want->flags & RTF_GATEWAY) == RTF_GATEWAY;
+	int cur_gw = (cur->flags & RTF_GATEWAY) == RTF_GATEWAY;
+
+	if (want_gw != cur_gw)
+		return 1;
+	if (want_gw &&
+		(cur->family == AF_INET
+		 ? want->gw.s_addr != cur->gw.s_addr
+		 : memcmp(&want->gw6, &cur->gw6, sizeof(struct in6_addr))))
+		return 1;
+
+	return (want_ifindex && want_ifindex != cur->ifindex) ||
+		(want->type ? want->type : RTN_UNICAST) != cur->type ||
+		(want->protocol && want->protocol != cur->protocol) ||
+		(want->scope && want->scope != cur->scope) ||
+		want->mtu != cur->mtu ||
+		want->window != cur->window;
+}
+
+
+int
+wapi_route_diff(
+	const wapi_list_t *current,
+	const wapi_list_t *desired,
+	wapi_route_diff_t *diff)
+{
+	const wapi_route_info_t **curs = NULL;
+	wapi_route_slot_t *slots = NULL;
+	unsigned char *matched = NULL;
+	const wapi_route_info_t *ri;
+	const char *ifname = NULL;
+	int ifindex = 0;
+	size_t ncurs;
+	size_t ndesired;
+	size_t nslots;
+	size_t k;
+	int ret = -1;
+
+	WAPI_VALIDATE_PTR(current);
+	WAPI_VALIDATE_PTR(desired);
+	WAPI_VALIDATE_PTR(diff);
+
+	bzero(diff, sizeof(wapi_route_diff_t));
+
+	/* Allocate buffers. */
+	for (ncurs = 0, ri = current->head.route; ri; ri = ri->next) ncurs++;
+	for (ndesired = 0, ri = desired->head.route; ri; ri = ri->next) ndesired++;
+	for (nslots = 16; nslots < 2 * ncurs; nslots *= 2);
+	curs = malloc((ncurs + 1) * sizeof(wapi_route_info_t *));
+	matched = calloc(ncurs + 1, sizeof(unsigned char));
+	slots = calloc(nslots, sizeof(wapi_route_slot_t));
+	diff->ops = malloc((ncurs + ndesired + 1) * sizeof(wapi_route_op_t));
+	if (!curs || !matched || !slots || !diff->ops)
+	{
+		WAPI_STRERROR("malloc()");
+		goto exit;
+	}
+
+	/* Hash current routes with linear probing. */
+	for (k = 0, ri = current->head.route; ri; ri = ri->next, k++)
+	{
+		wapi_route_key_t key;
+		unsigned int hash;
+		size_t slot;
+
+		curs[k] = ri;
+		wapi_route_key(ri, &key);
+		hash = wapi_route_cache_fnv(2166136261u, &key, sizeof(key));
+		for (slot = hash & (nslots - 1);
+			 slots[slot].pos;
+			 slot = (slot + 1) & (nslots - 1));
+		slots[slot].hash = hash;
+		slots[slot].pos = k + 1;
+	}
+
+	/* Look desired routes up. */
+	for (ri = desired->head.route; ri; ri = ri->next)
+	{
+		wapi_route_key_t key;
+		wapi_route_key_t curkey;
+		const wapi_route_info_t *cur = NULL;
+		unsigned int hash;
+		size_t slot;
+		int want_ifindex = ri->ifindex;
+
+		wapi_route_key(ri, &key);
+		hash = wapi_route_cache_fnv(2166136261u, &key, sizeof(key));
+		for (slot = hash & (nslots - 1);
+			 slots[slot].pos;
+			 slot = (slot + 1) & (nslots - 1))
+		{
+			if (slots[slot].hash != hash) continue;
+			wapi_route_key(curs[slots[slot].pos - 1], &curkey);
+			if (!memcmp(&key, &curkey, sizeof(key)))
+			{
+				cur = curs[slots[slot].pos - 1];
+				matched[slots[slot].pos - 1] = 1;
+				break;
+			}
+		}
+
+		/* Resolve interface names, remembering the last one. */
+		if (!want_ifindex && ri->ifname && strcmp(ri->ifname, "*"))
+		{
+			if (!ifname || strcmp(ifname, ri->ifname))
+			{
+				ifname = ri->ifname;
+				ifindex = if_nametoindex(ifname);
+			}
+			want_ifindex = ifindex;
+		}
+
+		if (!cur)
+		{
+			diff->ops[diff->nops].act = WAPI_ROUTE_ACT_ADD;
+			diff->nadd++;
+		}
+		else if (wapi_route_differs(ri, want_ifindex, cur))
+		{
+			diff->ops[diff->nops].act = WAPI_ROUTE_ACT_REPLACE;
+			diff->nreplace++;
+		}
+		else continue;
+
+		diff->ops[diff->nops].route = ri;
+		diff->ops[diff->nops].error = 0;
+		diff->nops++;
+	}
+
+	/* Whatever is left unmatched goes away. */
+	for (k = 0; k < ncurs; k++)
+		if (!matched[k])
+		{
+			diff->ops[diff->nops].act = WAPI_ROUTE_ACT_DEL;
+			diff->ops[diff->nops].route = curs[k];
+			diff->ops[diff->nops].error = 0;
+			diff->nops++;
+			diff->ndel++;
+		}
+
+	ret = 0;
+
+exit:
+	free(curs);
+	free(matched);
+	free(slots);
+	if (ret < 0) wapi_route_diff_free(diff);
+	return ret;
+}
+
+
+static int
+wapi_route_reconcile_fd(
+	int fd,
+	const wapi_list_t *desired,
+	const wapi_route_filter_t *filter,
+	int dry_run,
+	wapi_route_diff_t *diff)
+{
+	wapi_list_t current;
+	int ret;
+
+	bzero(diff, sizeof(wapi_route_diff_t));
+
+	/* Without a protocol of its own, the caller would take over every local,
+	 * kernel and link-local route, and have them deleted. */
+	if (!filter || !filter->protocol || filter->protocol == RTPROT_KERNEL)
+	{
+		WAPI_ERROR("Reconciliation requires a filter with a protocol!\n");
+		return -EINVAL;
+	}
+
+	bzero(&current, sizeof(wapi_list_t));
+	if ((ret = wapi_rtnl_get_routes(fd, &current, filter)) < 0)
+		return ret;
+
+	if ((ret = wapi_route_diff(&current, desired, diff)) < 0)
+	{
+		diff->current = current.head.route;
+		wapi_route_diff_free(diff);
+		return ret;
+	}
+	diff->current = current.head.route;
+
+	return dry_run ? 0
+		: wapi_rtnl_route_batch(fd, diff->ops, diff->nops, filter->protocol);
+}
+
+
+int
+wapi_route_reconcile(
+	const wapi_list_t *desired,
+	const wapi_route_filter_t *filter,
+	int dry_run,
+	wapi_route_diff_t *diff)
+{
+	int fd;
+	int ret;
+
+	WAPI_VALIDATE_PTR(desired);
+	WAPI_VALIDATE_PTR(diff);
+
+	if ((fd = wapi_rtnl_open(0)) < 0)
+		return fd;
+	ret = wapi_route_reconcile_fd(fd, desired, filter, dry_run, diff);
+	close(fd);
+
+	return ret;
+}
+
+
+int
+wapi_ctx_route_reconcile(
+	wapi_ctx_t *ctx,
+	const wapi_list_t *desired,
+	const wapi_route_filter_t *filter,
+	int dry_run,
+	wapi_route_diff_t *diff)
+{
+	int fd;
+
+	WAPI_VALIDATE_PTR(ctx);
+	WAPI_VALIDATE_PTR(desired);
+	WAPI_VALIDATE_PTR(diff);
+
+	if ((fd = wapi_ctx_rtnl(ctx)) < 0)
+		return fd;
+	return wapi_route_reconcile_fd(fd, desired, filter, dry_run, diff);
+}
+
+
+void
+wapi_route_diff_free(wapi_route_diff_t *diff)
+{
+	wapi_route_info_t *ri;
+
+	if (!diff) return;
+
+	for (ri = diff->current; ri; )
+	{
+		wapi_route_info_t *next = ri->next;
+		free(ri->ifname);
+		free(ri);
+		ri = next;
+	}
+	free(diff->ops);
+	bzero(diff, sizeof(wapi_route_diff_t));
+}
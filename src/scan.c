@@ -0,0 +1,1065 @@
+/**
+ * @file
+ * Scan result tables and caches.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <net/if.h>
+#include <linux/wireless.h>
+
+#include "util.h"
+#include "netlink.h"
+#include "wapi.h"
+
+
+/*-- Storage -----------------------------------------------------------------*/
+
+
+/* Columns of the table, wider ones first to keep them naturally aligned. */
+static const wapi_column_t wapi_scan_table_columns[] = {
+	WAPI_COLUMN(wapi_scan_table_t, rate),
+	WAPI_COLUMN(wapi_scan_table_t, essid),
+	WAPI_COLUMN(wapi_scan_table_t, radios),
+	WAPI_COLUMN(wapi_scan_table_t, freq),
+	WAPI_COLUMN(wapi_scan_table_t, signal),
+	WAPI_COLUMN(wapi_scan_table_t, bssid),
+	WAPI_COLUMN(wapi_scan_table_t, mode),
+	WAPI_COLUMN(wapi_scan_table_t, essid_len),
+	WAPI_COLUMN(wapi_scan_table_t, has),
+	WAPI_COLUMN(wapi_scan_table_t, radio)
+};
+
+
+/* Makes room for at least one more row. */
+static int
+wapi_scan_table_grow(wapi_scan_table_t *table)
+{
+	size_t size = table->size ? 2 * table->size : 64;
+	char *block;
+
+	block = wapi_columns_grow(
+		table, WAPI_COLUMNS(wapi_scan_table_columns),
+		table->block, table->nbss, size);
+	if (!block)
+		return -1;
+	table->block = block;
+	table->size = size;
+
+	return 0;
+}
+
+
+/* Copies an ESSID into the pool, and returns its offset. */
+static int
+wapi_scan_table_intern(wapi_scan_table_t *table, const char *essid, size_t len)
+{
+	size_t off = table->pool_len;
+
+	if (off + len + 1 > table->pool_size)
+	{
+		size_t size = table->pool_size ? 2 * table->pool_size : 1024;
+		char *pool;
+
+		while (size < off + len + 1) size *= 2;
+		pool = realloc(table->pool, size);
+		if (!pool)
+		{
+			WAPI_STRERROR("realloc()");
+			return -1;
+		}
+		table->pool = pool;
+		table->pool_size = size;
+	}
+
+	memcpy(table->pool + off, essid, len);
+	table->pool[off + len] = '\0';
+	table->pool_len += len + 1;
+
+	return (int) off;
+}
+
+
+/* Sets every column of the row but the ESSID and the radios. */
+static void
+wapi_scan_table_set(
+	wapi_scan_table_t *table,
+	size_t row,
+	const struct wapi_scan_info_t *info)
+{
+	uint8_t has = table->has[row] & WAPI_SCAN_HAS_ESSID;
+
+	memcpy(&table->bssid[row], &info->ap, sizeof(struct ether_addr));
+	table->freq[row] = info->has_freq ? (uint16_t) (info->freq / 1e6 + 0.5) : 0;
+	table->signal[row] = info->has_signal ? info->signal : 0;
+	table->mode[row] = info->has_mode ? info->mode : 0;
+	table->rate[row] = info->has_bitrate ? info->bitrate : 0;
+	if (info->has_freq) has |= WAPI_SCAN_HAS_FREQ;
+	if (info->has_signal) has |= WAPI_SCAN_HAS_SIGNAL;
+	if (info->has_mode) has |= WAPI_SCAN_HAS_MODE;
+	if (info->has_bitrate) has |= WAPI_SCAN_HAS_RATE;
+	table->has[row] = has;
+}
+
+
+int
+wapi_scan_table_add(const struct wapi_scan_info_t *info, void *arg)
+{
+	wapi_scan_table_t *table = arg;
+	size_t row;
+
+	WAPI_VALIDATE_PTR(info);
+	WAPI_VALIDATE_PTR(table);
+
+	if (table->nbss == table->size && wapi_scan_table_grow(table) < 0)
+		return -1;
+	row = table->nbss;
+
+	table->essid[row] = 0;
+	table->essid_len[row] = 0;
+	table->has[row] = 0;
+	if (info->has_essid)
+	{
+		/* ESSIDs are NUL padded, binary ones are cut at the first NUL. */
+		size_t len = strnlen(info->essid, WAPI_ESSID_MAX_SIZE);
+		int off = wapi_scan_table_intern(table, info->essid, len);
+		if (off < 0) return -1;
+		table->essid[row] = off;
+		table->essid_len[row] = len;
+		table->has[row] = WAPI_SCAN_HAS_ESSID;
+	}
+
+	wapi_scan_table_set(table, row, info);
+	table->radio[row] = 0;
+	table->radios[row] = 1;
+
+	table->nbss++;
+	return 0;
+}
+
+
+int
+wapi_scan_table_fill(int sock, const char *ifname, wapi_scan_table_t *table)
+{
+	WAPI_VALIDATE_PTR(table);
+
+	wapi_scan_table_clear(table);
+	return wapi_scan_visit(sock, ifname, wapi_scan_table_add, table);
+}
+
+
+const char *
+wapi_scan_table_essid(const wapi_scan_table_t *table, size_t row)
+{
+	if (row >= table->nbss || !(table->has[row] & WAPI_SCAN_HAS_ESSID))
+		return "";
+	return table->pool + table->essid[row];
+}
+
+
+void
+wapi_scan_table_clear(wapi_scan_table_t *table)
+{
+	table->nbss = 0;
+	table->pool_len = 0;
+}
+
+
+void
+wapi_scan_table_free(wapi_scan_table_t *table)
+{
+	if (!table) return;
+	free(table->block);
+	free(table->pool);
+	bzero(table, sizeof(wapi_scan_table_t));
+}
+
+
+/*-- Queries -----------------------------------------------------------------*/
+
+
+size_t
+wapi_scan_table_filter(
+	const wapi_scan_table_t *table,
+	const wapi_scan_filter_t *filter,
+	size_t *rows)
+{
+	size_t essid_len = 0;
+	size_t bssid_len = 0;
+	size_t nrows = 0;
+	size_t row;
+
+	if (filter && filter->essid)
+		essid_len = strlen(filter->essid);
+	if (filter && filter->bssid)
+		bssid_len = filter->bssid_len < sizeof(struct ether_addr)
+			? filter->bssid_len : sizeof(struct ether_addr);
+
+	for (row = 0; row < table->nbss; row++)
+	{
+		if (filter && filter->bands)
+		{
+			wapi_band_t band;
+			int chan;
+
+			if (!(table->has[row] & WAPI_SCAN_HAS_FREQ) ||
+				wapi_freq_mhz2chan(table->freq[row], &band, &chan) < 0 ||
+				!(filter->bands & (1u << band)))
+				continue;
+		}
+
+		if (filter && filter->essid &&
+			(!(table->has[row] & WAPI_SCAN_HAS_ESSID) ||
+			 table->essid_len[row] != essid_len ||
+			 memcmp(table->pool + table->essid[row], filter->essid, essid_len)))
+			continue;
+
+		if (bssid_len &&
+			memcmp(&table->bssid[row], filter->bssid, bssid_len))
+			continue;
+
+		rows[nrows++] = row;
+	}
+
+	return nrows;
+}
+
+
+/* Restores the min-heap property of "heap" (by signal) from position "i". */
+static void
+wapi_scan_topk_sift(
+	const int16_t *signal,
+	size_t *heap,
+	size_t n,
+	size_t i)
+{
+	for (;;)
+	{
+		size_t min = i;
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
+		size_t tmp;
+
+		if (l < n && signal[heap[l]] < signal[heap[min]]) min = l;
+		if (r < n && signal[heap[r]] < signal[heap[min]]) min = r;
+		if (min == i) break;
+
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+
+size_t
+wapi_scan_table_topk(
+	const wapi_scan_table_t *table,
+	const size_t *rows,
+	size_t nrows,
+	size_t k,
+	size_t *top)
+{
+	const int16_t *signal = table->signal;
+	size_t n = 0;
+	size_t i;
+
+	if (!rows) nrows = table->nbss;
+
+	/* Keep the k strongest rows seen so far in a min-heap, the weakest of them
+	 * on top. Each candidate then costs a single comparison in general. */
+	for (i = 0; i < nrows && k; i++)
+	{
+		size_t row = rows ? rows[i] : i;
+
+		if (!(table->has[row] & WAPI_SCAN_HAS_SIGNAL))
+			continue;
+
+		if (n < k)
+		{
+			size_t j = n++;
+
+			top[j] = row;
+			while (j && signal[top[(j - 1) / 2]] > signal[top[j]])
+			{
+				size_t tmp = top[j];
+				top[j] = top[(j - 1) / 2];
+				top[(j - 1) / 2] = tmp;
+				j = (j - 1) / 2;
+			}
+		}
+		else if (signal[row] > signal[top[0]])
+		{
+			top[0] = row;
+			wapi_scan_topk_sift(signal, top, n, 0);
+		}
+	}
+
+	/* Heap sort in place: popping the weakest to the end leaves the strongest
+	 * first. */
+	for (i = n; i > 1; i--)
+	{
+		size_t tmp = top[0];
+		top[0] = top[i - 1];
+		top[i - 1] = tmp;
+		wapi_scan_topk_sift(signal, top, i - 1, 0);
+	}
+
+	return n;
+}
+
+
+/*-- BSS Cache ---------------------------------------------------------------*/
+
+
+const char *wapi_bss_events[] = {
+	"WAPI_BSS_EVENT_ADD",
+	"WAPI_BSS_EVENT_CHANGE",
+	"WAPI_BSS_EVENT_DEL"
+};
+
+
+typedef struct wapi_bss_slot_t {
+	int used;
+	int reported;				/* Signal level last reported to the callback. */
+	unsigned long gen;			/* Merge the entry was last seen in. */
+	wapi_bss_info_t info;
+} wapi_bss_slot_t;
+
+
+struct wapi_bss_cache_t {
+	wapi_bss_slot_t *slots;
+	size_t size;				/* A power of two. */
+	size_t count;
+	unsigned int max_age;
+	unsigned int signal_delta;
+	wapi_bss_cache_cb_t cb;
+	void *arg;
+	uint64_t now;				/* Time of the scan being merged. */
+	unsigned long gen;			/* Merge counter, as clocks might not tick. */
+	int nchanges;
+};
+
+
+/* Returns the slot of the BSSID, or the empty slot it would be placed in. */
+static size_t
+wapi_bss_cache_find(const wapi_bss_cache_t *cache, const struct ether_addr *bssid)
+{
+	size_t mask = cache->size - 1;
+	size_t i = wapi_mac_hash(bssid) & mask;
+
+	while (cache->slots[i].used &&
+		   memcmp(&cache->slots[i].info.bssid, bssid, sizeof(struct ether_addr)))
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+
+/* Keeps the load factor at or below 1/2. */
+static int
+wapi_bss_cache_grow(wapi_bss_cache_t *cache)
+{
+	wapi_bss_slot_t *old = cache->slots;
+	size_t oldsize = cache->size;
+	size_t i;
+
+	if (2 * (cache->count + 1) <= cache->size)
+		return 0;
+
+	cache->slots = calloc(2 * oldsize, sizeof(wapi_bss_slot_t));
+	if (!cache->slots)
+	{
+		WAPI_STRERROR("calloc()");
+		cache->slots = old;
+		return -1;
+	}
+	cache->size = 2 * oldsize;
+
+	for (i = 0; i < oldsize; i++)
+		if (old[i].used)
+			cache->slots[wapi_bss_cache_find(cache, &old[i].info.bssid)] = old[i];
+	free(old);
+
+	return 0;
+}
+
+
+static size_t
+wapi_bss_cache_home(size_t j, void *arg)
+{
+	const wapi_bss_cache_t *cache = arg;
+
+	return !cache->slots[j].used ? WAPI_INDEX_NOROW
+		: wapi_mac_hash(&cache->slots[j].info.bssid) & (cache->size - 1);
+}
+
+
+static void
+wapi_bss_cache_move(size_t i, size_t j, void *arg)
+{
+	wapi_bss_cache_t *cache = arg;
+	cache->slots[i] = cache->slots[j];
+}
+
+
+/* Empties slot "i" without leaving a tombstone behind. */
+static void
+wapi_bss_cache_remove(wapi_bss_cache_t *cache, size_t i)
+{
+	i = wapi_probe_remove(
+		i, cache->size - 1, wapi_bss_cache_home, wapi_bss_cache_move, cache);
+	cache->slots[i].used = 0;
+	cache->count--;
+}
+
+
+static inline void
+wapi_bss_cache_notify(
+	wapi_bss_cache_t *cache,
+	wapi_bss_event_t event,
+	wapi_bss_slot_t *slot)
+{
+	slot->reported = slot->info.signal;
+	cache->nchanges++;
+	if (cache->cb) cache->cb(event, &slot->info, cache->arg);
+}
+
+
+int
+wapi_bss_cache_create(
+	unsigned int max_age,
+	unsigned int signal_delta,
+	wapi_bss_cache_cb_t cb,
+	void *arg,
+	wapi_bss_cache_t **cache)
+{
+	wapi_bss_cache_t *c;
+
+	WAPI_VALIDATE_PTR(cache);
+
+	c = calloc(1, sizeof(wapi_bss_cache_t));
+	if (!c)
+	{
+		WAPI_STRERROR("calloc()");
+		return -1;
+	}
+
+	c->size = 64;
+	c->slots = calloc(c->size, sizeof(wapi_bss_slot_t));
+	if (!c->slots)
+	{
+		WAPI_STRERROR("calloc()");
+		free(c);
+		return -1;
+	}
+
+	c->max_age = max_age;
+	c->signal_delta = signal_delta;
+	c->cb = cb;
+	c->arg = arg;
+	c->now = wapi_monotonic_ms();
+
+	*cache = c;
+	return 0;
+}
+
+
+void
+wapi_bss_cache_begin(wapi_bss_cache_t *cache)
+{
+	cache->now = wapi_monotonic_ms();
+	cache->gen++;
+	cache->nchanges = 0;
+}
+
+
+int
+wapi_bss_cache_add(const struct wapi_scan_info_t *info, void *arg)
+{
+	wapi_bss_cache_t *cache = arg;
+	wapi_bss_slot_t *slot;
+	wapi_bss_info_t *bss;
+	int changed = 0;
+	int fresh;
+
+	WAPI_VALIDATE_PTR(info);
+	WAPI_VALIDATE_PTR(cache);
+
+	if (wapi_bss_cache_grow(cache) < 0)
+		return -1;
+
+	slot = &cache->slots[wapi_bss_cache_find(cache, &info->ap)];
+	bss = &slot->info;
+	if ((fresh = !slot->used))
+	{
+		bzero(slot, sizeof(wapi_bss_slot_t));
+		slot->used = 1;
+		memcpy(&bss->bssid, &info->ap, sizeof(struct ether_addr));
+		bss->first_seen = cache->now;
+		cache->count++;
+	}
+	bss->last_seen = cache->now;
+	slot->gen = cache->gen;
+
+	/* Fields missing from a scan entry keep their previous values. */
+	if (info->has_freq)
+	{
+		unsigned int freq = (unsigned int) (info->freq / 1e6 + 0.5);
+		changed |= bss->freq != freq;
+		bss->freq = freq;
+	}
+
+	if (info->has_essid)
+	{
+		changed |= !bss->has_essid || strcmp(bss->essid, info->essid);
+		bss->has_essid = 1;
+		memcpy(bss->essid, info->essid, sizeof(bss->essid));
+	}
+
+	if (info->has_mode)
+	{
+		changed |= !bss->has_mode || bss->mode != info->mode;
+		bss->has_mode = 1;
+		bss->mode = info->mode;
+	}
+
+	if (info->has_bitrate)
+	{
+		changed |= bss->bitrate != info->bitrate;
+		bss->bitrate = info->bitrate;
+	}
+
+	if (info->has_signal)
+	{
+		bss->has_signal = 1;
+		bss->signal = info->signal;
+		bss->history[bss->nsamples++ % WAPI_BSS_HISTORY] = info->signal;
+		if (cache->signal_delta &&
+			(unsigned int) abs(info->signal - slot->reported) >=
+			cache->signal_delta)
+			changed = 1;
+	}
+
+	if (fresh)
+		wapi_bss_cache_notify(cache, WAPI_BSS_EVENT_ADD, slot);
+	else if (changed)
+		wapi_bss_cache_notify(cache, WAPI_BSS_EVENT_CHANGE, slot);
+
+	return 0;
+}
+
+
+int
+wapi_bss_cache_commit(wapi_bss_cache_t *cache)
+{
+	size_t i;
+
+	WAPI_VALIDATE_PTR(cache);
+
+	/* Removal shifts later entries back into "i", hence no increment then. */
+	for (i = 0; i < cache->size; )
+	{
+		wapi_bss_slot_t *slot = &cache->slots[i];
+
+		if (slot->used && slot->gen != cache->gen &&
+			cache->now - slot->info.last_seen >= cache->max_age)
+		{
+			cache->nchanges++;
+			if (cache->cb) cache->cb(WAPI_BSS_EVENT_DEL, &slot->info, cache->arg);
+			wapi_bss_cache_remove(cache, i);
+		}
+		else i++;
+	}
+
+	return cache->nchanges;
+}
+
+
+int
+wapi_bss_cache_update(int sock, const char *ifname, wapi_bss_cache_t *cache)
+{
+	int ret;
+
+	WAPI_VALIDATE_PTR(cache);
+
+	wapi_bss_cache_begin(cache);
+	if ((ret = wapi_scan_visit(sock, ifname, wapi_bss_cache_add, cache)) < 0)
+		return ret;
+
+	return wapi_bss_cache_commit(cache);
+}
+
+
+const wapi_bss_info_t *
+wapi_bss_cache_lookup(
+	const wapi_bss_cache_t *cache,
+	const struct ether_addr *bssid)
+{
+	const wapi_bss_slot_t *slot;
+
+	slot = &cache->slots[wapi_bss_cache_find(cache, bssid)];
+	return slot->used ? &slot->info : NULL;
+}
+
+
+const wapi_bss_info_t *
+wapi_bss_cache_next(const wapi_bss_cache_t *cache, size_t *pos)
+{
+	while (*pos < cache->size)
+	{
+		const wapi_bss_slot_t *slot = &cache->slots[(*pos)++];
+		if (slot->used) return &slot->info;
+	}
+
+	return NULL;
+}
+
+
+size_t
+wapi_bss_cache_count(const wapi_bss_cache_t *cache)
+{
+	return cache->count;
+}
+
+
+void
+wapi_bss_cache_destroy(wapi_bss_cache_t *cache)
+{
+	if (!cache) return;
+	free(cache->slots);
+	free(cache);
+}
+
+
+/*-- Multi-Radio Scans -------------------------------------------------------*/
+
+
+/* Interval of wapi_scan_stat() probes for radios without nl80211, in msecs. */
+#define WAPI_SCAN_MULTI_PROBE 100
+
+
+typedef enum {
+	WAPI_SCAN_RADIO_DONE,
+	WAPI_SCAN_RADIO_NL,			/* Waiting for the nl80211 scan event. */
+	WAPI_SCAN_RADIO_WE,			/* Waiting for the WE scan to complete. */
+	WAPI_SCAN_RADIO_LOST		/* nl80211 scan, whose event might be lost. */
+} wapi_scan_radio_state_t;
+
+
+typedef struct wapi_scan_multi_t {
+	wapi_ctx_t *ctx;
+	const char *const *ifnames;
+	int ifindex[WAPI_SCAN_MULTI_MAX];
+	wapi_scan_radio_state_t state[WAPI_SCAN_MULTI_MAX];
+	size_t n;
+	size_t pending;
+	int *errors;
+	uint64_t start;
+	wapi_scan_table_t *table;
+	size_t *index;				/* Rows by BSSID, open addressing. */
+	size_t index_size;			/* A power of two. */
+	size_t radio;				/* Radio being merged. */
+} wapi_scan_multi_t;
+
+
+/* Merges a BSS heard by the current radio into the table. */
+static int
+wapi_scan_multi_add(const struct wapi_scan_info_t *info, void *arg)
+{
+	wapi_scan_multi_t *m = arg;
+	wapi_scan_table_t *table = m->table;
+	size_t row;
+	size_t i;
+
+	if (wapi_mac_index_grow(
+			&m->index, &m->index_size, table->bssid, table->nbss) < 0)
+		return -1;
+
+	i = wapi_mac_index_find(m->index, m->index_size, table->bssid, &info->ap);
+	row = m->index[i];
+	if (row == WAPI_INDEX_NOROW)
+	{
+		if (wapi_scan_table_add(info, table) < 0)
+			return -1;
+		row = m->index[i] = table->nbss - 1;
+		table->radio[row] = m->radio;
+		table->radios[row] = 0;
+	}
+	else if (info->has_signal &&
+			 (!(table->has[row] & WAPI_SCAN_HAS_SIGNAL) ||
+			  info->signal > table->signal[row]))
+	{
+		wapi_scan_table_set(table, row, info);
+		table->radio[row] = m->radio;
+	}
+
+	table->radios[row] |= 1u << m->radio;
+	return 0;
+}
+
+
+/* Records the outcome of the radio, merging its results if it is a success. */
+static void
+wapi_scan_multi_done(wapi_scan_multi_t *m, size_t k, int ret)
+{
+	if (ret == 0)
+	{
+		m->radio = k;
+		if (m->state[k] != WAPI_SCAN_RADIO_WE)
+			/* Only entries refreshed since the scans are triggered. */
+			ret = wapi_ctx_scan_cached_visit(
+				m->ctx, m->ifnames[k], wapi_monotonic_ms() - m->start + 1,
+				wapi_scan_multi_add, m);
+		else
+			ret = wapi_scan_visit(
+				wapi_ctx_sock(m->ctx), m->ifnames[k], wapi_scan_multi_add, m);
+		if (ret > 0) ret = 0;
+	}
+
+	m->errors[k] = ret;
+	m->state[k] = WAPI_SCAN_RADIO_DONE;
+	m->pending--;
+}
+
+
+static void
+wapi_scan_multi_event(
+	wapi_scan_event_t event,
+	int ifindex,
+	int wiphy,
+	void *arg)
+{
+	wapi_scan_multi_t *m = arg;
+	size_t k;
+
+	(void) wiphy;
+
+	for (k = 0; k < m->n; k++)
+	{
+		if (m->state[k] != WAPI_SCAN_RADIO_NL &&
+			m->state[k] != WAPI_SCAN_RADIO_LOST)
+			continue;
+
+		switch (event)
+		{
+		case WAPI_SCAN_EVENT_DONE:
+			if (m->ifindex[k] == ifindex) wapi_scan_multi_done(m, k, 0);
+			break;
+
+		case WAPI_SCAN_EVENT_ABORTED:
+			if (m->ifindex[k] == ifindex) wapi_scan_multi_done(m, k, -ECANCELED);
+			break;
+
+		case WAPI_SCAN_EVENT_OVERRUN:
+			/* Any of the completions might be lost, hence probe them. */
+			m->state[k] = WAPI_SCAN_RADIO_LOST;
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+
+/* Handles SIOCGIWSCAN wireless events of the radios driven via WE. */
+static int
+wapi_scan_multi_link(wapi_scan_multi_t *m, int fd)
+{
+	char buf[WAPI_RTNL_BUFSIZ];
+	ssize_t len;
+
+	while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+	{
+		const struct nlmsghdr *nlh;
+
+		for (nlh = (const struct nlmsghdr *) buf;
+			 NLMSG_OK(nlh, len);
+			 nlh = NLMSG_NEXT(nlh, len))
+		{
+			const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+			struct rtattr *tb[IFLA_MAX + 1];
+			const char *data;
+			size_t wlen;
+			size_t off;
+			size_t k;
+
+			if (nlh->nlmsg_type != RTM_NEWLINK ||
+				nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+				continue;
+
+			for (k = 0; k < m->n; k++)
+				if (m->state[k] == WAPI_SCAN_RADIO_WE &&
+					m->ifindex[k] == ifi->ifi_index)
+					break;
+			if (k == m->n)
+				continue;
+
+			wapi_rtnl_parse(
+				tb, IFLA_MAX, IFLA_RTA(ifi),
+				nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)));
+			if (!tb[IFLA_WIRELESS])
+				continue;
+
+			/* Only the headers matter, no need to decode the payloads. */
+			data = RTA_DATA(tb[IFLA_WIRELESS]);
+			wlen = RTA_PAYLOAD(tb[IFLA_WIRELESS]);
+			for (off = 0; off + IW_EV_LCP_LEN <= wlen; )
+			{
+				struct iw_event iwe;
+
+				memcpy(&iwe, data + off, IW_EV_LCP_LEN);
+				if (iwe.len < IW_EV_LCP_LEN)
+					break;
+				if (iwe.cmd == SIOCGIWSCAN)
+				{
+					wapi_scan_multi_done(m, k, 0);
+					break;
+				}
+				off += iwe.len;
+			}
+		}
+	}
+
+	/* Lost events are made up for by the probes. */
+	if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+		errno != EINTR && errno != ENOBUFS)
+	{
+		WAPI_STRERROR("recv(AF_NETLINK)");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static inline int
+wapi_scan_multi_probed(const wapi_scan_multi_t *m, size_t k)
+{
+	return m->state[k] == WAPI_SCAN_RADIO_WE ||
+		m->state[k] == WAPI_SCAN_RADIO_LOST;
+}
+
+
+/* Polls the radios driven via WE, for drivers not sending scan events, and the
+ * nl80211 ones whose events might be lost. The latter are taken to be done, if
+ * the cfg80211 WE compatibility layer is missing, and their cached results
+ * refreshed since the trigger get merged anyway. */
+static void
+wapi_scan_multi_probe(wapi_scan_multi_t *m)
+{
+	size_t k;
+
+	for (k = 0; k < m->n; k++)
+	{
+		int ret;
+
+		if (!wapi_scan_multi_probed(m, k))
+			continue;
+
+		ret = wapi_scan_stat(wapi_ctx_sock(m->ctx), m->ifnames[k]);
+		if (ret != 1)
+			wapi_scan_multi_done(
+				m, k, m->state[k] == WAPI_SCAN_RADIO_LOST ? 0 : ret);
+	}
+}
+
+
+/* Triggers the scan of every radio. */
+static void
+wapi_scan_multi_trigger(
+	wapi_scan_multi_t *m,
+	const wapi_scan_params_t *params,
+	int has_nl80211)
+{
+	size_t k;
+
+	for (k = 0; k < m->n; k++)
+	{
+		int ret;
+
+		m->pending++;
+		m->ifindex[k] = if_nametoindex(m->ifnames[k]);
+		if (!m->ifindex[k])
+		{
+			WAPI_STRERROR("if_nametoindex(\"%s\")", m->ifnames[k]);
+			wapi_scan_multi_done(m, k, -ENODEV);
+			continue;
+		}
+
+		/* A running scan is as good as ours, just wait for it. */
+		ret = has_nl80211
+			? wapi_ctx_scan_trigger(m->ctx, m->ifnames[k], params)
+			: -ENOTSUP;
+		if (ret >= 0 || ret == -EBUSY)
+		{
+			m->state[k] = WAPI_SCAN_RADIO_NL;
+			continue;
+		}
+
+		/* Parameters the radio cannot honour are not silently dropped. */
+		m->state[k] = WAPI_SCAN_RADIO_WE;
+		if (ret != -EOPNOTSUPP)
+			ret = wapi_scan_init(wapi_ctx_sock(m->ctx), m->ifnames[k]);
+		if (ret < 0)
+			wapi_scan_multi_done(m, k, ret);
+	}
+}
+
+
+int
+wapi_scan_multi(
+	const char *const *ifnames,
+	size_t n,
+	const wapi_scan_params_t *params,
+	int timeout,
+	wapi_scan_table_t *table,
+	int *errors)
+{
+	wapi_ctx_t *ctx;
+	int ret;
+
+	if ((ret = wapi_ctx_create(&ctx)) < 0)
+		return ret;
+	ret = wapi_ctx_scan_multi(ctx, ifnames, n, params, timeout, table, errors);
+	wapi_ctx_destroy(ctx);
+
+	return ret;
+}
+
+
+int
+wapi_ctx_scan_multi(
+	wapi_ctx_t *ctx,
+	const char *const *ifnames,
+	size_t n,
+	const wapi_scan_params_t *params,
+	int timeout,
+	wapi_scan_table_t *table,
+	int *errors)
+{
+	wapi_scan_multi_t m;
+	wapi_scan_mon_t *mon = NULL;
+	struct epoll_event ev;
+	uint64_t next_probe;
+	uint64_t deadline;
+	int epfd = -1;
+	int link = -1;
+	int ret = -1;
+	size_t k;
+
+	WAPI_VALIDATE_PTR(ctx);
+	WAPI_VALIDATE_PTR(ifnames);
+	WAPI_VALIDATE_PTR(table);
+	WAPI_VALIDATE_PTR(errors);
+
+	if (n > WAPI_SCAN_MULTI_MAX)
+	{
+		WAPI_ERROR("Too many radios: %lu!\n", (unsigned long) n);
+		return -1;
+	}
+
+	bzero(&m, sizeof(m));
+	m.ctx = ctx;
+	m.ifnames = ifnames;
+	m.n = n;
+	m.errors = errors;
+	m.table = table;
+	m.start = wapi_monotonic_ms();
+	deadline = m.start + (timeout < 0 ? 0 : timeout);
+	next_probe = m.start + WAPI_SCAN_MULTI_PROBE;
+	wapi_scan_table_clear(table);
+
+	/* Subscribe before triggering, so that no completion slips through. Lack
+	 * of nl80211 leaves every radio to WE. */
+	if (wapi_scan_mon_open(wapi_scan_multi_event, &m, &mon) < 0)
+		mon = NULL;
+	if ((link = wapi_rtnl_open(RTMGRP_LINK)) < 0)
+		goto exit;
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	{
+		WAPI_STRERROR("epoll_create1()");
+		goto exit;
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = link;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, link, &ev) < 0)
+	{
+		WAPI_STRERROR("epoll_ctl()");
+		goto exit;
+	}
+	if (mon)
+	{
+		ev.data.fd = wapi_scan_mon_fd(mon);
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0)
+		{
+			WAPI_STRERROR("epoll_ctl()");
+			goto exit;
+		}
+	}
+
+	wapi_scan_multi_trigger(&m, params, mon != NULL);
+
+	while (m.pending)
+	{
+		struct epoll_event evs[2];
+		uint64_t now = wapi_monotonic_ms();
+		long long wait = -1;
+		int nev;
+		int i;
+
+		if (timeout >= 0 && now >= deadline)
+			break;
+		if (timeout >= 0)
+			wait = deadline - now;
+
+		/* Radios driven via WE might never send an event. */
+		for (k = 0; k < n && !wapi_scan_multi_probed(&m, k); k++);
+		if (k < n)
+		{
+			if (now >= next_probe)
+			{
+				wapi_scan_multi_probe(&m);
+				next_probe = now + WAPI_SCAN_MULTI_PROBE;
+				continue;
+			}
+			if (wait < 0 || wait > (long long) (next_probe - now))
+				wait = next_probe - now;
+		}
+
+		nev = epoll_wait(epfd, evs, 2, (int) wait);
+		if (nev < 0 && errno != EINTR)
+		{
+			WAPI_STRERROR("epoll_wait()");
+			goto exit;
+		}
+
+		for (i = 0; i < nev; i++)
+			if ((evs[i].data.fd == link
+				 ? wapi_scan_multi_link(&m, link)
+				 : wapi_scan_mon_process(mon)) < 0)
+				goto exit;
+	}
+
+	/* Timed out ones. */
+	for (k = 0; k < n; k++)
+		if (m.state[k] != WAPI_SCAN_RADIO_DONE)
+			errors[k] = 1;
+
+	for (ret = 0, k = 0; k < n; k++)
+		if (errors[k]) ret++;
+
+exit:
+	if (epfd >= 0) close(epfd);
+	if (link >= 0) close(link);
+	wapi_scan_mon_close(mon);
+	free(m.index);
+	return ret;
+}
@@ -10,6 +10,9 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
 
 #include "wapi.h"
 #include "util.h"
@@ -27,63 +30,459 @@ wapi_make_socket(void)
 int
 wapi_get_ifnames(wapi_list_t *list)
 {
-	FILE *fp;
+	wapi_wif_table_t table;
+	size_t i;
 	int ret;
-	size_t tmpsize = WAPI_PROC_LINE_SIZE * sizeof(char);
-	char tmp[WAPI_PROC_LINE_SIZE];
 
 	WAPI_VALIDATE_PTR(list);
 
-	/* Open file for reading. */
-	fp = fopen(WAPI_PROC_NET_WIRELESS, "r");
-	if (!fp)
+	if (wapi_get_wif_table(&table) < 0)
+		return wapi_get_ifnames_proc(list);
+	list->type = WAPI_LIST_STRING;
+
+	/* Push backwards, so that the list follows the table order. */
+	ret = 0;
+	for (i = table.nifs; i-- > 0; )
 	{
-		WAPI_STRERROR("fopen(\"%s\", \"r\")", WAPI_PROC_NET_WIRELESS);
-		return -1;
+		wapi_string_t *string;
+
+		string = wapi_list_alloc(list, sizeof(wapi_string_t));
+		if (string)
+			string->data = wapi_list_strndup(
+				list, table.ifs[i].ifname, strlen(table.ifs[i].ifname));
+		if (!string || !string->data)
+		{
+			WAPI_STRERROR("malloc()");
+			wapi_list_release(list, string);
+			ret = -1;
+			break;
+		}
+
+		string->next = list->head.string;
+		list->head.string = string;
 	}
 
-	/* Skip first two lines. */
-	if (!fgets(tmp, tmpsize, fp) || ! fgets(tmp, tmpsize, fp))
-	{
-		WAPI_ERROR("Invalid \"%s\" content!\n", WAPI_PROC_NET_WIRELESS);
+	wapi_free_wif_table(&table);
+	return ret;
+}
+
+
+int
+wapi_get_ifnames_proc(wapi_list_t *list)
+{
+	const char *data;
+	const char *end;
+	const char *line;
+	size_t len;
+	int nlines;
+	int ret;
+
+	WAPI_VALIDATE_PTR(list);
+
+	if (wapi_proc_read(WAPI_PROC_NET_WIRELESS, &data, &len) < 0)
 		return -1;
-	}
 
-	/* Iterate over available lines. */
+	list->type = WAPI_LIST_STRING;
+
+	/* Iterate over lines, skipping the first two. */
 	ret = 0;
-	while (fgets(tmp, tmpsize, fp))
+	end = data + len;
+	for (nlines = 0, line = data; line < end; nlines++)
 	{
-		char *beg;
-		char *end;
+		const char *eol;
+		const char *beg;
+		const char *colon;
 		wapi_string_t *string;
 
+		if (!(eol = memchr(line, '\n', end - line)))
+			eol = end;
+		if (nlines < 2)
+		{
+			line = eol + 1;
+			continue;
+		}
+
 		/* Locate the interface name region. */
-		for (beg = tmp; *beg && isspace(*beg); beg++);
-		for (end = beg; *end && *end != ':'; end++);
+		for (beg = line; beg < eol && (*beg == ' ' || *beg == '\t'); beg++);
+		colon = memchr(beg, ':', eol - beg);
+		if (!colon || colon == beg)
+		{
+			WAPI_ERROR(
+				"Invalid \"%s\" content at line %d!\n",
+				WAPI_PROC_NET_WIRELESS, nlines + 1);
+			ret = -1;
+			break;
+		}
 
-		/* Allocate both wapi_string_t and char vector. */
-		string = malloc(sizeof(wapi_string_t));
-		if (string) string->data = malloc(end - beg + sizeof(char));
+		/* Allocate wapi_string_t and copy the region into its char vector. */
+		string = wapi_list_alloc(list, sizeof(wapi_string_t));
+		if (string) string->data = wapi_list_strndup(list, beg, colon - beg);
 		if (!string || !string->data)
 		{
 			WAPI_STRERROR("malloc()");
+			wapi_list_release(list, string);
 			ret = -1;
 			break;
 		}
 
-		/* Copy region into the buffer. */
-		snprintf(string->data, (end - beg + sizeof(char)), "%s", beg);
-
 		/* Push string into the list. */
 		string->next = list->head.string;
 		list->head.string = string;
+
+		line = eol + 1;
+	}
+
+	if (nlines < 2)
+	{
+		WAPI_ERROR("Invalid \"%s\" content!\n", WAPI_PROC_NET_WIRELESS);
+		ret = -1;
 	}
 
-	fclose(fp);
 	return ret;
 }
 
 
+unsigned long long
+wapi_monotonic_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+
+unsigned long long
+wapi_monotonic_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+/*-- Tables ------------------------------------------------------------------*/
+
+
+size_t
+wapi_probe_remove(
+	size_t i,
+	size_t mask,
+	wapi_probe_home_cb_t home,
+	wapi_probe_move_cb_t move,
+	void *arg)
+{
+	size_t j = i;
+
+	for (;;)
+	{
+		size_t k;
+
+		j = (j + 1) & mask;
+		if ((k = home(j, arg)) == WAPI_INDEX_NOROW)
+			break;
+
+		/* Entries whose home slot lies cyclically in (i, j] stay put. */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		move(i, j, arg);
+		i = j;
+	}
+
+	return i;
+}
+
+
+size_t
+wapi_mac_index_find(
+	const size_t *index,
+	size_t size,
+	const struct ether_addr *keys,
+	const struct ether_addr *mac)
+{
+	size_t mask = size - 1;
+	size_t i = wapi_mac_hash(mac) & mask;
+
+	while (index[i] != WAPI_INDEX_NOROW &&
+		   memcmp(&keys[index[i]], mac, sizeof(struct ether_addr)))
+		i = (i + 1) & mask;
+
+	return i;
+}
+
+
+int
+wapi_mac_index_grow(
+	size_t **index,
+	size_t *size,
+	const struct ether_addr *keys,
+	size_t n)
+{
+	size_t nsize = *size ? *size : 64;
+	size_t *nindex;
+	size_t row;
+
+	if (2 * (n + 1) <= *size)
+		return 0;
+
+	while (2 * (n + 1) > nsize) nsize *= 2;
+	nindex = malloc(nsize * sizeof(size_t));
+	if (!nindex)
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
+	}
+	free(*index);
+	*index = nindex;
+	*size = nsize;
+
+	memset(nindex, 0xff, nsize * sizeof(size_t));
+	for (row = 0; row < n; row++)
+		nindex[wapi_mac_index_find(nindex, nsize, keys, &keys[row])] = row;
+
+	return 0;
+}
+
+
+typedef struct wapi_mac_index_t {
+	size_t *index;
+	size_t mask;
+	const struct ether_addr *keys;
+} wapi_mac_index_t;
+
+
+static size_t
+wapi_mac_index_home(size_t j, void *arg)
+{
+	const wapi_mac_index_t *mi = arg;
+
+	return mi->index[j] == WAPI_INDEX_NOROW ? WAPI_INDEX_NOROW
+		: wapi_mac_hash(&mi->keys[mi->index[j]]) & mi->mask;
+}
+
+
+static void
+wapi_mac_index_move(size_t i, size_t j, void *arg)
+{
+	const wapi_mac_index_t *mi = arg;
+	mi->index[i] = mi->index[j];
+}
+
+
+void
+wapi_mac_index_del(
+	size_t *index,
+	size_t size,
+	const struct ether_addr *keys,
+	size_t i)
+{
+	wapi_mac_index_t mi;
+
+	mi.index = index;
+	mi.mask = size - 1;
+	mi.keys = keys;
+	i = wapi_probe_remove(
+		i, mi.mask, wapi_mac_index_home, wapi_mac_index_move, &mi);
+	index[i] = WAPI_INDEX_NOROW;
+}
+
+
+static inline char *
+wapi_column_get(const void *table, const wapi_column_t *col)
+{
+	char *cells;
+	memcpy(&cells, (const char *) table + col->offset, sizeof(char *));
+	return cells;
+}
+
+
+char *
+wapi_columns_grow(
+	void *table,
+	const wapi_column_t *cols,
+	size_t ncols,
+	char *block,
+	size_t n,
+	size_t size)
+{
+	size_t rowlen = 0;
+	char *nblock;
+	char *cells;
+	size_t k;
+
+	for (k = 0; k < ncols; k++)
+		rowlen += cols[k].width;
+
+	nblock = malloc(size * rowlen);
+	if (!nblock)
+	{
+		WAPI_STRERROR("malloc()");
+		return NULL;
+	}
+
+	for (cells = nblock, k = 0; k < ncols; k++)
+	{
+		if (n) memcpy(cells, wapi_column_get(table, &cols[k]), n * cols[k].width);
+		memcpy((char *) table + cols[k].offset, &cells, sizeof(char *));
+		cells += size * cols[k].width;
+	}
+	free(block);
+
+	return nblock;
+}
+
+
+void
+wapi_columns_copy(
+	void *table,
+	const wapi_column_t *cols,
+	size_t ncols,
+	size_t dst,
+	size_t src)
+{
+	size_t k;
+
+	for (k = 0; k < ncols; k++)
+	{
+		char *cells = wapi_column_get(table, &cols[k]);
+		memcpy(cells + dst * cols[k].width, cells + src * cols[k].width,
+			   cols[k].width);
+	}
+}
+
+
+/*-- Procfs ------------------------------------------------------------------*/
+
+
+/* Initial size of the per-thread read buffer. */
+#define WAPI_PROC_BUFSIZ 16384
+
+
+static __thread struct {
+	char *data;
+	size_t size;
+} wapi_proc_buf;
+
+
+int
+wapi_proc_read(const char *path, const char **data, size_t *len)
+{
+	size_t off;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		WAPI_STRERROR("open(\"%s\")", path);
+		return -1;
+	}
+
+	/* Procfs reports zero file sizes, so grow until EOF. */
+	for (off = 0; ; off += n)
+	{
+		if (off == wapi_proc_buf.size)
+		{
+			size_t size = off ? 2 * off : WAPI_PROC_BUFSIZ;
+			char *buf = realloc(wapi_proc_buf.data, size);
+			if (!buf)
+			{
+				WAPI_STRERROR("realloc()");
+				close(fd);
+				return -1;
+			}
+			wapi_proc_buf.data = buf;
+			wapi_proc_buf.size = size;
+		}
+
+		n = pread(fd, wapi_proc_buf.data + off, wapi_proc_buf.size - off, off);
+		if (n < 0 && errno == EINTR)
+		{
+			n = 0;
+			continue;
+		}
+		if (n <= 0)
+			break;
+	}
+	close(fd);
+
+	if (n < 0)
+	{
+		WAPI_STRERROR("pread(\"%s\")", path);
+		return -1;
+	}
+
+	*data = wapi_proc_buf.data;
+	*len = off;
+	return 0;
+}
+
+
+void
+wapi_release_buffers(void)
+{
+	free(wapi_proc_buf.data);
+	wapi_proc_buf.data = NULL;
+	wapi_proc_buf.size = 0;
+	wapi_scan_release();
+}
+
+
+static inline int
+wapi_is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+
+const char *
+wapi_scan_hex(const char *p, const char *end, unsigned int *val)
+{
+	const char *beg;
+	unsigned int v = 0;
+
+	while (p < end && wapi_is_blank(*p)) p++;
+	for (beg = p; p < end; p++)
+	{
+		unsigned int d;
+		if (*p >= '0' && *p <= '9') d = *p - '0';
+		else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f') d = (*p | 0x20) - 'a' + 10;
+		else break;
+		v = v << 4 | d;
+	}
+
+	if (p == beg || (p < end && !wapi_is_blank(*p) && *p != '\n'))
+		return NULL;
+
+	*val = v;
+	return p;
+}
+
+
+const char *
+wapi_scan_dec(const char *p, const char *end, int *val)
+{
+	const char *beg;
+	unsigned int v = 0;
+	int neg = 0;
+
+	while (p < end && wapi_is_blank(*p)) p++;
+	if (p < end && *p == '-')
+	{
+		neg = 1;
+		p++;
+	}
+	for (beg = p; p < end && *p >= '0' && *p <= '9'; p++)
+		v = v * 10 + (*p - '0');
+
+	if (p == beg || (p < end && !wapi_is_blank(*p) && *p != '\n'))
+		return NULL;
+
+	*val = neg ? -(int) v : (int) v;
+	return p;
+}
+
+
 #define wapi_ioctl_command_name_bufsiz 128	/* Is fairly enough to print an integer. */
 static char wapi_ioctl_command_name_buf[wapi_ioctl_command_name_bufsiz];
 
@@ -119,3 +518,245 @@ wapi_ioctl_command_name(int cmd)
 		return wapi_ioctl_command_name_buf;
 	}
 }
+
+
+/*-- Arenas ------------------------------------------------------------------*/
+
+
+/* Size of the first chunk, unless given otherwise. */
+#define WAPI_ARENA_SIZE 16384
+
+
+/* Alignment of the allocations, good enough for any node type. */
+#define WAPI_ARENA_ALIGN (2 * sizeof(void *))
+
+
+#define WAPI_ARENA_ROUND(n) (((n) + WAPI_ARENA_ALIGN - 1) & ~(WAPI_ARENA_ALIGN - 1))
+
+
+/* A chunk header, followed by "size" bytes of storage. */
+typedef struct wapi_arena_chunk_t {
+	struct wapi_arena_chunk_t *next;
+	size_t size;
+} wapi_arena_chunk_t;
+
+
+#define WAPI_ARENA_HDRSIZ WAPI_ARENA_ROUND(sizeof(wapi_arena_chunk_t))
+
+
+struct wapi_arena_t {
+	wapi_arena_chunk_t *chunks;	/* Most recent (and the one in use) first. */
+	size_t used;				/* Bytes taken from the head chunk. */
+};
+
+
+static int
+wapi_arena_grow(wapi_arena_t *arena, size_t size)
+{
+	wapi_arena_chunk_t *chunk;
+
+	chunk = malloc(WAPI_ARENA_HDRSIZ + size);
+	if (!chunk)
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
+	}
+
+	chunk->next = arena->chunks;
+	chunk->size = size;
+	arena->chunks = chunk;
+	arena->used = 0;
+
+	return 0;
+}
+
+
+static void *
+wapi_arena_alloc(wapi_arena_t *arena, size_t size)
+{
+	wapi_arena_chunk_t *chunk = arena->chunks;
+	void *ptr;
+
+	size = WAPI_ARENA_ROUND(size);
+	if (!chunk || chunk->size - arena->used < size)
+	{
+		/* Double the capacity with each new chunk. */
+		size_t chunksiz = chunk ? 2 * chunk->size : WAPI_ARENA_SIZE;
+		if (chunksiz < size) chunksiz = size;
+		if (wapi_arena_grow(arena, chunksiz) < 0)
+			return NULL;
+		chunk = arena->chunks;
+	}
+
+	ptr = (char *) chunk + WAPI_ARENA_HDRSIZ + arena->used;
+	arena->used += size;
+
+	return ptr;
+}
+
+
+int
+wapi_arena_create(size_t size, wapi_arena_t **arena)
+{
+	wapi_arena_t *a;
+
+	WAPI_VALIDATE_PTR(arena);
+
+	a = malloc(sizeof(wapi_arena_t));
+	if (!a)
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
+	}
+	a->chunks = NULL;
+	a->used = 0;
+
+	if (wapi_arena_grow(a, WAPI_ARENA_ROUND(size ? size : WAPI_ARENA_SIZE)) < 0)
+	{
+		free(a);
+		return -1;
+	}
+
+	*arena = a;
+	return 0;
+}
+
+
+void
+wapi_arena_reset(wapi_arena_t *arena)
+{
+	wapi_arena_chunk_t *chunk;
+	size_t size;
+
+	if (!arena) return;
+	arena->used = 0;
+
+	if (!arena->chunks || !arena->chunks->next)
+		return;
+
+	/* Merge chunks, so that the next round fits into a single one. */
+	for (size = 0; (chunk = arena->chunks); )
+	{
+		size += chunk->size;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+
+	/* On failure, wapi_arena_alloc() retries on demand. */
+	wapi_arena_grow(arena, size);
+}
+
+
+void
+wapi_arena_destroy(wapi_arena_t *arena)
+{
+	wapi_arena_chunk_t *chunk;
+
+	if (!arena) return;
+
+	while ((chunk = arena->chunks))
+	{
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+	free(arena);
+}
+
+
+/* Tags lists set up by wapi_list_init(), so that a stale arena is not trusted. */
+#define WAPI_LIST_ARENA_TAG 0x7761706cU
+
+
+/* Returns the arena of the list, if any was attached by wapi_list_init(). */
+static wapi_arena_t *
+wapi_list_arena(const wapi_list_t *list)
+{
+	return list->tag == WAPI_LIST_ARENA_TAG ? list->arena : NULL;
+}
+
+
+void
+wapi_list_init(wapi_list_t *list, wapi_arena_t *arena)
+{
+	bzero(list, sizeof(wapi_list_t));
+	if (arena)
+	{
+		list->arena = arena;
+		list->tag = WAPI_LIST_ARENA_TAG;
+	}
+}
+
+
+void *
+wapi_list_alloc(wapi_list_t *list, size_t size)
+{
+	wapi_arena_t *arena = wapi_list_arena(list);
+	return arena ? wapi_arena_alloc(arena, size) : malloc(size);
+}
+
+
+char *
+wapi_list_strndup(wapi_list_t *list, const char *str, size_t len)
+{
+	char *dup = wapi_list_alloc(list, len + 1);
+	if (dup)
+	{
+		memcpy(dup, str, len);
+		dup[len] = '\0';
+	}
+	return dup;
+}
+
+
+void
+wapi_list_release(wapi_list_t *list, void *ptr)
+{
+	if (!wapi_list_arena(list)) free(ptr);
+}
+
+
+void
+wapi_list_free(wapi_list_t *list)
+{
+	if (!list) return;
+
+	/* Arena memory is reclaimed by its owner, the arena may be shared. */
+	if (!wapi_list_arena(list))
+		switch (list->type)
+		{
+		case WAPI_LIST_STRING:
+			while (list->head.string)
+			{
+				wapi_string_t *string = list->head.string;
+				list->head.string = string->next;
+				free(string->data);
+				free(string);
+			}
+			break;
+
+		case WAPI_LIST_SCAN:
+			while (list->head.scan)
+			{
+				wapi_scan_info_t *info = list->head.scan;
+				list->head.scan = info->next;
+				free(info);
+			}
+			break;
+
+		case WAPI_LIST_ROUTE:
+			while (list->head.route)
+			{
+				wapi_route_info_t *ri = list->head.route;
+				list->head.route = ri->next;
+				free(ri->ifname);
+				free(ri);
+			}
+			break;
+
+		case WAPI_LIST_NONE:
+			break;
+		}
+
+	list->head.string = NULL;
+	list->type = WAPI_LIST_NONE;
+}
@@ -8,9 +8,12 @@
 #define UTIL_H
 
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <libgen.h>
+#include <net/ethernet.h>
 
 
 #define WAPI_IOCTL_STRERROR(cmd)						\
@@ -44,4 +47,149 @@
 const char *wapi_ioctl_command_name(int cmd);
 
 
+/* Reads the whole (procfs) file into a per-thread buffer, which is reused by
+ * subsequent calls. "*data" is valid until the next call in the same thread. */
+int wapi_proc_read(const char *path, const char **data, size_t *len);
+
+
+/* Frees the scan results buffer of the calling thread, unless it is in use. */
+void wapi_scan_release(void);
+
+
+/* Scans an unsigned hexadecimal field after optional blanks. Returns the end of
+ * the field, or NULL if there is no digit or it is not followed by a blank. */
+const char *wapi_scan_hex(const char *p, const char *end, unsigned int *val);
+
+
+/* Scans an optionally negative decimal field, in the same fashion. */
+const char *wapi_scan_dec(const char *p, const char *end, int *val);
+
+
+/* Milliseconds of CLOCK_MONOTONIC. */
+unsigned long long wapi_monotonic_ms(void);
+
+
+/* Microseconds of CLOCK_MONOTONIC. */
+unsigned long long wapi_monotonic_us(void);
+
+
+/* Hashes a MAC address for open addressing tables. */
+static inline size_t
+wapi_mac_hash(const struct ether_addr *mac)
+{
+	uint64_t key = 0;
+	memcpy(&key, mac, sizeof(struct ether_addr));
+	return (size_t) ((key * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+
+/* Returns the home slot of the entry in slot "j" of a linear probing table, or
+ * WAPI_INDEX_NOROW if the slot is empty. */
+typedef size_t (*wapi_probe_home_cb_t)(size_t j, void *arg);
+
+
+/* Moves the entry of slot "j" into slot "i". */
+typedef void (*wapi_probe_move_cb_t)(size_t i, size_t j, void *arg);
+
+
+/* Empties slot "i" of a linear probing table of "mask" + 1 slots by shifting
+ * back the entries of its probe chain, so that lookups never need tombstones.
+ * Returns the slot to be marked empty by the caller. */
+size_t
+wapi_probe_remove(
+	size_t i,
+	size_t mask,
+	wapi_probe_home_cb_t home,
+	wapi_probe_move_cb_t move,
+	void *arg);
+
+
+/* Marks an empty slot of a row index. */
+#define WAPI_INDEX_NOROW ((size_t) -1)
+
+
+/* Returns the slot of "mac" in a row index of "size" (a power of two) slots
+ * keyed by the "keys" column, or the empty slot it would take. */
+size_t
+wapi_mac_index_find(
+	const size_t *index,
+	size_t size,
+	const struct ether_addr *keys,
+	const struct ether_addr *mac);
+
+
+/* Makes room for "n" + 1 rows in the index, keeping its load factor at or
+ * below 1/2. The first "n" rows of "keys" are indexed anew, if it grows. */
+int
+wapi_mac_index_grow(
+	size_t **index,
+	size_t *size,
+	const struct ether_addr *keys,
+	size_t n);
+
+
+/* Removes slot "i" from the row index. */
+void
+wapi_mac_index_del(
+	size_t *index,
+	size_t size,
+	const struct ether_addr *keys,
+	size_t i);
+
+
+/* A column of a struct of arrays table: offset of the column pointer within
+ * the table, and width of a single cell. */
+typedef struct wapi_column_t {
+	size_t offset;
+	size_t width;
+} wapi_column_t;
+
+
+#define WAPI_COLUMN(type, field) \
+	{ offsetof(type, field), sizeof(*((type *) 0)->field) }
+
+
+/* Expands to the column array and its length. */
+#define WAPI_COLUMNS(cols) (cols), (sizeof(cols) / sizeof(*(cols)))
+
+
+/* Moves the first "n" rows of every column from "block" into a new block of
+ * "size" rows, and releases "block". Columns are laid out in the given order,
+ * hence wider ones should come first to stay naturally aligned. Returns the new
+ * block, or NULL (leaving the table untouched) on failure. */
+char *
+wapi_columns_grow(
+	void *table,
+	const wapi_column_t *cols,
+	size_t ncols,
+	char *block,
+	size_t n,
+	size_t size);
+
+
+/* Copies row "src" over row "dst" in every column. */
+void
+wapi_columns_copy(
+	void *table,
+	const wapi_column_t *cols,
+	size_t ncols,
+	size_t dst,
+	size_t src);
+
+
+struct wapi_list_t;
+
+
+/* Allocates a list node, from the arena of the list if there is any. */
+void *wapi_list_alloc(struct wapi_list_t *list, size_t size);
+
+
+/* Copies "len" bytes of "str" into a NUL terminated string owned by the list. */
+char *wapi_list_strndup(struct wapi_list_t *list, const char *str, size_t len);
+
+
+/* Releases memory allocated by wapi_list_alloc(). No-op for arena backed lists. */
+void wapi_list_release(struct wapi_list_t *list, void *ptr);
+
+
 #endif /* UTIL_H */
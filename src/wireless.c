@@ -5,8 +5,13 @@
 
 
 #include <stdio.h>
-#include <math.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
 
 #include <linux/nl80211.h>
 #include <libnl3/netlink/genl/genl.h>
@@ -15,38 +20,59 @@
 #include <libnl3/netlink/msg.h>
 #include <libnl3/netlink/attr.h>
 
-#include <iwlib.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/wireless.h>
 
 #include "wapi.h"
 #include "util.h"
+#include "netlink.h"
+#include "context.h"
 
 
 /*-- Misc --------------------------------------------------------------------*/
 
 
+/**
+ * Issues SIOCGIWRANGE for the interface named in @a wrq. Drivers built against
+ * a different WE version might copy more than @c sizeof(struct iw_range),
+ * hence the larger buffer.
+ */
+static int
+wapi_get_range(int sock, struct iwreq *wrq, struct iw_range *range)
+{
+	char buf[sizeof(struct iw_range) * 2];
+	int ret;
+
+	/* Prepare request. */
+	bzero(buf, sizeof(buf));
+	wrq->u.data.pointer = buf;
+	wrq->u.data.length = sizeof(buf);
+	wrq->u.data.flags = 0;
+
+	/* Get range. */
+	if ((ret = ioctl(sock, SIOCGIWRANGE, wrq)) >= 0)
+		memcpy(range, buf, sizeof(struct iw_range));
+	else WAPI_IOCTL_STRERROR(SIOCGIWRANGE);
+
+	return ret;
+}
+
+
 int
 wapi_get_we_version(int sock, const char *ifname, int *we_version)
 {
 	struct iwreq wrq;
-	char buf[sizeof(struct iw_range) * 2];
+	struct iw_range range;
 	int ret;
 
 	WAPI_VALIDATE_PTR(we_version);
 
-	/* Prepare request. */
-	bzero(buf, sizeof(buf));
-	wrq.u.data.pointer = buf;
-	wrq.u.data.length = sizeof(buf);
-	wrq.u.data.flags = 0;
-
 	/* Get WE version. */
 	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
-	if ((ret = ioctl(sock, SIOCGIWRANGE, &wrq)) >= 0)
-	{
-		struct iw_range *range = (struct iw_range *) buf;
-		*we_version = (int) range->we_version_compiled;
-	}
-	else WAPI_IOCTL_STRERROR(SIOCGIWRANGE);
+	if ((ret = wapi_get_range(sock, &wrq, &range)) >= 0)
+		*we_version = (int) range.we_version_compiled;
 
 	return ret;
 }
@@ -61,13 +87,31 @@ const char *wapi_freq_flags[] = {
 };
 
 
+/* Exact powers of ten up to 10^18. */
+static const uint64_t wapi_pow10[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL
+};
+
+
 /**
  * Converts internal representation of frequencies to a floating point.
  */
 static inline double
 wapi_freq2float(const struct iw_freq *freq)
 {
-	return ((double) freq->m) * pow(10, freq->e);
+	double v = freq->m;
+	int e;
+
+	if (freq->e >= 0 && freq->e <= 18)
+		return v * wapi_pow10[freq->e];
+
+	for (e = freq->e; e > 0; e--) v *= 10;
+	for (; e < 0; e++) v /= 10;
+	return v;
 }
 
 
@@ -77,11 +121,15 @@ wapi_freq2float(const struct iw_freq *freq)
 static inline void
 wapi_float2freq(double floatfreq, struct iw_freq *freq)
 {
-	freq->e = (short) floor(log10(floatfreq));
-	if (freq->e > 8)
+	/* Frequencies above 1 GHz keep 4 significant digits after MHz, smaller
+	 * values (i.e. channels) are passed as is. */
+	if (floatfreq >= 1e9)
 	{
-		freq->m = ((long) (floor(floatfreq / pow(10,freq->e - 6)))) * 100;
-		freq->e -= 8;
+		short e;
+
+		for (e = 9; e < 18 && floatfreq >= wapi_pow10[e + 1]; e++);
+		freq->m = ((long) (floatfreq / wapi_pow10[e - 6])) * 100;
+		freq->e = e - 8;
 	}
 	else
 	{
@@ -91,6 +139,20 @@ wapi_float2freq(double floatfreq, struct iw_freq *freq)
 }
 
 
+/* Converts a frequency of a range to kHz without going through doubles. */
+static unsigned int
+wapi_iwfreq2khz(const struct iw_freq *freq)
+{
+	unsigned long long v = freq->m;
+	int e;
+
+	for (e = freq->e; e > 3; e--) v *= 10;
+	for (; e < 3; e++) v /= 10;
+
+	return (unsigned int) v;
+}
+
+
 int
 wapi_get_freq(int sock, const char *ifname, double *freq, wapi_freq_flag_t *flag)
 {
@@ -122,6 +184,63 @@ wapi_get_freq(int sock, const char *ifname, double *freq, wapi_freq_flag_t *flag
 }
 
 
+int
+wapi_get_freq_khz(
+	int sock,
+	const char *ifname,
+	unsigned int *khz,
+	wapi_freq_flag_t *flag)
+{
+	struct iwreq wrq;
+	int ret;
+
+	WAPI_VALIDATE_PTR(khz);
+	WAPI_VALIDATE_PTR(flag);
+
+	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
+	if ((ret = ioctl(sock, SIOCGIWFREQ, &wrq)) >= 0)
+	{
+		if (IW_FREQ_AUTO == (wrq.u.freq.flags & IW_FREQ_AUTO))
+			*flag = WAPI_FREQ_AUTO;
+		else if (IW_FREQ_FIXED == (wrq.u.freq.flags & IW_FREQ_FIXED))
+			*flag = WAPI_FREQ_FIXED;
+		else
+		{
+			WAPI_ERROR("Unknown flag: %d.\n", wrq.u.freq.flags);
+			return -1;
+		}
+
+		*khz = wapi_iwfreq2khz(&(wrq.u.freq));
+	}
+
+	return ret;
+}
+
+
+int
+wapi_set_freq_khz(
+	int sock,
+	const char *ifname,
+	unsigned int khz,
+	wapi_freq_flag_t flag)
+{
+	struct iwreq wrq;
+	int ret;
+
+	/* m * 10^3 Hz, exact for any frequency in kHz. */
+	wrq.u.freq.m = khz;
+	wrq.u.freq.e = 3;
+	wrq.u.freq.i = 0;
+	wrq.u.freq.flags = (flag == WAPI_FREQ_FIXED) ? IW_FREQ_FIXED : IW_FREQ_AUTO;
+
+	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
+	ret = ioctl(sock, SIOCSIWFREQ, &wrq);
+	if (ret < 0) WAPI_IOCTL_STRERROR(SIOCSIWFREQ);
+
+	return ret;
+}
+
+
 int
 wapi_set_freq(int sock, const char *ifname, double freq, wapi_freq_flag_t flag)
 {
@@ -150,42 +269,57 @@ wapi_set_freq(int sock, const char *ifname, double freq, wapi_freq_flag_t flag)
 }
 
 
+static int
+wapi_range_freq2chan(const struct iw_range *range, double freq, int *chan)
+{
+	int k;
+
+	/* Compare the frequencies as double to ignore differences in encoding.
+	 * Slower, but safer... */
+	for (k = 0; k < range->num_frequency; k++)
+		if (freq == wapi_freq2float(&(range->freq[k])))
+		{
+			*chan = range->freq[k].i;
+			return 0;
+		}
+
+	/* Oops! Nothing found. */
+	WAPI_ERROR("No channel matches for the given frequency!\n");
+	return -2;
+}
+
+
+static int
+wapi_range_chan2freq(const struct iw_range *range, int chan, double *freq)
+{
+	int k;
+
+	for (k = 0; k < range->num_frequency; k++)
+		if (chan == range->freq[k].i)
+		{
+			*freq = wapi_freq2float(&(range->freq[k]));
+			return 0;
+		}
+
+	/* Oops! Nothing found. */
+	WAPI_ERROR("No frequency matches for the given channel!\n");
+	return -2;
+}
+
+
 int
 wapi_freq2chan(int sock, const char *ifname, double freq, int *chan)
 {
 	struct iwreq wrq;
-	char buf[sizeof(struct iw_range) * 2];
+	struct iw_range range;
 	int ret;
 
 	WAPI_VALIDATE_PTR(chan);
 
-	/* Prepare request. */
-	bzero(buf, sizeof(buf));
-	wrq.u.data.pointer = buf;
-	wrq.u.data.length = sizeof(buf);
-	wrq.u.data.flags = 0;
-
 	/* Get range. */
 	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
-	if ((ret = ioctl(sock, SIOCGIWRANGE, &wrq)) >= 0)
-	{
-		struct iw_range *range = (struct iw_range *) buf;
-		int k;
-
-		/* Compare the frequencies as double to ignore differences in encoding.
-		 * Slower, but safer... */
-		for (k = 0; k < range->num_frequency; k++)
-			if (freq == wapi_freq2float(&(range->freq[k])))
-			{
-				*chan = range->freq[k].i;
-				return 0;
-			}
-
-		/* Oops! Nothing found. */
-		WAPI_ERROR("No channel matches for the given frequency!\n");
-		ret = -2;
-	}
-	else WAPI_IOCTL_STRERROR(SIOCGIWRANGE);
+	if ((ret = wapi_get_range(sock, &wrq, &range)) >= 0)
+		ret = wapi_range_freq2chan(&range, freq, chan);
 
 	return ret;
 }
@@ -195,38 +329,118 @@ int
 wapi_chan2freq(int sock, const char *ifname, int chan, double *freq)
 {
 	struct iwreq wrq;
-	char buf[sizeof(struct iw_range) * 2];
+	struct iw_range range;
 	int ret;
 
 	WAPI_VALIDATE_PTR(freq);
 
-	/* Prepare request. */
-	bzero(buf, sizeof(buf));
-	wrq.u.data.pointer = buf;
-	wrq.u.data.length = sizeof(buf);
-	wrq.u.data.flags = 0;
-
 	/* Get range. */
 	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
-	if ((ret = ioctl(sock, SIOCGIWRANGE, &wrq)) >= 0)
+	if ((ret = wapi_get_range(sock, &wrq, &range)) >= 0)
+		ret = wapi_range_chan2freq(&range, chan, freq);
+
+	return ret;
+}
+
+
+/*-- Channel Plans -----------------------------------------------------------*/
+
+
+const char *wapi_bands[] = {
+	"WAPI_BAND_2GHZ",
+	"WAPI_BAND_5GHZ",
+	"WAPI_BAND_6GHZ"
+};
+
+
+/* A run of channels "first".."last" spaced 5 MHz apart from "base" + 5 MHz. */
+typedef struct wapi_chan_run_t {
+	wapi_band_t band;
+	unsigned short first;
+	unsigned short last;
+	unsigned short base;
+} wapi_chan_run_t;
+
+
+/* Earlier runs take precedence. (e.g. 6 GHz channel 2 is 5935 MHz.) */
+static const wapi_chan_run_t wapi_chan_runs[] = {
+	{WAPI_BAND_2GHZ,   1,  13, 2407},
+	{WAPI_BAND_2GHZ,  14,  14, 2414},
+	{WAPI_BAND_5GHZ, 182, 196, 4000},
+	{WAPI_BAND_5GHZ,   1, 181, 5000},
+	{WAPI_BAND_6GHZ,   2,   2, 5925},
+	{WAPI_BAND_6GHZ,   1, 233, 5950}
+};
+
+
+#define WAPI_CHAN_RUNS (sizeof(wapi_chan_runs) / sizeof(wapi_chan_runs[0]))
+
+
+int
+wapi_freq_mhz2chan(unsigned int mhz, wapi_band_t *band, int *chan)
+{
+	size_t k;
+
+	WAPI_VALIDATE_PTR(chan);
+
+	for (k = 0; k < WAPI_CHAN_RUNS; k++)
 	{
-		struct iw_range *range = (struct iw_range *) buf;
-		int k;
+		const wapi_chan_run_t *run = &wapi_chan_runs[k];
+		unsigned int off = mhz - (run->base + 5 * run->first);
+		if (off <= 5u * (run->last - run->first) && !(off % 5))
+		{
+			if (band) *band = run->band;
+			*chan = run->first + off / 5;
+			return 0;
+		}
+	}
 
-		for (k = 0; k < range->num_frequency; k++)
-			if (chan == range->freq[k].i)
-			{
-				*freq = wapi_freq2float(&(range->freq[k]));
-				return 0;
-			}
+	return -2;
+}
 
-		/* Oops! Nothing found. */
-		WAPI_ERROR("No frequency matches for the given channel!\n");
-		ret = -2;
+
+int
+wapi_chan2freq_mhz(wapi_band_t band, int chan, unsigned int *mhz)
+{
+	size_t k;
+
+	WAPI_VALIDATE_PTR(mhz);
+
+	for (k = 0; k < WAPI_CHAN_RUNS; k++)
+	{
+		const wapi_chan_run_t *run = &wapi_chan_runs[k];
+		if (run->band == band && chan >= run->first && chan <= run->last)
+		{
+			*mhz = run->base + 5 * chan;
+			return 0;
+		}
 	}
-	else WAPI_IOCTL_STRERROR(SIOCGIWRANGE);
 
-	return ret;
+	return -2;
+}
+
+
+void
+wapi_freq_mhz2chan_bulk(const unsigned int *mhz, int *chans, size_t n)
+{
+	size_t i;
+	int k;
+
+	for (i = 0; i < n; i++)
+	{
+		int chan = 0;
+
+		/* Walk backwards, so that earlier runs overwrite. */
+		for (k = WAPI_CHAN_RUNS - 1; k >= 0; k--)
+		{
+			const wapi_chan_run_t *run = &wapi_chan_runs[k];
+			unsigned int off = mhz[i] - (run->base + 5 * run->first);
+			int hit = (off <= 5u * (run->last - run->first)) & !(off % 5);
+			chan = hit ? (int) (run->first + off / 5) : chan;
+		}
+
+		chans[i] = chan;
+	}
 }
 
 
@@ -493,17 +707,142 @@ const char *wapi_txpower_flags[] = {
 };
 
 
+/* 10^(k/10), 10^(k/100) and 10^(k/1000) for k = 0..9, rounded in Q28. Their
+ * product yields 10^(r/1000) for r = 0..999 within 2e-8 relative error. */
+#define WAPI_EXP10_SHIFT 28
+
+static const uint32_t wapi_exp10_tenths[] = {
+	268435456, 337940217, 425441527, 535599149, 674279380,
+	848867446, 1068660799, 1345364236, 1693713225, 2132258619
+};
+
+static const uint32_t wapi_exp10_hundredths[] = {
+	268435456, 274688121, 281086429, 287633773, 294333625,
+	301189535, 308205141, 315384161, 322730402, 330247758
+};
+
+static const uint32_t wapi_exp10_thousandths[] = {
+	268435456, 269054264, 269674498, 270296162, 270919259,
+	271543792, 272169765, 272797181, 273426044, 274056356
+};
+
+
+/* Computes 10^(r/1000) in Q28 for r = 0..999. */
+static inline uint64_t
+wapi_exp10_q28(int r)
+{
+	uint64_t v = wapi_exp10_tenths[r / 100];
+	v = (v * wapi_exp10_hundredths[r / 10 % 10]) >> WAPI_EXP10_SHIFT;
+	v = (v * wapi_exp10_thousandths[r % 10]) >> WAPI_EXP10_SHIFT;
+	return v;
+}
+
+
+int
+wapi_mbm2mwatt(int mbm)
+{
+	uint64_t v;
+
+	/* Below 1 mW rounds down to nothing, above INT_MAX saturates. */
+	if (mbm < 0) return 0;
+	if (mbm >= 9332) return INT_MAX;
+
+	v = wapi_exp10_q28(mbm % 1000) * wapi_pow10[mbm / 1000];
+	return (int) (v >> WAPI_EXP10_SHIFT);
+}
+
+
+/* 1000 * log10(1 + k/32) in Q8, seeds wapi_mwatt2mbm() within 0.1 mBm. */
+static const uint32_t wapi_log10_q8[] = {
+	0, 3421, 6740, 9963, 13095, 16141, 19106, 21994,
+	24809, 27554, 30233, 32850, 35405, 37904, 40348, 42739,
+	45079, 47372, 49618, 51820, 53978, 56096, 58174, 60214,
+	62218, 64186, 66119, 68020, 69888, 71726, 73534, 75313,
+	77064
+};
+
+
+/* 1000 * log10(2) in Q8. */
+#define WAPI_LOG10_2_Q8 77064
+
+
+int
+wapi_mwatt2mbm(int mwatt)
+{
+	uint64_t target;
+	uint32_t norm, frac;
+	int l2, idx, mbm;
+
+	if (mwatt <= 0) return INT_MIN;
+
+	/* Seed from log2: exponent plus an interpolated mantissa table. */
+	l2 = 31 - __builtin_clz(mwatt);
+	norm = (uint32_t) mwatt << (31 - l2);
+	idx = (norm >> 26) & 31;
+	frac = (norm >> 10) & 0xFFFF;
+	mbm = (l2 * WAPI_LOG10_2_Q8 + wapi_log10_q8[idx] +
+		   (((wapi_log10_q8[idx + 1] - wapi_log10_q8[idx]) * frac) >> 16)) >> 8;
+
+	/* Settle on the smallest mbm with 10^(mbm/1000) >= mwatt. */
+	target = (uint64_t) mwatt << WAPI_EXP10_SHIFT;
+	if (mbm > 0) mbm--;
+	while (wapi_exp10_q28(mbm % 1000) * wapi_pow10[mbm / 1000] < target)
+		mbm++;
+
+	return mbm;
+}
+
+
+/* 10^(dbm/10) rounded down for dbm = 0..93, the whole positive int range. */
+static const uint32_t wapi_dbm_mwatts[] = {
+	1, 1, 1, 1, 2, 3,
+	3, 5, 6, 7, 10, 12,
+	15, 19, 25, 31, 39, 50,
+	63, 79, 100, 125, 158, 199,
+	251, 316, 398, 501, 630, 794,
+	1000, 1258, 1584, 1995, 2511, 3162,
+	3981, 5011, 6309, 7943, 10000, 12589,
+	15848, 19952, 25118, 31622, 39810, 50118,
+	63095, 79432, 100000, 125892, 158489, 199526,
+	251188, 316227, 398107, 501187, 630957, 794328,
+	1000000, 1258925, 1584893, 1995262, 2511886, 3162277,
+	3981071, 5011872, 6309573, 7943282, 10000000, 12589254,
+	15848931, 19952623, 25118864, 31622776, 39810717, 50118723,
+	63095734, 79432823, 100000000, 125892541, 158489319, 199526231,
+	251188643, 316227766, 398107170, 501187233, 630957344, 794328234,
+	1000000000, 1258925411, 1584893192, 1995262314
+};
+
+
+#define WAPI_DBM_MAX (sizeof(wapi_dbm_mwatts) / sizeof(wapi_dbm_mwatts[0]) - 1)
+
+
 int
 wapi_dbm2mwatt(int dbm)
 {
-	return floor(pow(10, (((double) dbm) / 10)));
+	if (dbm < 0) return 0;
+	if (dbm > (int) WAPI_DBM_MAX) return INT_MAX;
+	return wapi_dbm_mwatts[dbm];
 }
 
 
 int
 wapi_mwatt2dbm(int mwatt)
 {
-	return ceil(10 * log10(mwatt));
+	int lo, hi;
+
+	if (mwatt <= 0) return INT_MIN;
+
+	/* Smallest dbm with 10^(dbm/10) >= mwatt. As mwatt is an integer, the
+	 * rounded down table compares the same. */
+	for (lo = 0, hi = WAPI_DBM_MAX + 1; lo < hi; )
+	{
+		int mid = (lo + hi) / 2;
+		if (wapi_dbm_mwatts[mid] >= (uint32_t) mwatt) hi = mid;
+		else lo = mid + 1;
+	}
+
+	return lo;
 }
 
 
@@ -583,67 +922,223 @@ wapi_set_txpower(
 }
 
 
-/*-- Event & Stream Routines -------------------------------------------------*/
+int
+wapi_get_txpower_mbm(int sock, const char *ifname, int *mbm)
+{
+	wapi_txpower_flag_t flag;
+	int power;
+	int ret;
 
+	WAPI_VALIDATE_PTR(mbm);
 
-struct iw_event_stream {
-	char *end;		/* end of the stream */
-	char *current;	/* current event in stream of events */
-	char *value;		/* current value in event */
-};
+	if ((ret = wapi_get_txpower(sock, ifname, &power, &flag)) < 0)
+		return ret;
 
+	switch (flag)
+	{
+	case WAPI_TXPOWER_DBM:
+		*mbm = 100 * power;
+		break;
+	case WAPI_TXPOWER_MWATT:
+		*mbm = wapi_mwatt2mbm(power);
+		break;
+	case WAPI_TXPOWER_RELATIVE:
+		WAPI_ERROR("Relative txpower cannot be converted to mBm!\n");
+		return -2;
+	}
 
-static void
-iw_event_stream_init(struct iw_event_stream *stream, char *data, size_t len)
-{
-	memset(stream, 0, sizeof(struct iw_event_stream));
-	stream->current = data;
-	stream->end = &data[len];
+	return 0;
 }
 
 
-static int
-iw_event_stream_pop(
-	struct iw_event_stream *stream,
-	struct iw_event *iwe,
-	int we_version)
+int
+wapi_set_txpower_mbm(int sock, const char *ifname, int mbm)
 {
-	return iw_extract_event_stream(
-		(struct stream_descr *) stream, iwe, we_version);
+	/* Wireless extensions take whole dBm, round to the nearest. */
+	int dbm = (mbm >= 0) ? (mbm + 50) / 100 : -((-mbm + 50) / 100);
+	return wapi_set_txpower(sock, ifname, dbm, WAPI_TXPOWER_DBM);
 }
 
 
-/*-- Scanning ----------------------------------------------------------------*/
-
+/*-- Event & Stream Routines -------------------------------------------------*/
 
-int
-wapi_scan_init(int sock, const char *ifname)
-{
-	struct iwreq wrq;
-	int ret;
 
-	wrq.u.data.pointer = NULL;
-	wrq.u.data.flags = 0;
-	wrq.u.data.length = 0;
+/* Header types of the decoded events. (See IW_HEADER_TYPE_* in the kernel.) */
+typedef enum {
+	WAPI_IWE_UINT,
+	WAPI_IWE_FREQ,
+	WAPI_IWE_ADDR,
+	WAPI_IWE_POINT,
+	WAPI_IWE_PARAM,
+	WAPI_IWE_QUAL
+} wapi_iwe_type_t;
+
+
+/* Stream layout of the events we care about. Anything else is skipped by its
+ * length, without looking inside. */
+static const struct {
+	uint16_t cmd;
+	uint8_t type;
+	uint8_t vlen;			/* Fixed part, without the event header. */
+	uint16_t max_tokens;	/* WAPI_IWE_POINT only, tokens are single bytes. */
+} wapi_iwe_descrs[] = {
+	{SIOCGIWAP,		WAPI_IWE_ADDR,	sizeof(struct sockaddr),	0},
+	{SIOCGIWFREQ,	WAPI_IWE_FREQ,	sizeof(struct iw_freq),		0},
+	{SIOCGIWMODE,	WAPI_IWE_UINT,	sizeof(__u32),				0},
+	{SIOCGIWESSID,	WAPI_IWE_POINT,	4,							IW_ESSID_MAX_SIZE},
+	{SIOCGIWRATE,	WAPI_IWE_PARAM,	sizeof(struct iw_param),	0},
+	{IWEVQUAL,		WAPI_IWE_QUAL,	sizeof(struct iw_quality),	0}
+};
 
-	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
-	ret = ioctl(sock, SIOCSIWSCAN, &wrq);
-	if (ret < 0) WAPI_IOCTL_STRERROR(SIOCSIWSCAN);
 
-	return ret;
-}
+/* A decoded event. Pointers refer to the stream, hence might be unaligned. */
+typedef struct wapi_iwe_t {
+	uint16_t cmd;
+	const char *value;		/* "nvalues" fixed parts of "vlen" bytes each. */
+	size_t nvalues;
+	size_t vlen;
+	uint16_t length;		/* WAPI_IWE_POINT header. */
+	uint16_t flags;
+	const char *data;		/* WAPI_IWE_POINT payload, NULL if none or bogus. */
+} wapi_iwe_t;
 
 
-int
-wapi_scan_stat(int sock, const char *ifname)
-{
-	struct iwreq wrq;
-	int ret;
-	char buf;
+typedef struct wapi_iwe_stream_t {
+	const char *current;
+	const char *end;
+	int we_version;
+} wapi_iwe_stream_t;
 
-	wrq.u.data.pointer = &buf;
-	wrq.u.data.flags = 0;
-	wrq.u.data.length = 0;
+
+/* Decodes the fixed part and the payload of an iw_point event. */
+static void
+wapi_iwe_point(
+	const wapi_iwe_stream_t *stream,
+	wapi_iwe_t *iwe,
+	const char *p,
+	size_t plen,
+	size_t max_tokens)
+{
+	/* Up to WE-18, the stream carries the user space pointer as well. */
+	size_t off = stream->we_version <= 18 ? IW_EV_POINT_OFF : 0;
+	size_t extra;
+
+	iwe->data = NULL;
+	iwe->length = iwe->flags = 0;
+	if (plen < off + 4) return;
+	memcpy(&iwe->length, p + off, 2);
+	memcpy(&iwe->flags, p + off + 2, 2);
+	extra = plen - off - 4;
+
+	/* Native 64-bit readers get the header padded by 4 bytes on both sides,
+	 * placing the payload at IW_EV_POINT_LEN. Compat (32-bit) readers get it
+	 * packed. */
+	if (!off && iwe->length != extra && extra >= 8)
+	{
+		uint16_t alt;
+		memcpy(&alt, p + 4, 2);
+		if ((size_t) alt + 8 == extra)
+		{
+			memcpy(&iwe->length, p + 4, 2);
+			memcpy(&iwe->flags, p + 6, 2);
+			extra -= 8;
+		}
+	}
+
+	/* Discard events advertising more tokens than they carry or we allow. */
+	if (extra && iwe->length <= extra && iwe->length <= max_tokens)
+		iwe->data = p + plen - extra;
+}
+
+
+/* Pops the next known event. Returns 1 on success, 0 at the end of the stream,
+ * or -1, if the stream is truncated. */
+static int
+wapi_iwe_next(wapi_iwe_stream_t *stream, wapi_iwe_t *iwe)
+{
+	while (stream->end - stream->current >= IW_EV_LCP_PK_LEN)
+	{
+		const char *p = stream->current + IW_EV_LCP_PK_LEN;
+		uint16_t len;
+		size_t plen;
+		size_t k;
+
+		memcpy(&len, stream->current, 2);
+		memcpy(&iwe->cmd, stream->current + 2, 2);
+		if (len <= IW_EV_LCP_PK_LEN || len > stream->end - stream->current)
+			return -1;
+		stream->current += len;
+		plen = len - IW_EV_LCP_PK_LEN;
+
+		for (k = 0; k < sizeof(wapi_iwe_descrs) / sizeof(wapi_iwe_descrs[0]); k++)
+			if (wapi_iwe_descrs[k].cmd == iwe->cmd)
+				break;
+		if (k == sizeof(wapi_iwe_descrs) / sizeof(wapi_iwe_descrs[0]))
+			continue;
+
+		if (wapi_iwe_descrs[k].type == WAPI_IWE_POINT)
+		{
+			wapi_iwe_point(stream, iwe, p, plen, wapi_iwe_descrs[k].max_tokens);
+			iwe->value = NULL;
+			iwe->nvalues = 0;
+			return 1;
+		}
+
+		/* Native 64-bit readers get the header padded by 4 bytes, compat
+		 * (32-bit) ones get it packed. */
+		iwe->vlen = wapi_iwe_descrs[k].vlen;
+		if (plen % iwe->vlen == 4 ||
+			(len == 12 && (wapi_iwe_descrs[k].type == WAPI_IWE_UINT ||
+						   wapi_iwe_descrs[k].type == WAPI_IWE_QUAL)))
+		{
+			p += 4;
+			plen -= 4;
+		}
+
+		/* Events might carry multiple values. (e.g. bitrates) */
+		if (!(iwe->nvalues = plen / iwe->vlen))
+			continue;
+		iwe->value = p;
+		iwe->length = iwe->flags = 0;
+		iwe->data = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*-- Scanning ----------------------------------------------------------------*/
+
+
+int
+wapi_scan_init(int sock, const char *ifname)
+{
+	struct iwreq wrq;
+	int ret;
+
+	wrq.u.data.pointer = NULL;
+	wrq.u.data.flags = 0;
+	wrq.u.data.length = 0;
+
+	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
+	ret = ioctl(sock, SIOCSIWSCAN, &wrq);
+	if (ret < 0) WAPI_IOCTL_STRERROR(SIOCSIWSCAN);
+
+	return ret;
+}
+
+
+int
+wapi_scan_stat(int sock, const char *ifname)
+{
+	struct iwreq wrq;
+	int ret;
+	char buf;
+
+	wrq.u.data.pointer = &buf;
+	wrq.u.data.flags = 0;
+	wrq.u.data.length = 0;
 
 	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
 	if ((ret = ioctl(sock, SIOCGIWSCAN, &wrq)) < 0)
@@ -663,158 +1158,306 @@ wapi_scan_stat(int sock, const char *ifname)
 }
 
 
-static int
-wapi_scan_event(struct iw_event *event, wapi_list_t *list)
+/* Applies a decoded event to the BSS entry being built. */
+static void
+wapi_scan_event(const wapi_iwe_t *iwe, wapi_scan_info_t *info)
 {
-	wapi_scan_info_t *info;
-
-	/* Get current "wapi_info_t". */
-	info = list->head.scan;
+	size_t k;
 
-	/* Decode the event. */
-	switch (event->cmd)
+	switch (iwe->cmd)
 	{
-	case SIOCGIWAP:
-	{
-		wapi_scan_info_t *temp;
-
-		/* Allocate a new cell. */
-		temp = malloc(sizeof(wapi_scan_info_t));
-		if (!temp)
-		{
-			WAPI_STRERROR("malloc()");
-			return -1;
-		}
-
-		/* Reset it. */
-		bzero(temp, sizeof(wapi_scan_info_t));
-
-		/* Save cell identifier. */
-		memcpy(&temp->ap, &event->u.ap_addr.sa_data, sizeof(struct ether_addr));
-
-		/* Push it to the head of the list. */
-		temp->next = info;
-		list->head.scan = temp;
-		
-		break;
-	}
-
 	case SIOCGIWFREQ:
+	{
+		struct iw_freq freq;
+		memcpy(&freq, iwe->value, sizeof(freq));
 		info->has_freq = 1;
-		info->freq = wapi_freq2float(&(event->u.freq));
+		info->freq = wapi_freq2float(&freq);
 		break;
+	}
 
 	case SIOCGIWMODE:
 	{
-		int ret = wapi_parse_mode(event->u.mode, &info->mode);
-		if (ret >= 0)
-		{
-			info->has_mode = 1;
-			break;
-		}
-		else return ret;
+		__u32 mode;
+		memcpy(&mode, iwe->value, sizeof(mode));
+		info->has_mode = wapi_parse_mode(mode, &info->mode) >= 0;
+		break;
 	}
 
 	case SIOCGIWESSID:
 		info->has_essid = 1;
-		info->essid_flag = (event->u.data.flags) ? WAPI_ESSID_ON : WAPI_ESSID_OFF;
+		info->essid_flag = iwe->flags ? WAPI_ESSID_ON : WAPI_ESSID_OFF;
 		memset(info->essid, 0, (WAPI_ESSID_MAX_SIZE + 1));
-		if ((event->u.essid.pointer) && (event->u.essid.length))
-			memcpy(info->essid, event->u.essid.pointer, event->u.essid.length);
+		if (iwe->data)
+			memcpy(info->essid, iwe->data, iwe->length);
 		break;
 
 	case SIOCGIWRATE:
 		/* Scan may return a list of bitrates. As we have space for only a
 		 * single bitrate, we only keep the largest one. */
-		if (!info->has_bitrate || event->u.bitrate.value > info->bitrate)
+		for (k = 0; k < iwe->nvalues; k++)
 		{
-			info->has_bitrate = 1;
-			info->bitrate = event->u.bitrate.value;
+			struct iw_param rate;
+			memcpy(&rate, iwe->value + k * iwe->vlen, sizeof(rate));
+			if (!info->has_bitrate || rate.value > info->bitrate)
+			{
+				info->has_bitrate = 1;
+				info->bitrate = rate.value;
+			}
 		}
 		break;
-	}
 
-	return 0;
+	case IWEVQUAL:
+	{
+		struct iw_quality qual;
+		memcpy(&qual, iwe->value, sizeof(qual));
+		/* Levels are in dBm, offset by 0x100 when negative. */
+		if ((qual.updated & IW_QUAL_DBM) &&
+			!(qual.updated & IW_QUAL_LEVEL_INVALID))
+		{
+			info->has_signal = 1;
+			info->signal = qual.level >= 64 ? qual.level - 0x100 : qual.level;
+		}
+		break;
+	}
+	}
 }
 
 
 int
-wapi_scan_coll(int sock, const char *ifname, wapi_list_t *aps)
+wapi_scan_decode(
+	const void *buf,
+	size_t len,
+	int we_version,
+	wapi_scan_visit_cb_t cb,
+	void *arg)
 {
-	char *buf;
-	int buflen;
-	struct iwreq wrq;
-	int we_version;
+	wapi_iwe_stream_t stream;
+	wapi_scan_info_t info;
+	wapi_iwe_t iwe;
+	int has_info = 0;
 	int ret;
 
-	WAPI_VALIDATE_PTR(aps);
-
-	/* Get WE version. (Required for event extraction via libiw.) */
-	if ((ret = wapi_get_we_version(sock, ifname, &we_version)) < 0)
-		return ret;
+	stream.current = buf;
+	stream.end = (const char *) buf + len;
+	stream.we_version = we_version;
 
-	buflen = IW_SCAN_MAX_DATA;
-	buf = malloc(buflen * sizeof(char));
-	if (!buf)
+	while ((ret = wapi_iwe_next(&stream, &iwe)) > 0)
 	{
-		WAPI_STRERROR("malloc()");
-		return -1;
+		if (iwe.cmd == SIOCGIWAP)
+		{
+			/* Flush the previous cell and start a new one. */
+			if (has_info && (ret = cb(&info, arg)) < 0)
+				return ret;
+			bzero(&info, sizeof(wapi_scan_info_t));
+			memcpy(
+				&info.ap, iwe.value + offsetof(struct sockaddr, sa_data),
+				sizeof(struct ether_addr));
+			has_info = 1;
+		}
+		else if (has_info)
+			wapi_scan_event(&iwe, &info);
 	}
 
-alloc:
-	/* Collect results. */
-	wrq.u.data.pointer = buf;
-	wrq.u.data.length = buflen;
-	wrq.u.data.flags = 0;
-	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
-	if ((ret = ioctl(sock, SIOCGIWSCAN, &wrq)) < 0 && errno == E2BIG)
+	if (ret < 0)
+		WAPI_ERROR("Truncated scan event stream!\n");
+	else if (has_info)
+		ret = cb(&info, arg);
+
+	return ret < 0 ? ret : 0;
+}
+
+
+/* Scan results buffer, kept at the largest size needed so far. */
+typedef struct wapi_scan_buf_t {
+	char *data;
+	size_t size;
+	int busy;		/* Being walked, visitors must not refill it. */
+} wapi_scan_buf_t;
+
+
+/* Buffer of the plain (handle-less) scan collectors. */
+static __thread wapi_scan_buf_t wapi_scan_tbuf;
+
+
+/* Fetches scan results into "buf" and feeds them to "cb". */
+static int
+wapi_scan_walk_we(
+	int sock,
+	struct iwreq *wrq,
+	int we_version,
+	wapi_scan_buf_t *buf,
+	wapi_scan_visit_cb_t cb,
+	void *arg)
+{
+	size_t size = buf->size ? buf->size : IW_SCAN_MAX_DATA;
+
+	for (;;)
 	{
-		char *tmp;
+		if (size > buf->size)
+		{
+			/* Contents are refetched anyway, no need to realloc(). */
+			char *data = malloc(size);
+			if (!data)
+			{
+				WAPI_STRERROR("malloc()");
+				return -1;
+			}
+			free(buf->data);
+			buf->data = data;
+			buf->size = size;
+		}
+
+		/* Collect results. */
+		wrq->u.data.pointer = buf->data;
+		wrq->u.data.length = buf->size;
+		wrq->u.data.flags = 0;
+		if (ioctl(sock, SIOCGIWSCAN, wrq) >= 0)
+			break;
 
-		buflen *= 2;
-		tmp = realloc(buf, buflen);
-		if (!tmp)
+		/* It's either EAGAIN or some other ioctl() failure. We don't bother,
+		 * let the user deal with it. Lengths are 16 bits, so there is no
+		 * point in growing beyond that either. */
+		if (errno != E2BIG || buf->size >= 0xFFFF)
 		{
-			WAPI_STRERROR("realloc()");
-			free(buf);
+			WAPI_IOCTL_STRERROR(SIOCGIWSCAN);
 			return -1;
 		}
 
-		buf = tmp;
-		goto alloc;
+		/* WE-17 and later report the required length. Older ones don't. */
+		size = wrq->u.data.length > buf->size
+			? wrq->u.data.length : 2 * buf->size;
+		if (size > 0xFFFF) size = 0xFFFF;
 	}
 
-	/* There is still something wrong. It's either EAGAIN or some other ioctl()
-	 * failure. We don't bother, let the user deal with it. */
-	if (ret < 0)
+	/* We have the results, process them. */
+	return wapi_scan_decode(
+		buf->data, wrq->u.data.length, we_version, cb, arg);
+}
+
+
+/**
+ * Fetches scan results of the interface named in @a wrq into @a buf, decoding
+ * events with the given WE version. Once @a buf has grown to the size of the
+ * result set, every later call costs a single ioctl(). A visitor that scans
+ * again gets a temporary buffer, since @a buf is still being walked.
+ */
+static int
+wapi_scan_visit_we(
+	int sock,
+	struct iwreq *wrq,
+	int we_version,
+	wapi_scan_buf_t *buf,
+	wapi_scan_visit_cb_t cb,
+	void *arg)
+{
+	wapi_scan_buf_t tmp;
+	int ret;
+
+	if (buf->busy)
 	{
-		WAPI_IOCTL_STRERROR(SIOCGIWSCAN);
-		free(buf);
+		bzero(&tmp, sizeof(wapi_scan_buf_t));
+		ret = wapi_scan_walk_we(sock, wrq, we_version, &tmp, cb, arg);
+		free(tmp.data);
 		return ret;
 	}
 
-	/* We have the results, process them. */
-	if (wrq.u.data.length)
-	{
-		struct iw_event iwe;
-		struct iw_event_stream stream;
+	buf->busy = 1;
+	ret = wapi_scan_walk_we(sock, wrq, we_version, buf, cb, arg);
+	buf->busy = 0;
+	return ret;
+}
 
-		iw_event_stream_init(&stream, buf, wrq.u.data.length);
-		do {
-			if ((ret = iw_event_stream_pop(&stream, &iwe, we_version)) >= 0)
-			{
-				int eventret = wapi_scan_event(&iwe, aps);
-				if (eventret < 0)
-					ret = eventret;
-			}
-			else WAPI_ERROR("iw_event_stream_pop() failed!\n");
-		} while (ret > 0);
+
+/* Pushes a copy of the visited cell to the head of the list. */
+static int
+wapi_scan_coll_cb(const wapi_scan_info_t *info, void *arg)
+{
+	wapi_list_t *list = arg;
+	wapi_scan_info_t *temp;
+
+	temp = wapi_list_alloc(list, sizeof(wapi_scan_info_t));
+	if (!temp)
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
 	}
 
-	/* Free request buffer. */
-	free(buf);
+	*temp = *info;
+	temp->next = list->head.scan;
+	list->head.scan = temp;
 
-	return ret;
+	return 0;
+}
+
+
+/**
+ * Collects scan results of the interface named in @a wrq, decoding events with
+ * the given WE version.
+ */
+static int
+wapi_scan_coll_we(
+	int sock,
+	struct iwreq *wrq,
+	int we_version,
+	wapi_scan_buf_t *buf,
+	wapi_list_t *aps)
+{
+	aps->type = WAPI_LIST_SCAN;
+	return wapi_scan_visit_we(
+		sock, wrq, we_version, buf, wapi_scan_coll_cb, aps);
+}
+
+
+int
+wapi_scan_visit(
+	int sock,
+	const char *ifname,
+	wapi_scan_visit_cb_t cb,
+	void *arg)
+{
+	struct iwreq wrq;
+	int we_version;
+	int ret;
+
+	WAPI_VALIDATE_PTR(cb);
+
+	/* Get WE version. (Required for event stream decoding.) */
+	if ((ret = wapi_get_we_version(sock, ifname, &we_version)) < 0)
+		return ret;
+
+	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
+	return wapi_scan_visit_we(
+		sock, &wrq, we_version, &wapi_scan_tbuf, cb, arg);
+}
+
+
+int
+wapi_scan_coll(int sock, const char *ifname, wapi_list_t *aps)
+{
+	struct iwreq wrq;
+	int we_version;
+	int ret;
+
+	WAPI_VALIDATE_PTR(aps);
+
+	/* Get WE version. (Required for event stream decoding.) */
+	if ((ret = wapi_get_we_version(sock, ifname, &we_version)) < 0)
+		return ret;
+
+	strncpy(wrq.ifr_name, ifname, IFNAMSIZ);
+	return wapi_scan_coll_we(sock, &wrq, we_version, &wapi_scan_tbuf, aps);
+}
+
+
+void
+wapi_scan_release(void)
+{
+	/* Called from a visitor, the buffer is still in use. */
+	if (!wapi_scan_tbuf.busy)
+	{
+		free(wapi_scan_tbuf.data);
+		bzero(&wapi_scan_tbuf, sizeof(wapi_scan_buf_t));
+	}
 }
 
 
@@ -839,6 +1482,7 @@ typedef struct wapi_nl80211_ifdel_ctx_t {
 
 typedef struct wapi_nl80211_ctx_t {
 	const char *ifname;
+	int ifindex;			/* Resolved from "ifname", if zero. */
 	wapi_nl80211_cmd_t cmd;
 	union {
 		wapi_nl80211_ifadd_ctx_t ifadd;
@@ -914,14 +1558,11 @@ nl80211_ack_handler(struct nl_msg *msg, void *arg)
 }
 
 
+/* Connects a generic netlink socket and resolves the nl80211 family on it. */
 static int
-nl80211_cmd_handler(const wapi_nl80211_ctx_t *ctx)
+nl80211_connect(struct nl_sock **sockp, int *family)
 {
 	struct nl_sock *sock;
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	int family;
-	int ifidx;
 	int ret;
 
 	/* Allocate netlink socket. */
@@ -932,105 +1573,201 @@ nl80211_cmd_handler(const wapi_nl80211_ctx_t *ctx)
 		return -ENOMEM;
 	}
 
-	/* Reset "msg" and "cb". */
-	msg = NULL;
-	cb = NULL;
-
 	/* Connect to generic netlink socket on kernel side. */
 	if (genl_connect(sock))
 	{
 		WAPI_ERROR("Failed to connect to generic netlink!\n");
-		ret = -ENOLINK;
-		goto exit;
+		nl_socket_free(sock);
+		return -ENOLINK;
 	}
 
 	/* Ask kernel to resolve family name to family id. */
-	ret = family = genl_ctrl_resolve(sock, "nl80211");
+	ret = genl_ctrl_resolve(sock, "nl80211");
 	if (ret < 0)
 	{
 		WAPI_ERROR("genl_ctrl_resolve() failed!\n");
-		goto exit;
-	}
-
-	/* Map given network interface name (ifname) to its corresponding index. */
-	ifidx = if_nametoindex(ctx->ifname);
-	if (!ifidx)
-	{
-		WAPI_STRERROR("if_nametoindex(\"%s\")", ctx->ifname);
-		ret = -errno;
-		goto exit;
-	}
-
-	/* Construct a generic netlink by allocating a new message. */
-	msg = nlmsg_alloc();
-	if (!msg)
-	{
-		WAPI_ERROR("nlmsg_alloc() failed!\n");
-		ret = -ENOMEM;
-		goto exit;
+		nl_socket_free(sock);
+		return ret;
 	}
 
-	/* Append the requested command to the message. */
-	switch (ctx->cmd)
-	{
-	case WAPI_NL80211_CMD_IFADD:
-	{
-		enum nl80211_iftype iftype;
-
-		genlmsg_put(
-			msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, 0,
-			NL80211_CMD_NEW_INTERFACE, 0);
-		NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifidx);
+	*sockp = sock;
+	*family = ret;
+	return 0;
+}
 
-		/* Get NL80211_IFTYPE_* for the given WAPI mode. */
-		ret = wapi_mode_to_iftype(ctx->u.ifadd.mode, &iftype);
-		if (ret < 0) goto exit;
 
-		NLA_PUT_STRING(msg, NL80211_ATTR_IFNAME, ctx->u.ifadd.name);
-		NLA_PUT_U32(msg, NL80211_ATTR_IFTYPE, iftype);
+/* Discards replies left over from an interrupted exchange, so that the next
+ * request on a reused socket does not trip over them. Dump parts are produced
+ * as they are read, hence the rest of a dump goes as well. */
+static void
+nl80211_drain(struct nl_sock *sock)
+{
+	wapi_netlink_drain(nl_socket_get_fd(sock));
+}
 
-		break;
-	}
 
-	case WAPI_NL80211_CMD_IFDEL:
-		genlmsg_put(
-			msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, 0,
-			NL80211_CMD_DEL_INTERFACE, 0);
-		NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifidx);
-		break;
-	}
+/* Sends "msg" and consumes replies until an ack, NLMSG_DONE or an error. Data
+ * messages are fed to "valid", if given. */
+static int
+nl80211_exec(
+	struct nl_sock *sock,
+	struct nl_msg *msg,
+	nl_recvmsg_msg_cb_t valid,
+	void *arg)
+{
+	struct nl_cb *cb;
+	int ret;
 
 	/* Finalize (send) the message. */
 	ret = nl_send_auto_complete(sock, msg);
 	if (ret < 0)
 	{
 		WAPI_ERROR("nl_send_auto_complete() failed!\n");
-		goto exit;
+		return ret;
 	}
 
 	/* Allocate a new callback handle. */
-	cb = nl_cb_alloc(NL_CB_VERBOSE);
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
 	if (!cb)
 	{
 		WAPI_ERROR("nl_cb_alloc() failed\n");
-		ret = -1;
-		goto exit;
+		return -1;
 	}
 
 	/* Configure callback handlers. */
+	if (valid) nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, valid, arg);
 	nl_cb_err(cb, NL_CB_CUSTOM, nl80211_err_handler, &ret);
 	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, nl80211_fin_handler, &ret);
 	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, nl80211_ack_handler, &ret);
 
-	/* Consume netlink replies. */
-	for (ret = 1; ret > 0; ) nl_recvmsgs(sock, cb);
-	if (ret) WAPI_ERROR("nl_recvmsgs() failed!\n");
+	/* Consume netlink replies. Errors reported by the kernel (e.g. -EBUSY)
+	 * are left to the caller, only transport failures are logged. */
+	for (ret = 1; ret > 0; )
+		if (nl_recvmsgs(sock, cb) < 0 && ret > 0)
+		{
+			WAPI_ERROR("nl_recvmsgs() failed!\n");
+			nl80211_drain(sock);
+			ret = -1;
+		}
+
+	nl_cb_put(cb);
+	return ret;
+}
+
+
+int
+wapi_ctx_nl80211(wapi_ctx_t *ctx)
+{
+	struct nl_sock *sock;
+	int ret;
+
+	if (ctx->genl)
+		return 0;
+
+	if ((ret = nl80211_connect(&sock, &ctx->nl80211)) < 0)
+		return ret;
+	ctx->genl = sock;
+
+	return 0;
+}
+
+
+void
+wapi_ctx_nl80211_close(wapi_ctx_t *ctx)
+{
+	nl_socket_free(ctx->genl);
+	ctx->genl = NULL;
+	ctx->nl80211 = -1;
+}
+
+
+/* Runs "fn" with the nl80211 socket of the context, or with a temporary one if
+ * no context is given. */
+static int
+nl80211_with(
+	wapi_ctx_t *wctx,
+	int (*fn)(struct nl_sock *sock, int family, void *arg),
+	void *arg)
+{
+	struct nl_sock *sock;
+	int family;
+	int ret;
+
+	if (wctx)
+	{
+		if ((ret = wapi_ctx_nl80211(wctx)) < 0)
+			return ret;
+		return fn(wctx->genl, wctx->nl80211, arg);
+	}
+
+	if ((ret = nl80211_connect(&sock, &family)) < 0)
+		return ret;
+	ret = fn(sock, family, arg);
+	nl_socket_free(sock);
+
+	return ret;
+}
+
+
+static int
+nl80211_cmd_handler(struct nl_sock *sock, int family, void *arg)
+{
+	const wapi_nl80211_ctx_t *ctx = arg;
+	struct nl_msg *msg;
+	int ifidx;
+	int ret;
+
+	/* Map given network interface name (ifname) to its corresponding index. */
+	ifidx = ctx->ifindex ? ctx->ifindex : (int) if_nametoindex(ctx->ifname);
+	if (!ifidx)
+	{
+		WAPI_STRERROR("if_nametoindex(\"%s\")", ctx->ifname);
+		return -errno;
+	}
+
+	/* Construct a generic netlink by allocating a new message. */
+	msg = nlmsg_alloc();
+	if (!msg)
+	{
+		WAPI_ERROR("nlmsg_alloc() failed!\n");
+		return -ENOMEM;
+	}
+
+	/* Append the requested command to the message. */
+	switch (ctx->cmd)
+	{
+	case WAPI_NL80211_CMD_IFADD:
+	{
+		enum nl80211_iftype iftype;
+
+		genlmsg_put(
+			msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, 0,
+			NL80211_CMD_NEW_INTERFACE, 0);
+		NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifidx);
+
+		/* Get NL80211_IFTYPE_* for the given WAPI mode. */
+		ret = wapi_mode_to_iftype(ctx->u.ifadd.mode, &iftype);
+		if (ret < 0) goto exit;
+
+		NLA_PUT_STRING(msg, NL80211_ATTR_IFNAME, ctx->u.ifadd.name);
+		NLA_PUT_U32(msg, NL80211_ATTR_IFTYPE, iftype);
+
+		break;
+	}
+
+	case WAPI_NL80211_CMD_IFDEL:
+		genlmsg_put(
+			msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, 0,
+			NL80211_CMD_DEL_INTERFACE, 0);
+		NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifidx);
+		break;
+	}
+
+	ret = nl80211_exec(sock, msg, NULL, NULL);
 
 exit:
 	/* Release resources and exit with "ret". */
-	nl_socket_free(sock);
-	if (msg) nlmsg_free(msg);
-	if (cb) free(cb);
+	nlmsg_free(msg);
 	return ret;
 
 nla_put_failure:
@@ -1042,21 +1779,2353 @@ nla_put_failure:
 
 int
 wapi_if_add(int sock, const char *ifname, const char *name, wapi_mode_t mode)
+{
+	return wapi_ctx_if_add(NULL, ifname, name, mode);
+}
+
+
+int
+wapi_if_del(int sock, const char *ifname)
+{
+	return wapi_ctx_if_del(NULL, ifname);
+}
+
+
+int
+wapi_ctx_if_add(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	const char *name,
+	wapi_mode_t mode)
 {
 	wapi_nl80211_ctx_t ctx;
 	ctx.ifname = ifname;
+	ctx.ifindex = 0;
 	ctx.cmd = WAPI_NL80211_CMD_IFADD;
 	ctx.u.ifadd.name = name;
 	ctx.u.ifadd.mode = mode;
-	return nl80211_cmd_handler(&ctx);
+	return nl80211_with(wctx, nl80211_cmd_handler, &ctx);
 }
 
 
 int
-wapi_if_del(int sock, const char *ifname)
+wapi_ctx_if_del(wapi_ctx_t *wctx, const char *ifname)
 {
 	wapi_nl80211_ctx_t ctx;
 	ctx.ifname = ifname;
+	ctx.ifindex = 0;
+	ctx.cmd = WAPI_NL80211_CMD_IFDEL;
+	return nl80211_with(wctx, nl80211_cmd_handler, &ctx);
+}
+
+
+/*-- Wireless Interface Table ------------------------------------------------*/
+
+
+typedef struct wapi_wif_table_ctx_t {
+	wapi_wif_table_t *table;
+	size_t size;
+	int ret;
+} wapi_wif_table_ctx_t;
+
+
+static int
+wapi_wif_table_cb(struct nl_msg *msg, void *arg)
+{
+	wapi_wif_table_ctx_t *ctx = arg;
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	wapi_wif_info_t *info;
+
+	/* Keep draining the dump after a failure. */
+	if (ctx->ret < 0)
+		return NL_SKIP;
+
+	nla_parse(
+		tb, NL80211_ATTR_MAX,
+		genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
+
+	/* Skip wdevs without a netdev. (e.g. P2P device) */
+	if (!tb[NL80211_ATTR_IFINDEX] || !tb[NL80211_ATTR_IFNAME])
+		return NL_SKIP;
+
+	/* Grow the table geometrically. */
+	if (ctx->table->nifs == ctx->size)
+	{
+		size_t size = ctx->size ? 2 * ctx->size : 8;
+		wapi_wif_info_t *ifs;
+
+		ifs = realloc(ctx->table->ifs, size * sizeof(wapi_wif_info_t));
+		if (!ifs)
+		{
+			WAPI_STRERROR("realloc()");
+			ctx->ret = -ENOMEM;
+			return NL_SKIP;
+		}
+		ctx->table->ifs = ifs;
+		ctx->size = size;
+	}
+
+	info = &ctx->table->ifs[ctx->table->nifs++];
+	bzero(info, sizeof(wapi_wif_info_t));
+	info->ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	snprintf(
+		info->ifname, sizeof(info->ifname), "%s",
+		nla_get_string(tb[NL80211_ATTR_IFNAME]));
+	if (tb[NL80211_ATTR_WIPHY])
+		info->wiphy = nla_get_u32(tb[NL80211_ATTR_WIPHY]);
+	if (tb[NL80211_ATTR_IFTYPE])
+		info->iftype = nla_get_u32(tb[NL80211_ATTR_IFTYPE]);
+	if (tb[NL80211_ATTR_MAC] && nla_len(tb[NL80211_ATTR_MAC]) >= ETH_ALEN)
+	{
+		memcpy(&info->mac, nla_data(tb[NL80211_ATTR_MAC]), ETH_ALEN);
+		info->has_mac = 1;
+	}
+
+	return NL_SKIP;
+}
+
+
+static int
+wapi_wif_table_dump(struct nl_sock *sock, int family, void *arg)
+{
+	wapi_wif_table_ctx_t *ctx = arg;
+	struct nl_msg *msg;
+	int ret;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+	{
+		WAPI_ERROR("nlmsg_alloc() failed!\n");
+		return -ENOMEM;
+	}
+
+	/* A single dump request for every interface of every wiphy. */
+	genlmsg_put(
+		msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, NLM_F_DUMP,
+		NL80211_CMD_GET_INTERFACE, 0);
+
+	ret = nl80211_exec(sock, msg, wapi_wif_table_cb, ctx);
+	nlmsg_free(msg);
+
+	return ret < 0 ? ret : ctx->ret;
+}
+
+
+int
+wapi_get_wif_table(wapi_wif_table_t *table)
+{
+	return wapi_ctx_get_wif_table(NULL, table);
+}
+
+
+int
+wapi_ctx_get_wif_table(wapi_ctx_t *wctx, wapi_wif_table_t *table)
+{
+	wapi_wif_table_ctx_t ctx;
+	int ret;
+
+	WAPI_VALIDATE_PTR(table);
+
+	bzero(table, sizeof(wapi_wif_table_t));
+	ctx.table = table;
+	ctx.size = 0;
+	ctx.ret = 0;
+
+	ret = nl80211_with(wctx, wapi_wif_table_dump, &ctx);
+	if (ret < 0) wapi_free_wif_table(table);
+
+	return ret;
+}
+
+
+void
+wapi_free_wif_table(wapi_wif_table_t *table)
+{
+	if (!table) return;
+	free(table->ifs);
+	bzero(table, sizeof(wapi_wif_table_t));
+}
+
+
+/*-- Scan Events -------------------------------------------------------------*/
+
+
+const char *wapi_scan_events[] = {
+	"WAPI_SCAN_EVENT_TRIGGER",
+	"WAPI_SCAN_EVENT_DONE",
+	"WAPI_SCAN_EVENT_ABORTED",
+	"WAPI_SCAN_EVENT_OVERRUN"
+};
+
+
+struct wapi_scan_mon_t {
+	struct nl_sock *sock;
+	int family;
+	wapi_scan_mon_cb_t cb;
+	void *arg;
+	int wait_ifindex;		/* Interface awaited by wapi_scan_mon_wait(). */
+	int wait_ret;
+};
+
+
+typedef struct wapi_genl_grp_ctx_t {
+	const char *name;
+	int id;
+} wapi_genl_grp_ctx_t;
+
+
+static int
+wapi_genl_grp_cb(struct nl_msg *msg, void *arg)
+{
+	wapi_genl_grp_ctx_t *ctx = arg;
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[CTRL_ATTR_MAX + 1];
+	struct nlattr *grp;
+	int rem;
+
+	nla_parse(
+		tb, CTRL_ATTR_MAX,
+		genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
+	if (!tb[CTRL_ATTR_MCAST_GROUPS])
+		return NL_SKIP;
+
+	nla_for_each_nested(grp, tb[CTRL_ATTR_MCAST_GROUPS], rem)
+	{
+		struct nlattr *gb[CTRL_ATTR_MCAST_GRP_MAX + 1];
+
+		nla_parse(
+			gb, CTRL_ATTR_MCAST_GRP_MAX, nla_data(grp), nla_len(grp), NULL);
+		if (gb[CTRL_ATTR_MCAST_GRP_NAME] && gb[CTRL_ATTR_MCAST_GRP_ID] &&
+			!strcmp(nla_get_string(gb[CTRL_ATTR_MCAST_GRP_NAME]), ctx->name))
+			ctx->id = nla_get_u32(gb[CTRL_ATTR_MCAST_GRP_ID]);
+	}
+
+	return NL_SKIP;
+}
+
+
+/* Resolves an nl80211 multicast group. (genl_ctrl_resolve_grp() is missing in
+ * libnl 1.x, hence the manual CTRL_CMD_GETFAMILY.) */
+static int
+nl80211_resolve_grp(struct nl_sock *sock, const char *name)
+{
+	wapi_genl_grp_ctx_t ctx;
+	struct nl_msg *msg;
+	int ret;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+	{
+		WAPI_ERROR("nlmsg_alloc() failed!\n");
+		return -ENOMEM;
+	}
+
+	genlmsg_put(
+		msg, NL_AUTO_PID, NL_AUTO_SEQ, GENL_ID_CTRL, 0, 0,
+		CTRL_CMD_GETFAMILY, 1);
+	nla_put_string(msg, CTRL_ATTR_FAMILY_NAME, "nl80211");
+
+	ctx.name = name;
+	ctx.id = -ENOENT;
+	ret = nl80211_exec(sock, msg, wapi_genl_grp_cb, &ctx);
+	nlmsg_free(msg);
+
+	if (ret < 0) return ret;
+	if (ctx.id < 0) WAPI_ERROR("No nl80211 multicast group: %s!\n", name);
+	return ctx.id;
+}
+
+
+/* Opens a socket joined to the given nl80211 multicast group. Notifications
+ * are read straight from the socket, libnl sequence checks never get in the
+ * way. */
+static int
+nl80211_subscribe(const char *name, struct nl_sock **sockp, int *family)
+{
+	struct nl_sock *sock;
+	int grp;
+	int ret;
+
+	if ((ret = nl80211_connect(&sock, family)) < 0)
+		return ret;
+
+	if ((ret = grp = nl80211_resolve_grp(sock, name)) < 0 ||
+		(ret = nl_socket_add_membership(sock, grp)) < 0)
+	{
+		if (ret != -ENOENT)
+			WAPI_ERROR("Failed to join nl80211 %s group!\n", name);
+		nl_socket_free(sock);
+		return ret;
+	}
+
+	*sockp = sock;
+	return 0;
+}
+
+
+/* Decodes a single notification. Returns 1, if it is delivered. */
+static int
+wapi_scan_mon_event(const struct nlmsghdr *nlh, void *arg)
+{
+	wapi_scan_mon_t *mon = arg;
+	struct genlmsghdr *gnlh = nlmsg_data(nlh);
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	wapi_scan_event_t event;
+	int ifindex;
+	int wiphy;
+
+	if (nlh->nlmsg_type != mon->family ||
+		nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+		return 0;
+
+	switch (gnlh->cmd)
+	{
+	case NL80211_CMD_TRIGGER_SCAN:		event = WAPI_SCAN_EVENT_TRIGGER;	break;
+	case NL80211_CMD_NEW_SCAN_RESULTS:	event = WAPI_SCAN_EVENT_DONE;		break;
+	case NL80211_CMD_SCAN_ABORTED:		event = WAPI_SCAN_EVENT_ABORTED;	break;
+	default: return 0;
+	}
+
+	nla_parse(
+		tb, NL80211_ATTR_MAX,
+		genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
+	ifindex = tb[NL80211_ATTR_IFINDEX]
+		? (int) nla_get_u32(tb[NL80211_ATTR_IFINDEX]) : -1;
+	wiphy = tb[NL80211_ATTR_WIPHY]
+		? (int) nla_get_u32(tb[NL80211_ATTR_WIPHY]) : -1;
+
+	if (mon->wait_ifindex > 0 && ifindex == mon->wait_ifindex)
+	{
+		if (event == WAPI_SCAN_EVENT_DONE) mon->wait_ret = 0;
+		else if (event == WAPI_SCAN_EVENT_ABORTED) mon->wait_ret = -ECANCELED;
+	}
+
+	if (mon->cb) mon->cb(event, ifindex, wiphy, mon->arg);
+	return 1;
+}
+
+
+int
+wapi_scan_mon_open(wapi_scan_mon_cb_t cb, void *arg, wapi_scan_mon_t **mon)
+{
+	wapi_scan_mon_t *m;
+	int ret;
+
+	WAPI_VALIDATE_PTR(mon);
+
+	m = calloc(1, sizeof(wapi_scan_mon_t));
+	if (!m)
+	{
+		WAPI_STRERROR("calloc()");
+		return -ENOMEM;
+	}
+	m->cb = cb;
+	m->arg = arg;
+
+	if ((ret = nl80211_subscribe("scan", &m->sock, &m->family)) < 0)
+	{
+		free(m);
+		return ret;
+	}
+
+	*mon = m;
+	return 0;
+}
+
+
+int
+wapi_scan_mon_fd(const wapi_scan_mon_t *mon)
+{
+	WAPI_VALIDATE_PTR(mon);
+	return nl_socket_get_fd(mon->sock);
+}
+
+
+/* There is no state to resync, just let the callers know. */
+static int
+wapi_scan_mon_overrun(void *arg)
+{
+	wapi_scan_mon_t *mon = arg;
+
+	if (mon->wait_ifindex > 0) mon->wait_ret = -ENOBUFS;
+	if (mon->cb) mon->cb(WAPI_SCAN_EVENT_OVERRUN, -1, -1, mon->arg);
+	return 1;
+}
+
+
+int
+wapi_scan_mon_process(wapi_scan_mon_t *mon)
+{
+	WAPI_VALIDATE_PTR(mon);
+	return wapi_netlink_process(
+		nl_socket_get_fd(mon->sock),
+		wapi_scan_mon_event, wapi_scan_mon_overrun, mon);
+}
+
+
+int
+wapi_scan_mon_wait(wapi_scan_mon_t *mon, int ifindex, int timeout)
+{
+	const long long deadline = (long long) wapi_monotonic_ms() + timeout;
+	struct pollfd pfd;
+	int ret;
+
+	WAPI_VALIDATE_PTR(mon);
+
+	pfd.fd = nl_socket_get_fd(mon->sock);
+	pfd.events = POLLIN;
+	mon->wait_ifindex = ifindex;
+	mon->wait_ret = 1;
+
+	for (;;)
+	{
+		long long left = -1;
+
+		/* Notifications queued before the call count as well. */
+		if ((ret = wapi_scan_mon_process(mon)) < 0 || mon->wait_ret != 1)
+			break;
+
+		if (timeout >= 0 &&
+			(left = deadline - (long long) wapi_monotonic_ms()) <= 0)
+			break;
+
+		if (poll(&pfd, 1, (int) left) < 0 && errno != EINTR)
+		{
+			WAPI_STRERROR("poll()");
+			ret = -1;
+			break;
+		}
+	}
+
+	mon->wait_ifindex = 0;
+	return ret < 0 ? ret : mon->wait_ret;
+}
+
+
+void
+wapi_scan_mon_close(wapi_scan_mon_t *mon)
+{
+	if (!mon) return;
+	nl_socket_free(mon->sock);
+	free(mon);
+}
+
+
+/*-- Targeted Scans ----------------------------------------------------------*/
+
+
+typedef struct wapi_scan_req_ctx_t {
+	const char *ifname;
+	const wapi_scan_params_t *params;	/* Trigger parameters. */
+	unsigned int max_age;				/* Dump filter. */
+	wapi_scan_visit_cb_t cb;			/* Dump visitor. */
+	void *arg;
+	int ret;
+} wapi_scan_req_ctx_t;
+
+
+static int
+wapi_nl80211_ifindex(const char *ifname)
+{
+	int ifindex = if_nametoindex(ifname);
+	if (!ifindex)
+	{
+		WAPI_STRERROR("if_nametoindex(\"%s\")", ifname);
+		return -errno;
+	}
+	return ifindex;
+}
+
+
+static int
+wapi_scan_trigger_handler(struct nl_sock *sock, int family, void *arg)
+{
+	const wapi_scan_req_ctx_t *ctx = arg;
+	const wapi_scan_params_t *params = ctx->params;
+	struct nl_msg *msg;
+	struct nlattr *nest;
+	uint32_t flags = 0;
+	size_t i;
+	int ret;
+
+	if ((ret = wapi_nl80211_ifindex(ctx->ifname)) < 0)
+		return ret;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+	{
+		WAPI_ERROR("nlmsg_alloc() failed!\n");
+		return -ENOMEM;
+	}
+
+	genlmsg_put(
+		msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, 0,
+		NL80211_CMD_TRIGGER_SCAN, 0);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ret);
+
+	/* Channels to visit. The kernel sweeps every channel without the list. */
+	if (params->nfreqs)
+	{
+		if (!(nest = nla_nest_start(msg, NL80211_ATTR_SCAN_FREQUENCIES)))
+			goto nla_put_failure;
+		for (i = 0; i < params->nfreqs; i++)
+			NLA_PUT_U32(msg, i + 1, params->freqs[i]);
+		nla_nest_end(msg, nest);
+	}
+
+	/* Probes to send. Leaving the list out makes the scan passive, hence an
+	 * empty (wildcard) SSID for active scans without specific SSIDs. */
+	if (!(params->flags & WAPI_SCAN_PASSIVE))
+	{
+		if (!(nest = nla_nest_start(msg, NL80211_ATTR_SCAN_SSIDS)))
+			goto nla_put_failure;
+		for (i = 0; i < params->nssids; i++)
+		{
+			size_t len = strlen(params->ssids[i]);
+			if (len > WAPI_ESSID_MAX_SIZE)
+			{
+				WAPI_ERROR("SSID too long: %s!\n", params->ssids[i]);
+				ret = -EINVAL;
+				goto exit;
+			}
+			NLA_PUT(msg, i + 1, len, params->ssids[i]);
+		}
+		if (!params->nssids)
+			NLA_PUT(msg, 1, 0, "");
+		nla_nest_end(msg, nest);
+	}
+
+	if (params->flags & WAPI_SCAN_FLUSH)
+		flags |= NL80211_SCAN_FLAG_FLUSH;
+	if (params->flags & WAPI_SCAN_LOW_PRIORITY)
+		flags |= NL80211_SCAN_FLAG_LOW_PRIORITY;
+	if (flags)
+		NLA_PUT_U32(msg, NL80211_ATTR_SCAN_FLAGS, flags);
+
+	/* Dwell time goes in TUs. (1024 usecs) */
+	if (params->dwell)
+	{
+		unsigned long tu = (params->dwell * 1000UL + 1023) / 1024;
+		NLA_PUT_U16(msg, NL80211_ATTR_MEASUREMENT_DURATION,
+					tu > UINT16_MAX ? UINT16_MAX : tu);
+		NLA_PUT_FLAG(msg, NL80211_ATTR_MEASUREMENT_DURATION_MANDATORY);
+	}
+
+	ret = nl80211_exec(sock, msg, NULL, NULL);
+
+exit:
+	nlmsg_free(msg);
+	return ret;
+
+nla_put_failure:
+	WAPI_ERROR("nla_put_failure!\n");
+	ret = -1;
+	goto exit;
+}
+
+
+/* Decodes the SSID and the supported rates of a BSS from its IEs. */
+static void
+wapi_scan_bss_ies(wapi_scan_info_t *info, const uint8_t *ie, size_t len)
+{
+	while (len >= 2 && (size_t) ie[1] + 2 <= len)
+	{
+		const uint8_t *data = ie + 2;
+		size_t i;
+
+		switch (ie[0])
+		{
+		case 0:		/* SSID */
+			if (info->has_essid || ie[1] > WAPI_ESSID_MAX_SIZE) break;
+			info->has_essid = 1;
+			info->essid_flag = WAPI_ESSID_ON;
+			memcpy(info->essid, data, ie[1]);
+			info->essid[ie[1]] = '\0';
+			break;
+
+		case 1:		/* Supported Rates */
+		case 50:	/* Extended Supported Rates */
+			/* Keep the largest one, as in wapi_scan_event(). */
+			for (i = 0; i < ie[1]; i++)
+			{
+				int rate = (data[i] & 0x7f) * 500000;
+				if (!info->has_bitrate || rate > info->bitrate)
+				{
+					info->has_bitrate = 1;
+					info->bitrate = rate;
+				}
+			}
+			break;
+		}
+
+		len -= ie[1] + 2;
+		ie += ie[1] + 2;
+	}
+}
+
+
+static int
+wapi_scan_bss_cb(struct nl_msg *msg, void *arg)
+{
+	wapi_scan_req_ctx_t *ctx = arg;
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nlattr *bss[NL80211_BSS_MAX + 1];
+	struct nlattr *ies;
+	wapi_scan_info_t info;
+	int ret;
+
+	/* Keep draining the dump after a failure. */
+	if (ctx->ret < 0)
+		return NL_SKIP;
+
+	nla_parse(
+		tb, NL80211_ATTR_MAX,
+		genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
+	if (!tb[NL80211_ATTR_BSS] ||
+		nla_parse_nested(bss, NL80211_BSS_MAX, tb[NL80211_ATTR_BSS], NULL) ||
+		!bss[NL80211_BSS_BSSID] ||
+		nla_len(bss[NL80211_BSS_BSSID]) < ETH_ALEN)
+		return NL_SKIP;
+
+	if (ctx->max_age && bss[NL80211_BSS_SEEN_MS_AGO] &&
+		nla_get_u32(bss[NL80211_BSS_SEEN_MS_AGO]) > ctx->max_age)
+		return NL_SKIP;
+
+	bzero(&info, sizeof(wapi_scan_info_t));
+	memcpy(&info.ap, nla_data(bss[NL80211_BSS_BSSID]), ETH_ALEN);
+
+	if (bss[NL80211_BSS_FREQUENCY])
+	{
+		info.has_freq = 1;
+		info.freq = nla_get_u32(bss[NL80211_BSS_FREQUENCY]) * 1e6;
+	}
+
+	if (bss[NL80211_BSS_SIGNAL_MBM])
+	{
+		info.has_signal = 1;
+		info.signal = (int32_t) nla_get_u32(bss[NL80211_BSS_SIGNAL_MBM]) / 100;
+	}
+
+	if (bss[NL80211_BSS_CAPABILITY])
+	{
+		uint16_t capa = nla_get_u16(bss[NL80211_BSS_CAPABILITY]);
+		if (capa & (1 << 0))
+		{
+			info.has_mode = 1;
+			info.mode = WAPI_MODE_MASTER;
+		}
+		else if (capa & (1 << 1))
+		{
+			info.has_mode = 1;
+			info.mode = WAPI_MODE_ADHOC;
+		}
+	}
+
+	/* Probe response IEs, or beacon IEs for passively found entries. */
+	if ((ies = bss[NL80211_BSS_INFORMATION_ELEMENTS]) ||
+		(ies = bss[NL80211_BSS_BEACON_IES]))
+		wapi_scan_bss_ies(&info, nla_data(ies), nla_len(ies));
+
+	if ((ret = ctx->cb(&info, ctx->arg)) < 0)
+		ctx->ret = ret;
+
+	return NL_SKIP;
+}
+
+
+static int
+wapi_scan_dump_handler(struct nl_sock *sock, int family, void *arg)
+{
+	wapi_scan_req_ctx_t *ctx = arg;
+	struct nl_msg *msg;
+	int ret;
+
+	if ((ret = wapi_nl80211_ifindex(ctx->ifname)) < 0)
+		return ret;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+	{
+		WAPI_ERROR("nlmsg_alloc() failed!\n");
+		return -ENOMEM;
+	}
+
+	genlmsg_put(
+		msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, NLM_F_DUMP,
+		NL80211_CMD_GET_SCAN, 0);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ret);
+
+	ret = nl80211_exec(sock, msg, wapi_scan_bss_cb, ctx);
+	if (ret >= 0) ret = ctx->ret;
+
+exit:
+	nlmsg_free(msg);
+	return ret;
+
+nla_put_failure:
+	WAPI_ERROR("nla_put_failure!\n");
+	ret = -1;
+	goto exit;
+}
+
+
+int
+wapi_scan_trigger(const char *ifname, const wapi_scan_params_t *params)
+{
+	return wapi_ctx_scan_trigger(NULL, ifname, params);
+}
+
+
+int
+wapi_ctx_scan_trigger(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	const wapi_scan_params_t *params)
+{
+	static const wapi_scan_params_t defaults;
+	wapi_scan_req_ctx_t ctx;
+
+	WAPI_VALIDATE_PTR(ifname);
+
+	bzero(&ctx, sizeof(ctx));
+	ctx.ifname = ifname;
+	ctx.params = params ? params : &defaults;
+	return nl80211_with(wctx, wapi_scan_trigger_handler, &ctx);
+}
+
+
+int
+wapi_scan_cached(const char *ifname, unsigned int max_age, wapi_list_t *aps)
+{
+	return wapi_ctx_scan_cached(NULL, ifname, max_age, aps);
+}
+
+
+int
+wapi_ctx_scan_cached(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	unsigned int max_age,
+	wapi_list_t *aps)
+{
+	WAPI_VALIDATE_PTR(aps);
+
+	aps->type = WAPI_LIST_SCAN;
+	return wapi_ctx_scan_cached_visit(
+		wctx, ifname, max_age, wapi_scan_coll_cb, aps);
+}
+
+
+int
+wapi_scan_cached_visit(
+	const char *ifname,
+	unsigned int max_age,
+	wapi_scan_visit_cb_t cb,
+	void *arg)
+{
+	return wapi_ctx_scan_cached_visit(NULL, ifname, max_age, cb, arg);
+}
+
+
+int
+wapi_ctx_scan_cached_visit(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	unsigned int max_age,
+	wapi_scan_visit_cb_t cb,
+	void *arg)
+{
+	wapi_scan_req_ctx_t ctx;
+
+	WAPI_VALIDATE_PTR(ifname);
+	WAPI_VALIDATE_PTR(cb);
+
+	bzero(&ctx, sizeof(ctx));
+	ctx.ifname = ifname;
+	ctx.max_age = max_age;
+	ctx.cb = cb;
+	ctx.arg = arg;
+	return nl80211_with(wctx, wapi_scan_dump_handler, &ctx);
+}
+
+
+/*-- Connect -----------------------------------------------------------------*/
+
+
+typedef struct wapi_connect_pick_t {
+	const wapi_connect_params_t *params;
+	int found;
+	int signal;
+	struct ether_addr bssid;
+	unsigned int freq;
+} wapi_connect_pick_t;
+
+
+typedef struct wapi_connect_req_t {
+	int ifindex;
+	const char *essid;
+	const struct ether_addr *bssid;
+	unsigned int freq;
+} wapi_connect_req_t;
+
+
+/* Keeps the strongest BSS of the network that agrees with the given hints. */
+static int
+wapi_connect_pick_cb(const struct wapi_scan_info_t *info, void *arg)
+{
+	wapi_connect_pick_t *pick = arg;
+	const wapi_connect_params_t *params = pick->params;
+	unsigned int freq;
+	int signal;
+
+	if (!info->has_essid || strcmp(info->essid, params->essid) ||
+		!info->has_freq)
+		return 0;
+
+	freq = (unsigned int) (info->freq / 1e6 + 0.5);
+	if ((params->bssid &&
+		 memcmp(&info->ap, params->bssid, sizeof(struct ether_addr))) ||
+		(params->freq && freq != params->freq))
+		return 0;
+
+	signal = info->has_signal ? info->signal : INT_MIN;
+	if (pick->found && signal <= pick->signal)
+		return 0;
+
+	pick->found = 1;
+	pick->signal = signal;
+	pick->bssid = info->ap;
+	pick->freq = freq;
+
+	return 0;
+}
+
+
+/* Runs a scan targeted at the ESSID, and picks a BSS from its results. */
+static int
+wapi_connect_scan(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	int ifindex,
+	long long deadline,
+	wapi_connect_pick_t *pick)
+{
+	const wapi_connect_params_t *params = pick->params;
+	const unsigned long long start = wapi_monotonic_ms();
+	wapi_scan_params_t sp;
+	wapi_scan_mon_t *mon;
+	int lost = 0;
+	int ret;
+
+	if ((ret = wapi_scan_mon_open(NULL, NULL, &mon)) < 0)
+		return ret;
+
+	bzero(&sp, sizeof(sp));
+	sp.ssids = &params->essid;
+	sp.nssids = 1;
+	if (params->freq)
+	{
+		sp.freqs = &params->freq;
+		sp.nfreqs = 1;
+	}
+	else
+	{
+		sp.freqs = params->freqs;
+		sp.nfreqs = params->nfreqs;
+	}
+
+	/* A running scan is as good as ours, just wait for it. */
+	ret = wapi_ctx_scan_trigger(wctx, ifname, &sp);
+	if (ret >= 0 || ret == -EBUSY)
+		for (;;)
+		{
+			long long left = deadline - (long long) wapi_monotonic_ms();
+			ret = wapi_scan_mon_wait(
+				mon, ifindex, deadline < 0 ? -1 : left < 0 ? 0 : (int) left);
+			if (ret != -ENOBUFS)
+				break;
+
+			/* The completion may be among the lost notifications, so settle
+			 * for the results so far, and keep waiting if they fall short. */
+			lost = 1;
+			ret = wapi_ctx_scan_cached_visit(
+				wctx, ifname, wapi_monotonic_ms() - start + 1,
+				wapi_connect_pick_cb, pick);
+			if (ret < 0 || pick->found)
+				break;
+		}
+	wapi_scan_mon_close(mon);
+
+	/* Without a completion to wait for, the results so far are all we get. */
+	if (ret > 0 && !lost)
+		return -ETIMEDOUT;
+	if (ret < 0)
+		return ret;
+
+	/* Only entries refreshed by this very scan. */
+	return wapi_ctx_scan_cached_visit(
+		wctx, ifname, wapi_monotonic_ms() - start + 1,
+		wapi_connect_pick_cb, pick);
+}
+
+
+static int
+wapi_connect_handler(struct nl_sock *sock, int family, void *arg)
+{
+	const wapi_connect_req_t *req = arg;
+	struct nl_msg *msg;
+	int ret;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+	{
+		WAPI_ERROR("nlmsg_alloc() failed!\n");
+		return -ENOMEM;
+	}
+
+	genlmsg_put(
+		msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, 0,
+		NL80211_CMD_CONNECT, 0);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, req->ifindex);
+	NLA_PUT(msg, NL80211_ATTR_SSID, strlen(req->essid), req->essid);
+
+	/* Pinning the BSS lets the kernel skip its own scan, provided that the
+	 * BSS is in its cache. */
+	if (req->bssid)
+		NLA_PUT(msg, NL80211_ATTR_MAC, ETH_ALEN, req->bssid);
+	if (req->freq)
+		NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, req->freq);
+
+	ret = nl80211_exec(sock, msg, NULL, NULL);
+
+exit:
+	nlmsg_free(msg);
+	return ret;
+
+nla_put_failure:
+	WAPI_ERROR("nla_put_failure!\n");
+	ret = -1;
+	goto exit;
+}
+
+
+/* Decodes an MLME event. Returns 1, if it does not concern the connection. */
+static int
+wapi_connect_event(const struct nlmsghdr *nlh, int family, int ifindex)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlh);
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	unsigned int status;
+
+	if (nlh->nlmsg_type != family ||
+		nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN) ||
+		(gnlh->cmd != NL80211_CMD_CONNECT &&
+		 gnlh->cmd != NL80211_CMD_DISCONNECT))
+		return 1;
+
+	nla_parse(
+		tb, NL80211_ATTR_MAX,
+		genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
+	if (!tb[NL80211_ATTR_IFINDEX] ||
+		(int) nla_get_u32(tb[NL80211_ATTR_IFINDEX]) != ifindex)
+		return 1;
+
+	if (gnlh->cmd == NL80211_CMD_DISCONNECT)
+	{
+		WAPI_ERROR("Disconnected while connecting!\n");
+		return -ECONNRESET;
+	}
+
+	if (tb[NL80211_ATTR_TIMED_OUT])
+	{
+		WAPI_ERROR("Association timed out!\n");
+		return -ETIMEDOUT;
+	}
+
+	status = tb[NL80211_ATTR_STATUS_CODE]
+		? nla_get_u16(tb[NL80211_ATTR_STATUS_CODE]) : 0;
+	if (status)
+	{
+		WAPI_ERROR("Association rejected with status %u!\n", status);
+		return -ECONNREFUSED;
+	}
+
+	return 0;
+}
+
+
+typedef struct wapi_connect_wait_t {
+	int family;
+	int ifindex;
+	int done;
+	int ret;
+} wapi_connect_wait_t;
+
+
+/* Stops at the first event concerning the connection. */
+static int
+wapi_connect_wait_cb(const struct nlmsghdr *nlh, void *arg)
+{
+	wapi_connect_wait_t *w = arg;
+	int ret = wapi_connect_event(nlh, w->family, w->ifindex);
+
+	if (ret > 0)
+		return 0;
+	w->done = 1;
+	w->ret = ret;
+	return -1;
+}
+
+
+/* Waits for the outcome of the connection request on the MLME socket. Lost
+ * events leave nothing better to do than waiting for the deadline, hence
+ * ENOBUFS is not fatal. */
+static int
+wapi_connect_wait(
+	struct nl_sock *sock,
+	int family,
+	int ifindex,
+	long long deadline)
+{
+	wapi_connect_wait_t w;
+	struct pollfd pfd;
+
+	pfd.fd = nl_socket_get_fd(sock);
+	pfd.events = POLLIN;
+	bzero(&w, sizeof(w));
+	w.family = family;
+	w.ifindex = ifindex;
+
+	for (;;)
+	{
+		long long left = -1;
+		int ret;
+
+		ret = wapi_netlink_process(pfd.fd, wapi_connect_wait_cb, NULL, &w);
+		if (w.done)
+			return w.ret;
+		if (ret < 0)
+			return ret;
+
+		if (deadline >= 0 &&
+			(left = deadline - (long long) wapi_monotonic_ms()) <= 0)
+		{
+			WAPI_ERROR("Connection timed out!\n");
+			return -ETIMEDOUT;
+		}
+
+		if (poll(&pfd, 1, (int) left) < 0 && errno != EINTR)
+		{
+			WAPI_STRERROR("poll()");
+			return -1;
+		}
+	}
+}
+
+
+int
+wapi_connect(
+	const char *ifname,
+	const wapi_connect_params_t *params,
+	wapi_connect_info_t *info)
+{
+	return wapi_ctx_connect(NULL, ifname, params, info);
+}
+
+
+int
+wapi_ctx_connect(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	const wapi_connect_params_t *params,
+	wapi_connect_info_t *info)
+{
+	const unsigned long long t0 = wapi_monotonic_us();
+	wapi_connect_info_t dummy;
+	wapi_connect_pick_t pick;
+	wapi_connect_req_t req;
+	struct nl_sock *mlme;
+	unsigned long long t;
+	long long deadline;
+	int ifindex;
+	int family;
+	int ret;
+
+	WAPI_VALIDATE_PTR(ifname);
+	WAPI_VALIDATE_PTR(params);
+	WAPI_VALIDATE_PTR(params->essid);
+
+	if (!info) info = &dummy;
+	bzero(info, sizeof(wapi_connect_info_t));
+	deadline = params->timeout < 0 ? -1 : (long long) (t0 / 1000) +
+		(params->timeout ? params->timeout : WAPI_CONNECT_TIMEOUT);
+
+	if ((ret = ifindex = wapi_nl80211_ifindex(ifname)) < 0)
+		goto exit;
+
+	/* Take the BSS from the hints, or from fresh cached results. */
+	bzero(&pick, sizeof(pick));
+	pick.params = params;
+	if (params->bssid && params->freq)
+	{
+		pick.found = 1;
+		pick.bssid = *params->bssid;
+		pick.freq = params->freq;
+	}
+	else if (params->max_age &&
+			 (ret = wapi_ctx_scan_cached_visit(
+				 wctx, ifname, params->max_age,
+				 wapi_connect_pick_cb, &pick)) < 0)
+		goto exit;
+	t = wapi_monotonic_us();
+	info->hint_time = t - t0;
+
+	/* No luck, scan for it. */
+	if (!pick.found)
+	{
+		info->scanned = 1;
+		ret = wapi_connect_scan(wctx, ifname, ifindex, deadline, &pick);
+		info->scan_time = wapi_monotonic_us() - t;
+		t += info->scan_time;
+		if (ret < 0)
+			goto exit;
+		if (!pick.found)
+		{
+			WAPI_ERROR("No BSS found for ESSID: %s!\n", params->essid);
+			ret = -ENOENT;
+			goto exit;
+		}
+	}
+	info->bssid = pick.bssid;
+	info->freq = pick.freq;
+
+	/* Subscribe before the request, so that the outcome cannot be missed. */
+	if ((ret = nl80211_subscribe("mlme", &mlme, &family)) < 0)
+		goto exit;
+
+	req.ifindex = ifindex;
+	req.essid = params->essid;
+	req.bssid = &pick.bssid;
+	req.freq = pick.freq;
+	if ((ret = nl80211_with(wctx, wapi_connect_handler, &req)) >= 0)
+		ret = wapi_connect_wait(mlme, family, ifindex, deadline);
+	nl_socket_free(mlme);
+	info->connect_time = wapi_monotonic_us() - t;
+
+exit:
+	info->total_time = wapi_monotonic_us() - t0;
+	return ret;
+}
+
+
+/*-- Station Statistics ------------------------------------------------------*/
+
+
+typedef struct wapi_sta_req_t {
+	const char *ifname;
+	const struct ether_addr *mac;	/* NULL for a dump. */
+	wapi_sta_visit_cb_t cb;			/* NULL to fill "stas". */
+	void *arg;
+	int ret;
+	wapi_sta_info_t *stas;
+	size_t size;
+	size_t n;
+} wapi_sta_req_t;
+
+
+static void
+wapi_sta_rate(struct nlattr *attr, wapi_sta_rate_t *rate)
+{
+	struct nlattr *ri[NL80211_RATE_INFO_MAX + 1];
+
+	bzero(rate, sizeof(wapi_sta_rate_t));
+	rate->mcs = 0xff;
+	rate->width = 20;
+	if (nla_parse_nested(ri, NL80211_RATE_INFO_MAX, attr, NULL))
+		return;
+
+	/* Both are in 100 kbps. */
+	if (ri[NL80211_RATE_INFO_BITRATE32])
+		rate->bitrate = nla_get_u32(ri[NL80211_RATE_INFO_BITRATE32]) * 100;
+	else if (ri[NL80211_RATE_INFO_BITRATE])
+		rate->bitrate = nla_get_u16(ri[NL80211_RATE_INFO_BITRATE]) * 100;
+
+	if (ri[NL80211_RATE_INFO_MCS])
+		rate->mcs = nla_get_u8(ri[NL80211_RATE_INFO_MCS]);
+	else if (ri[NL80211_RATE_INFO_VHT_MCS])
+		rate->mcs = nla_get_u8(ri[NL80211_RATE_INFO_VHT_MCS]);
+	if (ri[NL80211_RATE_INFO_VHT_NSS])
+		rate->nss = nla_get_u8(ri[NL80211_RATE_INFO_VHT_NSS]);
+
+	if (ri[NL80211_RATE_INFO_40_MHZ_WIDTH]) rate->width = 40;
+	if (ri[NL80211_RATE_INFO_80_MHZ_WIDTH]) rate->width = 80;
+	if (ri[NL80211_RATE_INFO_80P80_MHZ_WIDTH] ||
+		ri[NL80211_RATE_INFO_160_MHZ_WIDTH])
+		rate->width = 160;
+	rate->short_gi = ri[NL80211_RATE_INFO_SHORT_GI] != NULL;
+}
+
+
+/* Decodes the nested STA_INFO attributes into "info". */
+static void
+wapi_sta_parse(struct nlattr *attr, wapi_sta_info_t *info)
+{
+	struct nlattr *si[NL80211_STA_INFO_MAX + 1];
+
+	if (nla_parse_nested(si, NL80211_STA_INFO_MAX, attr, NULL))
+		return;
+
+#define WAPI_STA_GET(attr, field, bits, flag) \
+	if (si[attr]) \
+	{ \
+		info->field = nla_get_u##bits(si[attr]); \
+		info->has |= flag; \
+	}
+
+	WAPI_STA_GET(
+		NL80211_STA_INFO_INACTIVE_TIME, inactive_time, 32,
+		WAPI_STA_HAS_INACTIVE_TIME);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_CONNECTED_TIME, connected_time, 32,
+		WAPI_STA_HAS_CONNECTED_TIME);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_RX_PACKETS, rx_packets, 32, WAPI_STA_HAS_RX_PACKETS);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_TX_PACKETS, tx_packets, 32, WAPI_STA_HAS_TX_PACKETS);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_TX_RETRIES, tx_retries, 32, WAPI_STA_HAS_TX_RETRIES);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_TX_FAILED, tx_failed, 32, WAPI_STA_HAS_TX_FAILED);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_SIGNAL, signal, 8, WAPI_STA_HAS_SIGNAL);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_SIGNAL_AVG, signal_avg, 8, WAPI_STA_HAS_SIGNAL_AVG);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_BEACON_LOSS, beacon_loss, 32,
+		WAPI_STA_HAS_BEACON_LOSS);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_BEACON_RX, beacon_rx, 64, WAPI_STA_HAS_BEACON_RX);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_EXPECTED_THROUGHPUT, expected_throughput, 32,
+		WAPI_STA_HAS_EXPECTED_THROUGHPUT);
+
+	/* 32-bit counters wrap quickly, prefer the 64-bit ones. */
+	WAPI_STA_GET(NL80211_STA_INFO_RX_BYTES, rx_bytes, 32, WAPI_STA_HAS_RX_BYTES);
+	WAPI_STA_GET(NL80211_STA_INFO_TX_BYTES, tx_bytes, 32, WAPI_STA_HAS_TX_BYTES);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_RX_BYTES64, rx_bytes, 64, WAPI_STA_HAS_RX_BYTES);
+	WAPI_STA_GET(
+		NL80211_STA_INFO_TX_BYTES64, tx_bytes, 64, WAPI_STA_HAS_TX_BYTES);
+
+#undef WAPI_STA_GET
+
+	if (si[NL80211_STA_INFO_STA_FLAGS])
+	{
+		const struct nl80211_sta_flag_update *upd =
+			nla_data(si[NL80211_STA_INFO_STA_FLAGS]);
+		info->flags = upd->set & upd->mask;
+		info->has |= WAPI_STA_HAS_FLAGS;
+	}
+
+	if (si[NL80211_STA_INFO_TX_BITRATE])
+	{
+		wapi_sta_rate(si[NL80211_STA_INFO_TX_BITRATE], &info->tx_rate);
+		info->has |= WAPI_STA_HAS_TX_RATE;
+	}
+	if (si[NL80211_STA_INFO_RX_BITRATE])
+	{
+		wapi_sta_rate(si[NL80211_STA_INFO_RX_BITRATE], &info->rx_rate);
+		info->has |= WAPI_STA_HAS_RX_RATE;
+	}
+}
+
+
+static int
+wapi_sta_cb(struct nl_msg *msg, void *arg)
+{
+	wapi_sta_req_t *req = arg;
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	wapi_sta_info_t *info;
+	wapi_sta_info_t tmp;
+
+	/* Keep draining the dump after a failure. */
+	if (req->ret < 0)
+		return NL_SKIP;
+
+	nla_parse(
+		tb, NL80211_ATTR_MAX,
+		genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
+	if (!tb[NL80211_ATTR_MAC] || nla_len(tb[NL80211_ATTR_MAC]) < ETH_ALEN ||
+		!tb[NL80211_ATTR_STA_INFO])
+		return NL_SKIP;
+
+	/* Keep counting past the end of the table. */
+	if (!req->cb && req->n >= req->size)
+	{
+		req->n++;
+		return NL_SKIP;
+	}
+
+	info = req->cb ? &tmp : &req->stas[req->n];
+	bzero(info, sizeof(wapi_sta_info_t));
+	memcpy(&info->mac, nla_data(tb[NL80211_ATTR_MAC]), ETH_ALEN);
+	wapi_sta_parse(tb[NL80211_ATTR_STA_INFO], info);
+	req->n++;
+
+	if (req->cb && (req->ret = req->cb(info, req->arg)) > 0)
+		req->ret = 0;
+
+	return NL_SKIP;
+}
+
+
+static int
+wapi_sta_handler(struct nl_sock *sock, int family, void *arg)
+{
+	wapi_sta_req_t *req = arg;
+	struct nl_msg *msg;
+	int ret;
+
+	if ((ret = wapi_nl80211_ifindex(req->ifname)) < 0)
+		return ret;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+	{
+		WAPI_ERROR("nlmsg_alloc() failed!\n");
+		return -ENOMEM;
+	}
+
+	genlmsg_put(
+		msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, req->mac ? 0 : NLM_F_DUMP,
+		NL80211_CMD_GET_STATION, 0);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ret);
+	if (req->mac)
+		NLA_PUT(msg, NL80211_ATTR_MAC, ETH_ALEN, req->mac);
+
+	ret = nl80211_exec(sock, msg, wapi_sta_cb, req);
+	if (ret >= 0) ret = req->ret;
+
+exit:
+	nlmsg_free(msg);
+	return ret;
+
+nla_put_failure:
+	WAPI_ERROR("nla_put_failure!\n");
+	ret = -1;
+	goto exit;
+}
+
+
+int
+wapi_sta_get(
+	const char *ifname,
+	const struct ether_addr *mac,
+	wapi_sta_info_t *info)
+{
+	return wapi_ctx_sta_get(NULL, ifname, mac, info);
+}
+
+
+int
+wapi_sta_dump(const char *ifname, wapi_sta_info_t *stas, size_t size)
+{
+	return wapi_ctx_sta_dump(NULL, ifname, stas, size);
+}
+
+
+int
+wapi_sta_visit(const char *ifname, wapi_sta_visit_cb_t cb, void *arg)
+{
+	return wapi_ctx_sta_visit(NULL, ifname, cb, arg);
+}
+
+
+int
+wapi_ctx_sta_get(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	const struct ether_addr *mac,
+	wapi_sta_info_t *info)
+{
+	wapi_sta_req_t req;
+	int ret;
+
+	WAPI_VALIDATE_PTR(ifname);
+	WAPI_VALIDATE_PTR(mac);
+	WAPI_VALIDATE_PTR(info);
+
+	bzero(&req, sizeof(req));
+	req.ifname = ifname;
+	req.mac = mac;
+	req.stas = info;
+	req.size = 1;
+
+	if ((ret = nl80211_with(wctx, wapi_sta_handler, &req)) < 0)
+		return ret;
+	return req.n ? 0 : -ENOENT;
+}
+
+
+int
+wapi_ctx_sta_dump(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	wapi_sta_info_t *stas,
+	size_t size)
+{
+	wapi_sta_req_t req;
+	int ret;
+
+	WAPI_VALIDATE_PTR(ifname);
+	if (size && !stas)
+	{
+		WAPI_ERROR("Null pointer: stas.\n");
+		return -1;
+	}
+
+	bzero(&req, sizeof(req));
+	req.ifname = ifname;
+	req.stas = stas;
+	req.size = size;
+
+	if ((ret = nl80211_with(wctx, wapi_sta_handler, &req)) < 0)
+		return ret;
+	return (int) req.n;
+}
+
+
+int
+wapi_ctx_sta_visit(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	wapi_sta_visit_cb_t cb,
+	void *arg)
+{
+	wapi_sta_req_t req;
+
+	WAPI_VALIDATE_PTR(ifname);
+	WAPI_VALIDATE_PTR(cb);
+
+	bzero(&req, sizeof(req));
+	req.ifname = ifname;
+	req.cb = cb;
+	req.arg = arg;
+
+	return nl80211_with(wctx, wapi_sta_handler, &req);
+}
+
+
+/*-- AP Station Table --------------------------------------------------------*/
+
+
+/* 802.11 frame subtypes and the reason code of kicks. */
+#define WAPI_MGMT_SUBTYPE_DISASSOC 10
+#define WAPI_MGMT_SUBTYPE_DEAUTH 12
+#define WAPI_REASON_AP_BUSY 5
+
+
+struct wapi_ap_sta_mon_t {
+	struct nl_sock *sock;		/* Subscribed to "mlme". */
+	int family;
+	wapi_ctx_t *ctx;
+	char ifname[IFNAMSIZ];
+	int ifindex;
+	wapi_ap_sta_table_t *table;
+};
+
+
+/* Columns of the table, wider ones first to keep them naturally aligned. */
+static const wapi_column_t wapi_ap_sta_columns[] = {
+	WAPI_COLUMN(wapi_ap_sta_table_t, rx_bytes),
+	WAPI_COLUMN(wapi_ap_sta_table_t, tx_bytes),
+	WAPI_COLUMN(wapi_ap_sta_table_t, inactive_time),
+	WAPI_COLUMN(wapi_ap_sta_table_t, rx_rate),
+	WAPI_COLUMN(wapi_ap_sta_table_t, tx_rate),
+	WAPI_COLUMN(wapi_ap_sta_table_t, flags),
+	WAPI_COLUMN(wapi_ap_sta_table_t, has),
+	WAPI_COLUMN(wapi_ap_sta_table_t, mac),
+	WAPI_COLUMN(wapi_ap_sta_table_t, signal)
+};
+
+
+/* Makes room for at least one more row, and keeps the load factor of the index
+ * at or below 1/2. */
+static int
+wapi_ap_sta_grow(wapi_ap_sta_table_t *table)
+{
+	if (table->nsta == table->size)
+	{
+		size_t size = table->size ? 2 * table->size : 64;
+		char *block;
+
+		block = wapi_columns_grow(
+			table, WAPI_COLUMNS(wapi_ap_sta_columns),
+			table->block, table->nsta, size);
+		if (!block)
+			return -1;
+		table->block = block;
+		table->size = size;
+	}
+
+	return wapi_mac_index_grow(
+		&table->index, &table->index_size, table->mac, table->nsta);
+}
+
+
+int
+wapi_ap_sta_table_add(const wapi_sta_info_t *info, void *arg)
+{
+	wapi_ap_sta_table_t *table = arg;
+	size_t row;
+	size_t i;
+
+	WAPI_VALIDATE_PTR(info);
+	WAPI_VALIDATE_PTR(table);
+
+	if (wapi_ap_sta_grow(table) < 0)
+		return -1;
+
+	i = wapi_mac_index_find(
+		table->index, table->index_size, table->mac, &info->mac);
+	if ((row = table->index[i]) == WAPI_INDEX_NOROW)
+	{
+		row = table->index[i] = table->nsta++;
+		table->mac[row] = info->mac;
+	}
+
+	table->inactive_time[row] = info->inactive_time;
+	table->signal[row] = info->signal;
+	table->rx_bytes[row] = info->rx_bytes;
+	table->tx_bytes[row] = info->tx_bytes;
+	table->rx_rate[row] = info->rx_rate.bitrate;
+	table->tx_rate[row] = info->tx_rate.bitrate;
+	table->flags[row] = info->flags;
+	table->has[row] = info->has;
+
+	return 0;
+}
+
+
+int
+wapi_ap_sta_table_find(
+	const wapi_ap_sta_table_t *table,
+	const struct ether_addr *mac,
+	size_t *row)
+{
+	size_t i;
+
+	WAPI_VALIDATE_PTR(table);
+	WAPI_VALIDATE_PTR(mac);
+
+	if (!table->nsta)
+		return -ENOENT;
+
+	i = wapi_mac_index_find(table->index, table->index_size, table->mac, mac);
+	if (table->index[i] == WAPI_INDEX_NOROW)
+		return -ENOENT;
+
+	if (row) *row = table->index[i];
+	return 0;
+}
+
+
+int
+wapi_ap_sta_table_del(wapi_ap_sta_table_t *table, const struct ether_addr *mac)
+{
+	size_t last;
+	size_t row;
+	size_t i;
+
+	WAPI_VALIDATE_PTR(table);
+	WAPI_VALIDATE_PTR(mac);
+
+	if (!table->nsta)
+		return -ENOENT;
+
+	i = wapi_mac_index_find(table->index, table->index_size, table->mac, mac);
+	if ((row = table->index[i]) == WAPI_INDEX_NOROW)
+		return -ENOENT;
+	wapi_mac_index_del(table->index, table->index_size, table->mac, i);
+
+	/* Move the last row into the hole. */
+	last = --table->nsta;
+	if (row != last)
+	{
+		table->index[wapi_mac_index_find(
+			table->index, table->index_size, table->mac,
+			&table->mac[last])] = row;
+		wapi_columns_copy(table, WAPI_COLUMNS(wapi_ap_sta_columns), row, last);
+	}
+
+	return 0;
+}
+
+
+int
+wapi_ap_sta_table_fill(const char *ifname, wapi_ap_sta_table_t *table)
+{
+	return wapi_ctx_ap_sta_table_fill(NULL, ifname, table);
+}
+
+
+int
+wapi_ctx_ap_sta_table_fill(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	wapi_ap_sta_table_t *table)
+{
+	WAPI_VALIDATE_PTR(table);
+
+	wapi_ap_sta_table_clear(table);
+	return wapi_ctx_sta_visit(wctx, ifname, wapi_ap_sta_table_add, table);
+}
+
+
+void
+wapi_ap_sta_table_clear(wapi_ap_sta_table_t *table)
+{
+	table->nsta = 0;
+	if (table->index)
+		memset(table->index, 0xff, table->index_size * sizeof(size_t));
+}
+
+
+void
+wapi_ap_sta_table_free(wapi_ap_sta_table_t *table)
+{
+	if (!table) return;
+	free(table->block);
+	free(table->index);
+	bzero(table, sizeof(wapi_ap_sta_table_t));
+}
+
+
+int
+wapi_ap_sta_mon_open(
+	wapi_ctx_t *ctx,
+	const char *ifname,
+	wapi_ap_sta_table_t *table,
+	wapi_ap_sta_mon_t **mon)
+{
+	wapi_ap_sta_mon_t *m;
+	int ret;
+
+	WAPI_VALIDATE_PTR(ifname);
+	WAPI_VALIDATE_PTR(table);
+	WAPI_VALIDATE_PTR(mon);
+
+	m = calloc(1, sizeof(wapi_ap_sta_mon_t));
+	if (!m)
+	{
+		WAPI_STRERROR("calloc()");
+		return -ENOMEM;
+	}
+	m->ctx = ctx;
+	m->table = table;
+	snprintf(m->ifname, IFNAMSIZ, "%s", ifname);
+
+	if ((ret = m->ifindex = wapi_nl80211_ifindex(ifname)) < 0)
+	{
+		free(m);
+		return ret;
+	}
+
+	/* Subscribe before the dump, so that no event slips through. */
+	if ((ret = nl80211_subscribe("mlme", &m->sock, &m->family)) < 0 ||
+		(ret = wapi_ctx_ap_sta_table_fill(ctx, ifname, table)) < 0)
+	{
+		wapi_ap_sta_mon_close(m);
+		return ret;
+	}
+
+	*mon = m;
+	return 0;
+}
+
+
+int
+wapi_ap_sta_mon_fd(const wapi_ap_sta_mon_t *mon)
+{
+	WAPI_VALIDATE_PTR(mon);
+	return nl_socket_get_fd(mon->sock);
+}
+
+
+/* Applies a station event. Returns 1 if the table is changed. */
+static int
+wapi_ap_sta_mon_event(const struct nlmsghdr *nlh, void *arg)
+{
+	wapi_ap_sta_mon_t *mon = arg;
+	struct genlmsghdr *gnlh = nlmsg_data(nlh);
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	const struct ether_addr *mac;
+	wapi_sta_info_t info;
+	int ret;
+
+	if (nlh->nlmsg_type != mon->family ||
+		nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN) ||
+		(gnlh->cmd != NL80211_CMD_NEW_STATION &&
+		 gnlh->cmd != NL80211_CMD_DEL_STATION))
+		return 0;
+
+	nla_parse(
+		tb, NL80211_ATTR_MAX,
+		genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
+	if (!tb[NL80211_ATTR_IFINDEX] ||
+		(int) nla_get_u32(tb[NL80211_ATTR_IFINDEX]) != mon->ifindex ||
+		!tb[NL80211_ATTR_MAC] || nla_len(tb[NL80211_ATTR_MAC]) < ETH_ALEN)
+		return 0;
+	mac = nla_data(tb[NL80211_ATTR_MAC]);
+
+	if (gnlh->cmd == NL80211_CMD_DEL_STATION)
+		return wapi_ap_sta_table_del(mon->table, mac) < 0 ? 0 : 1;
+
+	/* Events carry barely any statistics, fetch them. A station gone in the
+	 * meantime has its DEL_STATION event queued already. */
+	ret = wapi_ctx_sta_get(mon->ctx, mon->ifname, mac, &info);
+	if (ret == -ENOENT)
+		return 0;
+	if (ret < 0 || (ret = wapi_ap_sta_table_add(&info, mon->table)) < 0)
+		return ret;
+
+	return 1;
+}
+
+
+/* Events are lost, start over. */
+static int
+wapi_ap_sta_mon_overrun(void *arg)
+{
+	wapi_ap_sta_mon_t *mon = arg;
+	int ret;
+
+	ret = wapi_ctx_ap_sta_table_fill(mon->ctx, mon->ifname, mon->table);
+	return ret < 0 ? ret : 1;
+}
+
+
+int
+wapi_ap_sta_mon_process(wapi_ap_sta_mon_t *mon)
+{
+	WAPI_VALIDATE_PTR(mon);
+	return wapi_netlink_process(
+		nl_socket_get_fd(mon->sock),
+		wapi_ap_sta_mon_event, wapi_ap_sta_mon_overrun, mon);
+}
+
+
+void
+wapi_ap_sta_mon_close(wapi_ap_sta_mon_t *mon)
+{
+	if (!mon) return;
+	if (mon->sock) nl_socket_free(mon->sock);
+	free(mon);
+}
+
+
+typedef struct wapi_ap_sta_kick_req_t {
+	const char *ifname;
+	const struct ether_addr *macs;
+	size_t n;
+	int subtype;
+	unsigned int reason;
+	int *errors;				/* Positive while in flight. */
+	size_t base;				/* First station in flight. */
+	unsigned int seq;			/* Its sequence number. */
+	size_t inflight;
+	size_t pending;
+} wapi_ap_sta_kick_req_t;
+
+
+/* Replies of a batch carry different sequence numbers, let them all in. */
+static int
+wapi_ap_sta_kick_seq_cb(struct nl_msg *msg, void *arg)
+{
+	(void) msg;
+	(void) arg;
+	return NL_OK;
+}
+
+
+static void
+wapi_ap_sta_kick_reply(wapi_ap_sta_kick_req_t *req, unsigned int seq, int error)
+{
+	size_t k = seq - req->seq;
+
+	if (k < req->inflight && req->errors[req->base + k] > 0)
+	{
+		req->errors[req->base + k] = error;
+		req->pending--;
+	}
+}
+
+
+static int
+wapi_ap_sta_kick_err_cb(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+	(void) nla;
+	wapi_ap_sta_kick_reply(arg, err->msg.nlmsg_seq, err->error);
+	return NL_SKIP;
+}
+
+
+static int
+wapi_ap_sta_kick_ack_cb(struct nl_msg *msg, void *arg)
+{
+	wapi_ap_sta_kick_reply(arg, nlmsg_hdr(msg)->nlmsg_seq, 0);
+	return NL_OK;
+}
+
+
+/* Sends the DEL_STATION request of a single station. */
+static int
+wapi_ap_sta_kick_send(
+	struct nl_sock *sock,
+	int family,
+	int ifindex,
+	const wapi_ap_sta_kick_req_t *req,
+	const struct ether_addr *mac,
+	unsigned int *seq)
+{
+	struct nl_msg *msg;
+	int ret;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+	{
+		WAPI_ERROR("nlmsg_alloc() failed!\n");
+		return -ENOMEM;
+	}
+
+	genlmsg_put(
+		msg, NL_AUTO_PID, NL_AUTO_SEQ, family, 0, 0,
+		NL80211_CMD_DEL_STATION, 0);
+	NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
+	NLA_PUT(msg, NL80211_ATTR_MAC, ETH_ALEN, mac);
+	NLA_PUT_U8(msg, NL80211_ATTR_MGMT_SUBTYPE, req->subtype);
+	NLA_PUT_U16(msg, NL80211_ATTR_REASON_CODE, req->reason);
+
+	if ((ret = nl_send_auto_complete(sock, msg)) < 0)
+		WAPI_ERROR("nl_send_auto_complete() failed!\n");
+	else
+		*seq = nlmsg_hdr(msg)->nlmsg_seq;
+
+exit:
+	nlmsg_free(msg);
+	return ret;
+
+nla_put_failure:
+	WAPI_ERROR("nla_put_failure!\n");
+	ret = -1;
+	goto exit;
+}
+
+
+static int
+wapi_ap_sta_kick_handler(struct nl_sock *sock, int family, void *arg)
+{
+	wapi_ap_sta_kick_req_t *req = arg;
+	struct nl_cb *cb;
+	int ifindex;
+	size_t k;
+	int ret = 0;
+
+	if ((ifindex = wapi_nl80211_ifindex(req->ifname)) < 0)
+		return ifindex;
+
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!cb)
+	{
+		WAPI_ERROR("nl_cb_alloc() failed\n");
+		return -1;
+	}
+	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, wapi_ap_sta_kick_seq_cb, NULL);
+	nl_cb_err(cb, NL_CB_CUSTOM, wapi_ap_sta_kick_err_cb, req);
+	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, wapi_ap_sta_kick_ack_cb, req);
+
+	/* Send requests in chunks, so that replies fit into the receive queue. */
+	for (req->base = 0; req->base < req->n && ret >= 0;
+		 req->base += req->inflight)
+	{
+		size_t n = req->n - req->base;
+		unsigned int seq;
+
+		if (n > WAPI_RTNL_BATCH_MAX) n = WAPI_RTNL_BATCH_MAX;
+		for (k = 0; k < n; k++)
+		{
+			ret = wapi_ap_sta_kick_send(
+				sock, family, ifindex, req, &req->macs[req->base + k], &seq);
+			if (ret < 0) break;
+			if (!k) req->seq = seq;
+			req->errors[req->base + k] = 1;
+		}
+		req->inflight = req->pending = k;
+
+		while (req->pending)
+			if (nl_recvmsgs(sock, cb) < 0)
+			{
+				WAPI_ERROR("nl_recvmsgs() failed!\n");
+				ret = -1;
+				break;
+			}
+	}
+
+	/* Replies lost along with a failure. */
+	for (k = 0; k < req->n; k++)
+		if (req->errors[k] > 0) req->errors[k] = -EIO;
+
+	nl_cb_put(cb);
+	return ret < 0 ? -1 : 0;
+}
+
+
+int
+wapi_ap_sta_kick(
+	const char *ifname,
+	const struct ether_addr *macs,
+	size_t n,
+	wapi_sta_kick_t kind,
+	unsigned int reason,
+	int *errors)
+{
+	return wapi_ctx_ap_sta_kick(NULL, ifname, macs, n, kind, reason, errors);
+}
+
+
+int
+wapi_ctx_ap_sta_kick(
+	wapi_ctx_t *wctx,
+	const char *ifname,
+	const struct ether_addr *macs,
+	size_t n,
+	wapi_sta_kick_t kind,
+	unsigned int reason,
+	int *errors)
+{
+	wapi_ap_sta_kick_req_t req;
+	int *errs = errors;
+	int nfailed = 0;
+	size_t k;
+	int ret;
+
+	WAPI_VALIDATE_PTR(ifname);
+	if (!n) return 0;
+	WAPI_VALIDATE_PTR(macs);
+
+	if (!errs && !(errs = malloc(n * sizeof(int))))
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
+	}
+
+	bzero(&req, sizeof(req));
+	req.ifname = ifname;
+	req.macs = macs;
+	req.n = n;
+	req.subtype = kind == WAPI_STA_DEAUTH
+		? WAPI_MGMT_SUBTYPE_DEAUTH : WAPI_MGMT_SUBTYPE_DISASSOC;
+	req.reason = reason ? reason : WAPI_REASON_AP_BUSY;
+	req.errors = errs;
+
+	for (k = 0; k < n; k++) errs[k] = -ECANCELED;
+	ret = nl80211_with(wctx, wapi_ap_sta_kick_handler, &req);
+	for (k = 0; k < n; k++)
+		if (errs[k]) nfailed++;
+
+	if (!errors) free(errs);
+	return ret < 0 ? ret : nfailed;
+}
+
+
+/*-- Interface Handles -------------------------------------------------------*/
+
+
+/* Slots of the frequency hash, twice the number of frequencies in a range. */
+#define WAPI_CHAN_MAP_SIZE 64
+
+
+/* Channel tables of a range, built along with the range itself. */
+typedef struct wapi_chan_map_t {
+	unsigned int khz[256];				/* By channel, 0 if unknown. */
+	struct {
+		unsigned int khz;				/* 0 for an empty slot. */
+		unsigned char chan;
+	} slots[WAPI_CHAN_MAP_SIZE];		/* Open addressing by frequency. */
+} wapi_chan_map_t;
+
+
+struct wapi_iface_t {
+	wapi_ctx_t *ctx;
+	int fd;						/* RTMGRP_LINK listener. */
+	int ifindex;				/* 0 if the interface is gone. */
+	struct iwreq wrq;			/* Request template with "ifr_name" set. */
+	int has_range;
+	struct iw_range range;
+	wapi_chan_map_t chans;
+	wapi_scan_buf_t scan_buf;	/* Sized after the largest scan of the iface. */
+};
+
+
+static inline unsigned int
+wapi_chan_map_slot(unsigned int khz)
+{
+	return (khz * 2654435761u) >> 26;		/* log2(WAPI_CHAN_MAP_SIZE) bits */
+}
+
+
+static void
+wapi_chan_map_build(wapi_chan_map_t *map, const struct iw_range *range)
+{
+	int k;
+
+	bzero(map, sizeof(wapi_chan_map_t));
+	for (k = 0; k < range->num_frequency && k < IW_MAX_FREQUENCIES; k++)
+	{
+		unsigned int khz = wapi_iwfreq2khz(&range->freq[k]);
+		unsigned int slot;
+
+		if (!khz) continue;
+
+		/* First entry wins, like the linear scans do. */
+		if (!map->khz[range->freq[k].i])
+			map->khz[range->freq[k].i] = khz;
+
+		for (slot = wapi_chan_map_slot(khz);
+			 map->slots[slot].khz && map->slots[slot].khz != khz;
+			 slot = (slot + 1) & (WAPI_CHAN_MAP_SIZE - 1));
+		if (!map->slots[slot].khz)
+		{
+			map->slots[slot].khz = khz;
+			map->slots[slot].chan = range->freq[k].i;
+		}
+	}
+}
+
+
+/* Points the handle to the interface currently named as in the template. */
+static int
+wapi_iface_resolve(wapi_iface_t *iface)
+{
+	iface->has_range = 0;
+	iface->ifindex = if_nametoindex(iface->wrq.ifr_name);
+	if (!iface->ifindex)
+	{
+		WAPI_STRERROR("if_nametoindex(\"%s\")", iface->wrq.ifr_name);
+		return -1;
+	}
+	return 0;
+}
+
+
+static void
+wapi_iface_event(wapi_iface_t *iface, const struct nlmsghdr *nlh)
+{
+	const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_MAX + 1];
+
+	if ((nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK) ||
+		nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)) ||
+		ifi->ifi_index != iface->ifindex)
+		return;
+
+	/* Removal, resolve the name again on next use. */
+	if (nlh->nlmsg_type == RTM_DELLINK)
+	{
+		iface->ifindex = 0;
+		iface->has_range = 0;
+		return;
+	}
+
+	/* Rename, follow the device. */
+	wapi_rtnl_parse(
+		tb, IFLA_MAX, IFLA_RTA(ifi), nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)));
+	if (tb[IFLA_IFNAME])
+		snprintf(
+			iface->wrq.ifr_name, IFNAMSIZ, "%s",
+			(const char *) RTA_DATA(tb[IFLA_IFNAME]));
+}
+
+
+int
+wapi_iface_process(wapi_iface_t *iface)
+{
+	char buf[WAPI_RTNL_BUFSIZ];
+	ssize_t len;
+
+	WAPI_VALIDATE_PTR(iface);
+
+	while ((len = recv(iface->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+	{
+		const struct nlmsghdr *nlh;
+
+		for (nlh = (const struct nlmsghdr *) buf;
+			 NLMSG_OK(nlh, len);
+			 nlh = NLMSG_NEXT(nlh, len))
+			wapi_iface_event(iface, nlh);
+	}
+
+	if (len < 0 && errno == ENOBUFS)
+	{
+		/* Events are lost, trust nothing. */
+		iface->ifindex = 0;
+		iface->has_range = 0;
+		return wapi_iface_process(iface);
+	}
+	if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	{
+		WAPI_STRERROR("recv(AF_NETLINK)");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Applies pending link events and makes sure the handle points somewhere. */
+static int
+wapi_iface_sync(wapi_iface_t *iface)
+{
+	int ret;
+
+	WAPI_VALIDATE_PTR(iface);
+
+	if ((ret = wapi_iface_process(iface)) < 0)
+		return ret;
+	if (!iface->ifindex)
+		return wapi_iface_resolve(iface);
+
+	return 0;
+}
+
+
+/* Fetches the range of the interface, unless it is already cached. */
+static int
+wapi_iface_range(wapi_iface_t *iface)
+{
+	struct iwreq wrq;
+	int ret;
+
+	if ((ret = wapi_iface_sync(iface)) < 0 || iface->has_range)
+		return ret;
+
+	wrq = iface->wrq;
+	if ((ret = wapi_get_range(iface->ctx->sock, &wrq, &iface->range)) >= 0)
+	{
+		wapi_chan_map_build(&iface->chans, &iface->range);
+		iface->has_range = 1;
+	}
+
+	return ret;
+}
+
+
+int
+wapi_iface_open(wapi_ctx_t *ctx, const char *ifname, wapi_iface_t **iface)
+{
+	wapi_iface_t *i;
+
+	WAPI_VALIDATE_PTR(ctx);
+	WAPI_VALIDATE_PTR(ifname);
+	WAPI_VALIDATE_PTR(iface);
+
+	i = malloc(sizeof(wapi_iface_t));
+	if (!i)
+	{
+		WAPI_STRERROR("malloc()");
+		return -1;
+	}
+	bzero(i, sizeof(wapi_iface_t));
+	i->ctx = ctx;
+	strncpy(i->wrq.ifr_name, ifname, IFNAMSIZ - 1);
+
+	/* Subscribe before resolving, so that no event slips through. */
+	if ((i->fd = wapi_rtnl_open(RTMGRP_LINK)) < 0)
+	{
+		free(i);
+		return -1;
+	}
+
+	if (wapi_iface_resolve(i) < 0)
+	{
+		wapi_iface_close(i);
+		return -1;
+	}
+
+	*iface = i;
+	return 0;
+}
+
+
+void
+wapi_iface_close(wapi_iface_t *iface)
+{
+	if (!iface) return;
+	close(iface->fd);
+	free(iface->scan_buf.data);
+	free(iface);
+}
+
+
+int
+wapi_iface_fd(const wapi_iface_t *iface)
+{
+	WAPI_VALIDATE_PTR(iface);
+	return iface->fd;
+}
+
+
+int
+wapi_iface_ifindex(wapi_iface_t *iface)
+{
+	int ret;
+
+	if ((ret = wapi_iface_sync(iface)) < 0)
+		return ret;
+	return iface->ifindex;
+}
+
+
+const char *
+wapi_iface_name(const wapi_iface_t *iface)
+{
+	return iface ? iface->wrq.ifr_name : NULL;
+}
+
+
+int
+wapi_iface_get_we_version(wapi_iface_t *iface, int *we_version)
+{
+	int ret;
+
+	WAPI_VALIDATE_PTR(we_version);
+
+	if ((ret = wapi_iface_range(iface)) >= 0)
+		*we_version = (int) iface->range.we_version_compiled;
+
+	return ret;
+}
+
+
+int
+wapi_iface_freq2chan(wapi_iface_t *iface, double freq, int *chan)
+{
+	int ret;
+
+	unsigned int khz = (unsigned int) (freq / 1e3 + 0.5);
+	unsigned int slot;
+
+	WAPI_VALIDATE_PTR(chan);
+
+	if ((ret = wapi_iface_range(iface)) < 0)
+		return ret;
+
+	for (slot = wapi_chan_map_slot(khz);
+		 iface->chans.slots[slot].khz;
+		 slot = (slot + 1) & (WAPI_CHAN_MAP_SIZE - 1))
+		if (iface->chans.slots[slot].khz == khz)
+		{
+			*chan = iface->chans.slots[slot].chan;
+			return 0;
+		}
+
+	WAPI_ERROR("No channel matches for the given frequency!\n");
+	return -2;
+}
+
+
+int
+wapi_iface_chan2freq(wapi_iface_t *iface, int chan, double *freq)
+{
+	int ret;
+
+	WAPI_VALIDATE_PTR(freq);
+
+	if ((ret = wapi_iface_range(iface)) < 0)
+		return ret;
+
+	if (chan < 0 || chan > 255 || !iface->chans.khz[chan])
+	{
+		WAPI_ERROR("No frequency matches for the given channel!\n");
+		return -2;
+	}
+
+	*freq = iface->chans.khz[chan] * 1e3;
+	return 0;
+}
+
+
+int
+wapi_iface_scan_coll(wapi_iface_t *iface, wapi_list_t *aps)
+{
+	struct iwreq wrq;
+	int ret;
+
+	WAPI_VALIDATE_PTR(aps);
+
+	if ((ret = wapi_iface_range(iface)) < 0)
+		return ret;
+
+	wrq = iface->wrq;
+	return wapi_scan_coll_we(
+		iface->ctx->sock, &wrq, iface->range.we_version_compiled,
+		&iface->scan_buf, aps);
+}
+
+
+int
+wapi_iface_scan_visit(
+	wapi_iface_t *iface,
+	wapi_scan_visit_cb_t cb,
+	void *arg)
+{
+	struct iwreq wrq;
+	int ret;
+
+	WAPI_VALIDATE_PTR(cb);
+
+	if ((ret = wapi_iface_range(iface)) < 0)
+		return ret;
+
+	wrq = iface->wrq;
+	return wapi_scan_visit_we(
+		iface->ctx->sock, &wrq, iface->range.we_version_compiled,
+		&iface->scan_buf, cb, arg);
+}
+
+
+int
+wapi_iface_if_add(wapi_iface_t *iface, const char *name, wapi_mode_t mode)
+{
+	wapi_nl80211_ctx_t ctx;
+	int ret;
+
+	if ((ret = wapi_iface_sync(iface)) < 0)
+		return ret;
+
+	ctx.ifname = iface->wrq.ifr_name;
+	ctx.ifindex = iface->ifindex;
+	ctx.cmd = WAPI_NL80211_CMD_IFADD;
+	ctx.u.ifadd.name = name;
+	ctx.u.ifadd.mode = mode;
+	return nl80211_with(iface->ctx, nl80211_cmd_handler, &ctx);
+}
+
+
+int
+wapi_iface_if_del(wapi_iface_t *iface)
+{
+	wapi_nl80211_ctx_t ctx;
+	int ret;
+
+	if ((ret = wapi_iface_sync(iface)) < 0)
+		return ret;
+
+	ctx.ifname = iface->wrq.ifr_name;
+	ctx.ifindex = iface->ifindex;
 	ctx.cmd = WAPI_NL80211_CMD_IFDEL;
-	return nl80211_cmd_handler(&ctx);
+	return nl80211_with(iface->ctx, nl80211_cmd_handler, &ctx);
 }